@@ -0,0 +1,137 @@
+#include "td_main.h"
+#include <raymath.h>
+#include <math.h>
+
+// Area damage events (catapult splashes, enemy explosions) are queued during
+// the tick and resolved together in AreaDamageUpdate. Resolving them in one
+// pass lets us bucket the enemies into a grid once, so every event only has
+// to look at the enemies in the cells it overlaps instead of all enemies.
+void AreaDamageInit(World *world)
+{
+  world->areaDamageCount = 0;
+  world->areaDamageSequence = 0;
+}
+
+static int AreaDamageGetCell(float position)
+{
+  // positions outside the grid are clamped into the border cells; the 
+  // queries are clamped the same way, so those enemies are still found
+  int cell = (int)floorf(position / AREA_DAMAGE_GRID_CELL_SIZE) + AREA_DAMAGE_GRID_SIZE / 2;
+  return cell < 0 ? 0 : (cell >= AREA_DAMAGE_GRID_SIZE ? AREA_DAMAGE_GRID_SIZE - 1 : cell);
+}
+
+static void AreaDamageBuildEnemyGrid(World *world)
+{
+  const int cellCount = AREA_DAMAGE_GRID_SIZE * AREA_DAMAGE_GRID_SIZE;
+  uint16_t *cellStart = world->areaDamageCellStart;
+  for (int i = 0; i <= cellCount; i++)
+  {
+    cellStart[i] = 0;
+  }
+
+  // counting sort: count the enemies per cell, turn the counts into start
+  // offsets and then place the enemies
+  for (int i = 0; i < world->enemyCount; i++)
+  {
+    Enemy *enemy = &world->enemies[i];
+    if (enemy->enemyType == ENEMY_TYPE_NONE)
+    {
+      continue;
+    }
+    int cell = AreaDamageGetCell(enemy->simPosition.y) * AREA_DAMAGE_GRID_SIZE + AreaDamageGetCell(enemy->simPosition.x);
+    cellStart[cell + 1]++;
+  }
+  for (int i = 0; i < cellCount; i++)
+  {
+    cellStart[i + 1] += cellStart[i];
+  }
+  uint16_t cellFill[AREA_DAMAGE_GRID_SIZE * AREA_DAMAGE_GRID_SIZE];
+  for (int i = 0; i < cellCount; i++)
+  {
+    cellFill[i] = cellStart[i];
+  }
+  for (int i = 0; i < world->enemyCount; i++)
+  {
+    Enemy *enemy = &world->enemies[i];
+    if (enemy->enemyType == ENEMY_TYPE_NONE)
+    {
+      continue;
+    }
+    int cell = AreaDamageGetCell(enemy->simPosition.y) * AREA_DAMAGE_GRID_SIZE + AreaDamageGetCell(enemy->simPosition.x);
+    world->areaDamageCellEnemies[cellFill[cell]++] = i;
+  }
+}
+
+static void AreaDamageResolve(World *world, AreaDamage *areaDamage, uint32_t sequence)
+{
+  const uint16_t *cellStart = world->areaDamageCellStart;
+  const uint16_t *cellEnemies = world->areaDamageCellEnemies;
+  float radius2 = areaDamage->radius * areaDamage->radius;
+  int minX = AreaDamageGetCell(areaDamage->position.x - areaDamage->radius);
+  int maxX = AreaDamageGetCell(areaDamage->position.x + areaDamage->radius);
+  int minY = AreaDamageGetCell(areaDamage->position.y - areaDamage->radius);
+  int maxY = AreaDamageGetCell(areaDamage->position.y + areaDamage->radius);
+  for (int y = minY; y <= maxY; y++)
+  {
+    for (int x = minX; x <= maxX; x++)
+    {
+      int cell = y * AREA_DAMAGE_GRID_SIZE + x;
+      for (int i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+      {
+        Enemy *enemy = &world->enemies[cellEnemies[i]];
+        if (enemy->enemyType == ENEMY_TYPE_NONE)
+        {
+          continue;
+        }
+        float distanceSqr = Vector2DistanceSqr(areaDamage->position, enemy->simPosition);
+        if (distanceSqr >= radius2)
+        {
+          continue;
+        }
+        // the area damage that pushes back comes from exploding enemies, which
+        // spare an enemy right at their center; there's no way to push it
+        if (areaDamage->pushbackPower > 0.0f && distanceSqr == 0.0f)
+        {
+          continue;
+        }
+        if (areaDamage->pushbackPower > 0.0f)
+        {
+          Vector2 direction = Vector2Normalize(Vector2Subtract(enemy->simPosition, areaDamage->position));
+          enemy->simPosition = Vector2Add(enemy->simPosition, Vector2Scale(direction, areaDamage->pushbackPower));
+        }
+        EnemyQueueDamage(world, enemy, areaDamage->damage,
+          ENEMY_DAMAGE_SORT_KEY(ENEMY_DAMAGE_SOURCE_AREA, ((uint64_t)sequence << 16) | cellEnemies[i]));
+      }
+    }
+  }
+}
+
+void AreaDamageUpdate(World *world)
+{
+  if (world->areaDamageCount == 0)
+  {
+    return;
+  }
+
+  AreaDamageBuildEnemyGrid(world);
+  for (int i = 0; i < world->areaDamageCount; i++)
+  {
+    AreaDamageResolve(world, &world->areaDamages[i], world->areaDamageSequence++);
+  }
+  world->areaDamageCount = 0;
+}
+
+void AreaDamageAdd(World *world, Vector2 position, float radius, float damage, float pushbackPower)
+{
+  if (world->areaDamageCount >= AREA_DAMAGE_MAX_COUNT)
+  {
+    // the queue is full; resolve what we have so far instead of dropping the event
+    AreaDamageUpdate(world);
+  }
+
+  AreaDamage *areaDamage = &world->areaDamages[world->areaDamageCount++];
+  areaDamage->position = position;
+  areaDamage->radius = radius;
+  areaDamage->damage = damage;
+  areaDamage->pushbackPower = pushbackPower;
+}
\ No newline at end of file
@@ -0,0 +1,395 @@
+#include "td_main.h"
+#include <stdio.h>
+#include <string.h>
+
+// All models and textures are loaded through this cache. It is keyed by the
+// file path, so every file is loaded only once per process no matter how often
+// it is requested; the reference count tells us when it can be unloaded again.
+static AssetCacheEntry assetCacheEntries[ASSET_CACHE_MAX_COUNT];
+static int assetCacheEntryCount = 0;
+static AssetLoadStats assetLoadStats = {0};
+
+static AssetCacheEntry *AssetCacheFind(const char *path, uint8_t assetType)
+{
+  for (int i = 0; i < assetCacheEntryCount; i++)
+  {
+    AssetCacheEntry *entry = &assetCacheEntries[i];
+    if (entry->refCount > 0 && entry->assetType == assetType && strcmp(entry->path, path) == 0)
+    {
+      return entry;
+    }
+  }
+  return 0;
+}
+
+static AssetCacheEntry *AssetCacheAdd(const char *path, uint8_t assetType)
+{
+  AssetCacheEntry *entry = 0;
+  for (int i = 0; i < assetCacheEntryCount; i++)
+  {
+    if (assetCacheEntries[i].refCount == 0)
+    {
+      entry = &assetCacheEntries[i];
+      break;
+    }
+  }
+  if (!entry)
+  {
+    if (assetCacheEntryCount >= ASSET_CACHE_MAX_COUNT)
+    {
+      TraceLog(LOG_WARNING, "ASSETS: cache is full, can't load %s", path);
+      return 0;
+    }
+    entry = &assetCacheEntries[assetCacheEntryCount++];
+  }
+
+  *entry = (AssetCacheEntry){0};
+  strncpy(entry->path, path, ASSET_PATH_MAX_LENGTH - 1);
+  entry->assetType = assetType;
+  return entry;
+}
+
+Model AssetCacheLoadModel(const char *path)
+{
+  AssetCacheEntry *entry = AssetCacheFind(path, ASSET_TYPE_MODEL);
+  if (!entry)
+  {
+    entry = AssetCacheAdd(path, ASSET_TYPE_MODEL);
+    if (!entry)
+    {
+      return (Model){0};
+    }
+    double startTime = GetTime();
+    // prefer the asset pack; fall back to parsing the file if it isn't packed
+    if (AssetPackIsOpen() && AssetPackLoadModel(path, &entry->model, &assetLoadStats))
+    {
+      entry->isPacked = 1;
+    }
+    else
+    {
+      entry->model = LoadModel(path);
+      assetLoadStats.fileReads++;
+      assetLoadStats.bytesRead += GetFileLength(path);
+      // the file is read into a buffer and then decoded into the mesh arrays
+      assetLoadStats.bytesCopied += GetFileLength(path);
+      for (int i = 0; i < entry->model.meshCount; i++)
+      {
+        Mesh *mesh = &entry->model.meshes[i];
+        assetLoadStats.bytesCopied += mesh->vertexCount * (3 + 2 + 3) * sizeof(float);
+        assetLoadStats.bytesCopied += mesh->colors ? mesh->vertexCount * 4 : 0;
+        assetLoadStats.bytesCopied += mesh->indices ? mesh->triangleCount * 3 * sizeof(unsigned short) : 0;
+      }
+    }
+    assetLoadStats.loadTime += GetTime() - startTime;
+  }
+  entry->refCount++;
+  return entry->model;
+}
+
+// decoded is an image that was already decoded by a loader job, or null
+static Texture2D AssetCacheLoadDecodedTexture(const char *path, Image *decoded)
+{
+  AssetCacheEntry *entry = AssetCacheFind(path, ASSET_TYPE_TEXTURE);
+  if (!entry)
+  {
+    entry = AssetCacheAdd(path, ASSET_TYPE_TEXTURE);
+    if (!entry)
+    {
+      return (Texture2D){0};
+    }
+    double startTime = GetTime();
+    if (AssetPackIsOpen() && AssetPackLoadTexture(path, &entry->texture, &assetLoadStats))
+    {
+      entry->isPacked = 1;
+    }
+    else if (decoded && decoded->data)
+    {
+      entry->texture = LoadTextureFromImage(*decoded);
+      assetLoadStats.fileReads++;
+      assetLoadStats.bytesRead += GetFileLength(path);
+      assetLoadStats.bytesCopied += GetFileLength(path) + entry->texture.width * entry->texture.height * 4;
+    }
+    else
+    {
+      entry->texture = LoadTexture(path);
+      assetLoadStats.fileReads++;
+      assetLoadStats.bytesRead += GetFileLength(path);
+      // the file is read into a buffer and then decoded to RGBA pixels
+      assetLoadStats.bytesCopied += GetFileLength(path) + entry->texture.width * entry->texture.height * 4;
+    }
+    assetLoadStats.loadTime += GetTime() - startTime;
+  }
+  entry->refCount++;
+  return entry->texture;
+}
+
+Texture2D AssetCacheLoadTexture(const char *path)
+{
+  return AssetCacheLoadDecodedTexture(path, 0);
+}
+
+static void AssetCacheUnloadEntry(AssetCacheEntry *entry)
+{
+  if (entry->assetType == ASSET_TYPE_MODEL && entry->isPacked)
+  {
+    AssetPackUnloadModel(entry->model);
+  }
+  else if (entry->assetType == ASSET_TYPE_MODEL)
+  {
+    UnloadModel(entry->model);
+  }
+  else if (entry->assetType == ASSET_TYPE_TEXTURE)
+  {
+    UnloadTexture(entry->texture);
+  }
+  *entry = (AssetCacheEntry){0};
+}
+
+static void AssetCacheRelease(AssetCacheEntry *entry)
+{
+  if (--entry->refCount == 0)
+  {
+    AssetCacheUnloadEntry(entry);
+  }
+}
+
+void AssetCacheReleaseModel(Model model)
+{
+  // models handed out by the cache share the mesh array with the cached model
+  for (int i = 0; i < assetCacheEntryCount; i++)
+  {
+    AssetCacheEntry *entry = &assetCacheEntries[i];
+    if (entry->refCount > 0 && entry->assetType == ASSET_TYPE_MODEL && entry->model.meshes == model.meshes)
+    {
+      AssetCacheRelease(entry);
+      return;
+    }
+  }
+}
+
+void AssetCacheReleaseTexture(Texture2D texture)
+{
+  for (int i = 0; i < assetCacheEntryCount; i++)
+  {
+    AssetCacheEntry *entry = &assetCacheEntries[i];
+    if (entry->refCount > 0 && entry->assetType == ASSET_TYPE_TEXTURE && entry->texture.id == texture.id)
+    {
+      AssetCacheRelease(entry);
+      return;
+    }
+  }
+}
+
+AssetLoadStats AssetCacheGetStats()
+{
+  AssetLoadStats stats = assetLoadStats;
+  if (AssetPackIsOpen())
+  {
+    // opening the pack is the only file access of the pack loader
+    stats.fileReads++;
+  }
+  return stats;
+}
+
+//# Asynchronous loading
+// Requested assets are read and decoded by jobs on the worker threads. Only
+// the GPU upload is done on the main thread, in AssetCacheUpdateRequests, which
+// finishes the requests in the order they were made. raylib can't parse a
+// glTF file without uploading it, so for models the jobs only read the file;
+// LoadModel then gets the file content through the LoadFileData callback.
+static AssetRequest assetRequests[ASSET_REQUEST_MAX_COUNT];
+static int assetRequestCount = 0;
+static int assetRequestsFinished = 0;
+// the request whose file content the LoadFileData callback hands to LoadModel
+static AssetRequest *assetRequestInUpload = 0;
+
+static unsigned char *AssetCacheReadFile(const char *path, int *dataSize)
+{
+  *dataSize = 0;
+  FILE *file = fopen(path, "rb");
+  if (!file)
+  {
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  unsigned char *data = size > 0 ? (unsigned char *)MemAlloc(size) : 0;
+  if (data && fread(data, 1, size, file) == (size_t)size)
+  {
+    *dataSize = (int)size;
+  }
+  else
+  {
+    MemFree(data);
+    data = 0;
+  }
+  fclose(file);
+  return data;
+}
+
+// raylib calls this for every LoadFileData call while requests are loading,
+// also from the worker threads that decode images
+static unsigned char *AssetCacheLoadFileData(const char *fileName, int *dataSize)
+{
+  AssetRequest *request = __atomic_load_n(&assetRequestInUpload, __ATOMIC_ACQUIRE);
+  if (request && request->fileData && strcmp(request->path, fileName) == 0)
+  {
+    // raylib frees the data with UnloadFileData, so we hand over the ownership
+    unsigned char *data = request->fileData;
+    *dataSize = request->fileDataSize;
+    request->fileData = 0;
+    return data;
+  }
+  return AssetCacheReadFile(fileName, dataSize);
+}
+
+static void AssetCacheDecodeJob(void *data)
+{
+  AssetRequest *request = (AssetRequest *)data;
+  if (request->assetType == ASSET_TYPE_TEXTURE)
+  {
+    request->image = LoadImage(request->path);
+  }
+  else
+  {
+    request->fileData = AssetCacheReadFile(request->path, &request->fileDataSize);
+  }
+  __atomic_store_n(&request->state, ASSET_REQUEST_DECODED, __ATOMIC_RELEASE);
+}
+
+static AssetRequest *AssetCacheAddRequest(const char *path, uint8_t assetType)
+{
+  if (assetRequestCount >= ASSET_REQUEST_MAX_COUNT)
+  {
+    TraceLog(LOG_WARNING, "ASSETS: too many requests, can't load %s", path);
+    return 0;
+  }
+  if (assetRequestCount == 0 || assetRequestsFinished == assetRequestCount)
+  {
+    SetLoadFileDataCallback(AssetCacheLoadFileData);
+  }
+
+  AssetRequest *request = &assetRequests[assetRequestCount++];
+  *request = (AssetRequest){0};
+  strncpy(request->path, path, ASSET_PATH_MAX_LENGTH - 1);
+  request->assetType = assetType;
+
+  // packed and already cached assets have nothing to decode
+  if (AssetCacheFind(path, assetType) || AssetPackContains(path, assetType))
+  {
+    request->state = ASSET_REQUEST_DECODED;
+  }
+  else
+  {
+    request->state = ASSET_REQUEST_QUEUED;
+    JobSystemSubmit(AssetCacheDecodeJob, request);
+  }
+  return request;
+}
+
+void AssetCacheRequestModel(const char *path, Model *model, Texture2D *diffuseTexture)
+{
+  AssetRequest *request = AssetCacheAddRequest(path, ASSET_TYPE_MODEL);
+  if (request)
+  {
+    request->model = model;
+    request->diffuseTexture = diffuseTexture;
+  }
+}
+
+void AssetCacheRequestTexture(const char *path, Texture2D *texture, int textureFilter)
+{
+  AssetRequest *request = AssetCacheAddRequest(path, ASSET_TYPE_TEXTURE);
+  if (request)
+  {
+    request->texture = texture;
+    request->textureFilter = textureFilter;
+  }
+}
+
+static void AssetCacheFinishRequest(AssetRequest *request)
+{
+  if (request->assetType == ASSET_TYPE_TEXTURE)
+  {
+    *request->texture = AssetCacheLoadDecodedTexture(request->path, &request->image);
+    SetTextureFilter(*request->texture, request->textureFilter);
+    if (request->image.data)
+    {
+      UnloadImage(request->image);
+    }
+    return;
+  }
+
+  __atomic_store_n(&assetRequestInUpload, request, __ATOMIC_RELEASE);
+  *request->model = AssetCacheLoadModel(request->path);
+  __atomic_store_n(&assetRequestInUpload, 0, __ATOMIC_RELEASE);
+  // the model was already cached if LoadModel didn't take the file content
+  MemFree(request->fileData);
+  request->fileData = 0;
+
+  // the texture is uploaded before the model since requests finish in order
+  if (request->diffuseTexture && request->model->materialCount > 1)
+  {
+    request->model->materials[1].maps[MATERIAL_MAP_DIFFUSE].texture = *request->diffuseTexture;
+  }
+}
+
+float AssetCacheUpdateRequests(double timeBudget)
+{
+  double startTime = GetTime();
+  while (assetRequestsFinished < assetRequestCount && GetTime() - startTime < timeBudget)
+  {
+    AssetRequest *request = &assetRequests[assetRequestsFinished];
+    if (__atomic_load_n(&request->state, __ATOMIC_ACQUIRE) != ASSET_REQUEST_DECODED)
+    {
+      // requests finish in order, so we have to wait for this one
+      break;
+    }
+    AssetCacheFinishRequest(request);
+    request->state = ASSET_REQUEST_DONE;
+    assetRequestsFinished++;
+  }
+
+  if (assetRequestsFinished < assetRequestCount)
+  {
+    return (float)assetRequestsFinished / (float)assetRequestCount;
+  }
+  if (assetRequestCount > 0)
+  {
+    SetLoadFileDataCallback(0);
+    assetRequestCount = assetRequestsFinished = 0;
+  }
+  return 1.0f;
+}
+
+// the decode jobs must be done (see JobSystemShutdown), since this also frees
+// the requests that were decoded but never finished, e.g. when the window is
+// closed while the assets are still loading
+void AssetCacheUnloadAll()
+{
+  for (int i = assetRequestsFinished; i < assetRequestCount; i++)
+  {
+    AssetRequest *request = &assetRequests[i];
+    MemFree(request->fileData);
+    if (request->image.data)
+    {
+      UnloadImage(request->image);
+    }
+    *request = (AssetRequest){0};
+  }
+  if (assetRequestCount > 0)
+  {
+    SetLoadFileDataCallback(0);
+    assetRequestCount = assetRequestsFinished = 0;
+  }
+
+  for (int i = 0; i < assetCacheEntryCount; i++)
+  {
+    if (assetCacheEntries[i].refCount > 0)
+    {
+      AssetCacheUnloadEntry(&assetCacheEntries[i]);
+    }
+  }
+  assetCacheEntryCount = 0;
+}
\ No newline at end of file
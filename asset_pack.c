@@ -0,0 +1,319 @@
+#include "td_main.h"
+#include <raymath.h>
+#include <string.h>
+
+// On desktop platforms the pack is memory mapped, so the meshes and textures
+// are uploaded straight from the mapped pages without reading the file into
+// a buffer first. Windows and the web build read the whole pack with a single
+// LoadFileData call instead (windows.h can't be included next to raylib.h).
+#if !defined(_WIN32) && !defined(PLATFORM_WEB)
+#define ASSET_PACK_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static unsigned char *assetPackData = 0;
+static long assetPackSize = 0;
+static const AssetPackEntry *assetPackEntries = 0;
+static int assetPackEntryCount = 0;
+// one flag per entry; entries that are stale or don't check out are skipped,
+// so their assets are loaded from the files instead
+static unsigned char *assetPackEntryUsable = 0;
+
+// true if size bytes at offset lie within the payload of the entry; offset 0
+// is the payload header, so no array starts there
+static int AssetPackIsArrayInEntry(const AssetPackEntry *entry, uint32_t offset, uint64_t size)
+{
+  return offset != 0 && offset % ASSET_PACK_ALIGNMENT == 0 && offset <= entry->size && size <= entry->size - offset;
+}
+
+// optional arrays have offset 0 if the mesh doesn't have them
+static int AssetPackIsOptionalArrayInEntry(const AssetPackEntry *entry, uint32_t offset, uint64_t size)
+{
+  return offset == 0 || AssetPackIsArrayInEntry(entry, offset, size);
+}
+
+static int AssetPackIsModelValid(const AssetPackEntry *entry)
+{
+  if (entry->size < sizeof(AssetPackModel))
+  {
+    return 0;
+  }
+  const AssetPackModel *packModel = (const AssetPackModel *)(assetPackData + entry->offset);
+  if (!AssetPackIsArrayInEntry(entry, packModel->materialsOffset, (uint64_t)packModel->materialCount * sizeof(AssetPackMaterial)) ||
+    !AssetPackIsArrayInEntry(entry, packModel->meshesOffset, (uint64_t)packModel->meshCount * sizeof(AssetPackMesh)))
+  {
+    return 0;
+  }
+
+  const AssetPackMesh *packMeshes = (const AssetPackMesh *)(assetPackData + entry->offset + packModel->meshesOffset);
+  for (uint32_t i = 0; i < packModel->meshCount; i++)
+  {
+    const AssetPackMesh *packMesh = &packMeshes[i];
+    uint64_t vertexCount = packMesh->vertexCount;
+    if (packMesh->materialIndex >= packModel->materialCount ||
+      !AssetPackIsArrayInEntry(entry, packMesh->verticesOffset, vertexCount * 3 * sizeof(float)) ||
+      !AssetPackIsOptionalArrayInEntry(entry, packMesh->texcoordsOffset, vertexCount * 2 * sizeof(float)) ||
+      !AssetPackIsOptionalArrayInEntry(entry, packMesh->normalsOffset, vertexCount * 3 * sizeof(float)) ||
+      !AssetPackIsOptionalArrayInEntry(entry, packMesh->colorsOffset, vertexCount * 4) ||
+      !AssetPackIsOptionalArrayInEntry(entry, packMesh->indicesOffset, (uint64_t)packMesh->triangleCount * 3 * sizeof(unsigned short)))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int AssetPackIsTextureValid(const AssetPackEntry *entry)
+{
+  if (entry->size < sizeof(AssetPackTexture))
+  {
+    return 0;
+  }
+  // the packer converts all textures to RGBA, 4 bytes per pixel
+  const AssetPackTexture *packTexture = (const AssetPackTexture *)(assetPackData + entry->offset);
+  return packTexture->format == PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 && packTexture->width > 0 && packTexture->height > 0 &&
+    AssetPackIsArrayInEntry(entry, packTexture->dataOffset, (uint64_t)packTexture->width * packTexture->height * 4);
+}
+
+static int AssetPackIsEntryUsable(const AssetPackEntry *entry)
+{
+  if (!memchr(entry->path, 0, ASSET_PATH_MAX_LENGTH) || entry->offset % ASSET_PACK_ALIGNMENT != 0 ||
+    (uint64_t)entry->offset + entry->size > (uint64_t)assetPackSize ||
+    (entry->assetType == ASSET_TYPE_MODEL && !AssetPackIsModelValid(entry)) ||
+    (entry->assetType == ASSET_TYPE_TEXTURE && !AssetPackIsTextureValid(entry)))
+  {
+    TraceLog(LOG_WARNING, "ASSETS: entry %.*s of the asset pack is corrupt, skipping it", ASSET_PATH_MAX_LENGTH, entry->path);
+    return 0;
+  }
+
+  // a pack without the data files is fine; if the file is there, it has to be
+  // the one that was packed. The web build's preloaded files all get the time
+  // they were preloaded, so there only the size can tell.
+  if (FileExists(entry->path))
+  {
+    int isStale = (uint32_t)GetFileLength(entry->path) != entry->sourceSize;
+#ifndef PLATFORM_WEB
+    isStale = isStale || GetFileModTime(entry->path) != entry->sourceModTime;
+#endif
+    if (isStale)
+    {
+      TraceLog(LOG_INFO, "ASSETS: %s changed since it was packed, loading the file", entry->path);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int AssetPackOpen(const char *path)
+{
+  AssetPackClose();
+
+#ifdef ASSET_PACK_USE_MMAP
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size < (long)sizeof(AssetPackHeader))
+  {
+    close(fd);
+    return 0;
+  }
+  void *mapped = mmap(0, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after closing the file descriptor
+  close(fd);
+  if (mapped == MAP_FAILED)
+  {
+    return 0;
+  }
+  assetPackData = (unsigned char *)mapped;
+  assetPackSize = fileStat.st_size;
+#else
+  if (!FileExists(path))
+  {
+    return 0;
+  }
+  int dataSize = 0;
+  assetPackData = LoadFileData(path, &dataSize);
+  assetPackSize = dataSize;
+  if (!assetPackData)
+  {
+    return 0;
+  }
+#endif
+
+  const AssetPackHeader *header = (const AssetPackHeader *)assetPackData;
+  if (header->magic != ASSET_PACK_MAGIC || header->version != ASSET_PACK_VERSION ||
+    header->entryTableOffset % ASSET_PACK_ALIGNMENT != 0 || header->entryCount > INT32_MAX ||
+    header->entryTableOffset + (uint64_t)header->entryCount * sizeof(AssetPackEntry) > (uint64_t)assetPackSize)
+  {
+    TraceLog(LOG_WARNING, "ASSETS: %s is not a valid asset pack (version %d)", path, ASSET_PACK_VERSION);
+    AssetPackClose();
+    return 0;
+  }
+  assetPackEntries = (const AssetPackEntry *)(assetPackData + header->entryTableOffset);
+  assetPackEntryCount = header->entryCount;
+
+  // everything the loaders read is checked once here, so they can trust the offsets
+  assetPackEntryUsable = (unsigned char *)MemAlloc(assetPackEntryCount);
+  int usableCount = 0;
+  for (int i = 0; i < assetPackEntryCount; i++)
+  {
+    assetPackEntryUsable[i] = AssetPackIsEntryUsable(&assetPackEntries[i]);
+    usableCount += assetPackEntryUsable[i];
+  }
+  TraceLog(LOG_INFO, "ASSETS: opened asset pack %s with %d entries (%d skipped)", path, assetPackEntryCount,
+    assetPackEntryCount - usableCount);
+  return 1;
+}
+
+void AssetPackClose()
+{
+  if (!assetPackData)
+  {
+    return;
+  }
+#ifdef ASSET_PACK_USE_MMAP
+  munmap(assetPackData, assetPackSize);
+#else
+  UnloadFileData(assetPackData);
+#endif
+  MemFree(assetPackEntryUsable);
+  assetPackData = 0;
+  assetPackSize = 0;
+  assetPackEntries = 0;
+  assetPackEntryCount = 0;
+  assetPackEntryUsable = 0;
+}
+
+int AssetPackIsOpen()
+{
+  return assetPackData != 0;
+}
+
+static const AssetPackEntry *AssetPackFind(const char *path, uint32_t assetType)
+{
+  for (int i = 0; i < assetPackEntryCount; i++)
+  {
+    if (assetPackEntryUsable[i] && assetPackEntries[i].assetType == assetType && strcmp(assetPackEntries[i].path, path) == 0)
+    {
+      return &assetPackEntries[i];
+    }
+  }
+  return 0;
+}
+
+// false for assets whose entry is stale or corrupt, so they are decoded from the file
+int AssetPackContains(const char *path, uint32_t assetType)
+{
+  return AssetPackFind(path, assetType) != 0;
+}
+
+// the offsets of the entries that AssetPackFind returns were checked in AssetPackOpen
+static void *AssetPackGetArray(const AssetPackEntry *entry, uint32_t offset)
+{
+  return offset ? assetPackData + entry->offset + offset : 0;
+}
+
+int AssetPackLoadModel(const char *path, Model *model, AssetLoadStats *stats)
+{
+  const AssetPackEntry *entry = AssetPackFind(path, ASSET_TYPE_MODEL);
+  if (!entry)
+  {
+    return 0;
+  }
+
+  const AssetPackModel *packModel = (const AssetPackModel *)(assetPackData + entry->offset);
+  const AssetPackMaterial *packMaterials = (const AssetPackMaterial *)AssetPackGetArray(entry, packModel->materialsOffset);
+  const AssetPackMesh *packMeshes = (const AssetPackMesh *)AssetPackGetArray(entry, packModel->meshesOffset);
+
+  Model result = {0};
+  result.transform = MatrixIdentity();
+  result.materialCount = packModel->materialCount;
+  result.materials = (Material *)MemAlloc(result.materialCount * sizeof(Material));
+  for (int i = 0; i < result.materialCount; i++)
+  {
+    result.materials[i] = LoadMaterialDefault();
+    result.materials[i].maps[MATERIAL_MAP_DIFFUSE].color = packMaterials[i].diffuseColor;
+  }
+
+  result.meshCount = packModel->meshCount;
+  result.meshes = (Mesh *)MemAlloc(result.meshCount * sizeof(Mesh));
+  result.meshMaterial = (int *)MemAlloc(result.meshCount * sizeof(int));
+  for (int i = 0; i < result.meshCount; i++)
+  {
+    const AssetPackMesh *packMesh = &packMeshes[i];
+    Mesh *mesh = &result.meshes[i];
+    // the vertex arrays point right into the pack; they are read only and
+    // must never be freed, see AssetPackUnloadModel
+    mesh->vertexCount = packMesh->vertexCount;
+    mesh->triangleCount = packMesh->triangleCount;
+    mesh->vertices = (float *)AssetPackGetArray(entry, packMesh->verticesOffset);
+    mesh->texcoords = (float *)AssetPackGetArray(entry, packMesh->texcoordsOffset);
+    mesh->normals = (float *)AssetPackGetArray(entry, packMesh->normalsOffset);
+    mesh->colors = (unsigned char *)AssetPackGetArray(entry, packMesh->colorsOffset);
+    mesh->indices = (unsigned short *)AssetPackGetArray(entry, packMesh->indicesOffset);
+    UploadMesh(mesh, false);
+    result.meshMaterial[i] = packMesh->materialIndex;
+  }
+
+  if (stats)
+  {
+    // nothing is copied on the CPU side; the pages are read by the upload
+    stats->bytesRead += entry->size;
+#ifndef ASSET_PACK_USE_MMAP
+    stats->bytesCopied += entry->size;
+#endif
+  }
+
+  *model = result;
+  return 1;
+}
+
+int AssetPackLoadTexture(const char *path, Texture2D *texture, AssetLoadStats *stats)
+{
+  const AssetPackEntry *entry = AssetPackFind(path, ASSET_TYPE_TEXTURE);
+  if (!entry)
+  {
+    return 0;
+  }
+
+  const AssetPackTexture *packTexture = (const AssetPackTexture *)(assetPackData + entry->offset);
+  Image image = {
+    .data = AssetPackGetArray(entry, packTexture->dataOffset),
+    .width = packTexture->width,
+    .height = packTexture->height,
+    .mipmaps = 1,
+    .format = packTexture->format,
+  };
+  *texture = LoadTextureFromImage(image);
+
+  if (stats)
+  {
+    stats->bytesRead += entry->size;
+#ifndef ASSET_PACK_USE_MMAP
+    stats->bytesCopied += entry->size;
+#endif
+  }
+  return 1;
+}
+
+void AssetPackUnloadModel(Model model)
+{
+  // detach the arrays that live in the pack, so UnloadModel only releases
+  // the GPU buffers and the memory that was allocated in AssetPackLoadModel
+  for (int i = 0; i < model.meshCount; i++)
+  {
+    Mesh *mesh = &model.meshes[i];
+    mesh->vertices = 0;
+    mesh->texcoords = 0;
+    mesh->normals = 0;
+    mesh->colors = 0;
+    mesh->indices = 0;
+  }
+  UnloadModel(model);
+}
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include "td_main.h"
+#include <string.h>
+
+// Packs all models (.glb) and textures (.png) of the data directory into a
+// single asset pack that the game can map into memory and upload directly;
+// see the AssetPack structs in td_main.h for the layout.
+//
+// usage: asset_packer [data directory] [output file]
+
+typedef struct PackBuffer
+{
+  unsigned char *data;
+  uint32_t size;
+  uint32_t capacity;
+} PackBuffer;
+
+// appends size bytes (zeroes if data is null) at the next aligned offset and returns that offset
+static uint32_t PackBufferAppend(PackBuffer *buffer, const void *data, uint32_t size)
+{
+  uint32_t offset = (buffer->size + ASSET_PACK_ALIGNMENT - 1) & ~(uint32_t)(ASSET_PACK_ALIGNMENT - 1);
+  if (offset + size > buffer->capacity)
+  {
+    uint32_t capacity = buffer->capacity == 0 ? 4096 : buffer->capacity;
+    while (offset + size > capacity)
+    {
+      capacity *= 2;
+    }
+    buffer->data = buffer->data ? MemRealloc(buffer->data, capacity) : MemAlloc(capacity);
+    buffer->capacity = capacity;
+  }
+  memset(buffer->data + buffer->size, 0, offset - buffer->size);
+  if (data)
+  {
+    memcpy(buffer->data + offset, data, size);
+  }
+  else
+  {
+    memset(buffer->data + offset, 0, size);
+  }
+  buffer->size = offset + size;
+  return offset;
+}
+
+static int PackModel(PackBuffer *payload, const char *path)
+{
+  Model model = LoadModel(path);
+  if (model.meshCount == 0)
+  {
+    return 0;
+  }
+
+  AssetPackModel packModel = {.meshCount = model.meshCount, .materialCount = model.materialCount};
+  uint32_t modelOffset = PackBufferAppend(payload, 0, sizeof(packModel));
+  packModel.materialsOffset = PackBufferAppend(payload, 0, model.materialCount * sizeof(AssetPackMaterial));
+  for (int i = 0; i < model.materialCount; i++)
+  {
+    AssetPackMaterial packMaterial = {.diffuseColor = model.materials[i].maps[MATERIAL_MAP_DIFFUSE].color};
+    memcpy(payload->data + packModel.materialsOffset + i * sizeof(AssetPackMaterial), &packMaterial, sizeof(packMaterial));
+  }
+  // the mesh table is filled in once we know where the arrays end up
+  packModel.meshesOffset = PackBufferAppend(payload, 0, model.meshCount * sizeof(AssetPackMesh));
+  memcpy(payload->data + modelOffset, &packModel, sizeof(packModel));
+
+  for (int i = 0; i < model.meshCount; i++)
+  {
+    Mesh *mesh = &model.meshes[i];
+    AssetPackMesh packMesh = {
+      .vertexCount = mesh->vertexCount,
+      .triangleCount = mesh->triangleCount,
+      .materialIndex = model.meshMaterial[i],
+    };
+    packMesh.verticesOffset = PackBufferAppend(payload, mesh->vertices, mesh->vertexCount * 3 * sizeof(float));
+    if (mesh->texcoords)
+    {
+      packMesh.texcoordsOffset = PackBufferAppend(payload, mesh->texcoords, mesh->vertexCount * 2 * sizeof(float));
+    }
+    if (mesh->normals)
+    {
+      packMesh.normalsOffset = PackBufferAppend(payload, mesh->normals, mesh->vertexCount * 3 * sizeof(float));
+    }
+    if (mesh->colors)
+    {
+      packMesh.colorsOffset = PackBufferAppend(payload, mesh->colors, mesh->vertexCount * 4);
+    }
+    if (mesh->indices)
+    {
+      packMesh.indicesOffset = PackBufferAppend(payload, mesh->indices, mesh->triangleCount * 3 * sizeof(unsigned short));
+    }
+    memcpy(payload->data + packModel.meshesOffset + i * sizeof(AssetPackMesh), &packMesh, sizeof(packMesh));
+  }
+
+  UnloadModel(model);
+  return 1;
+}
+
+static int PackTexture(PackBuffer *payload, const char *path)
+{
+  Image image = LoadImage(path);
+  if (!image.data)
+  {
+    return 0;
+  }
+  // store the pixels in the format they are uploaded in, so loading needs no conversion
+  ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+  AssetPackTexture packTexture = {.width = image.width, .height = image.height, .format = image.format};
+  uint32_t headerOffset = PackBufferAppend(payload, &packTexture, sizeof(packTexture));
+  packTexture.dataOffset = PackBufferAppend(payload, image.data, image.width * image.height * 4);
+  memcpy(payload->data + headerOffset, &packTexture, sizeof(packTexture));
+
+  UnloadImage(image);
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  const char *dataDirectory = argc > 1 ? argv[1] : "data";
+  const char *outputPath = argc > 2 ? argv[2] : ASSET_PACK_PATH;
+
+  // loading models uploads them to the GPU, so we need a (hidden) window
+  SetConfigFlags(FLAG_WINDOW_HIDDEN);
+  InitWindow(64, 64, "asset packer");
+
+  static AssetPackEntry entries[ASSET_CACHE_MAX_COUNT];
+  int entryCount = 0;
+  PackBuffer pack = {0};
+  PackBufferAppend(&pack, 0, sizeof(AssetPackHeader));
+
+  FilePathList files = LoadDirectoryFiles(dataDirectory);
+  for (unsigned int i = 0; i < files.count && entryCount < ASSET_CACHE_MAX_COUNT; i++)
+  {
+    const char *file = files.paths[i];
+    uint32_t assetType = IsFileExtension(file, ".glb") ? ASSET_TYPE_MODEL : 
+      (IsFileExtension(file, ".png") ? ASSET_TYPE_TEXTURE : ASSET_TYPE_NONE);
+    if (assetType == ASSET_TYPE_NONE)
+    {
+      continue;
+    }
+
+    // the entries are keyed by the same paths the game uses to load the assets
+    AssetPackEntry *entry = &entries[entryCount];
+    *entry = (AssetPackEntry){.assetType = assetType};
+    strncpy(entry->path, TextFormat("%s/%s", dataDirectory, GetFileName(file)), ASSET_PATH_MAX_LENGTH - 1);
+
+    PackBuffer payload = {0};
+    int packed = assetType == ASSET_TYPE_MODEL ? PackModel(&payload, file) : PackTexture(&payload, file);
+    if (!packed)
+    {
+      TraceLog(LOG_WARNING, "PACKER: failed to load %s, skipping", file);
+      MemFree(payload.data);
+      continue;
+    }
+    entry->offset = PackBufferAppend(&pack, payload.data, payload.size);
+    entry->size = payload.size;
+    entry->sourceSize = GetFileLength(file);
+    entry->sourceModTime = GetFileModTime(file);
+    MemFree(payload.data);
+    TraceLog(LOG_INFO, "PACKER: packed %s (%u bytes)", entry->path, entry->size);
+    entryCount++;
+  }
+  UnloadDirectoryFiles(files);
+
+  AssetPackHeader header = {
+    .magic = ASSET_PACK_MAGIC,
+    .version = ASSET_PACK_VERSION,
+    .entryCount = entryCount,
+    .entryTableOffset = PackBufferAppend(&pack, entries, entryCount * sizeof(AssetPackEntry)),
+  };
+  memcpy(pack.data, &header, sizeof(header));
+
+  int result = SaveFileData(outputPath, pack.data, pack.size) ? 0 : 1;
+  TraceLog(LOG_INFO, "PACKER: wrote %d assets to %s (%u bytes)", entryCount, outputPath, pack.size);
+  MemFree(pack.data);
+  CloseWindow();
+  return result;
+}
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "td_main.h"
+#include <raymath.h>
+#include <rlgl.h>
+#include <stddef.h>
+
+// Projectile trails and particles are lots of tiny, unlit cubes. Drawing them
+// with DrawCube pushes 36 vertices per cube through raylib's immediate mode
+// batch every frame. Instead, the cubes are collected here as instances
+// (position, size, color) and drawn with a single instanced draw call that
+// reuses one unit cube mesh.
+static CubeInstance cubeInstances[CUBE_BATCH_MAX_COUNT];
+static int cubeInstanceCount = 0;
+
+static Shader cubeShader = {0};
+static int cubeShaderMvpLoc = -1;
+static unsigned int cubeVao = 0;
+static unsigned int cubeVertexVbo = 0;
+static unsigned int cubeInstanceVbo = 0;
+// without instancing support, we fall back to DrawCube
+static int cubeBatchIsInstanced = 0;
+
+static const char *cubeVertexShaderCode =
+  "in vec3 vertexPosition;\n"
+  "in vec3 instancePosition;\n"
+  "in vec3 instanceSize;\n"
+  "in vec4 instanceColor;\n"
+  "uniform mat4 mvp;\n"
+  "out vec4 fragColor;\n"
+  "void main()\n"
+  "{\n"
+  "  fragColor = instanceColor;\n"
+  "  gl_Position = mvp * vec4(vertexPosition * instanceSize + instancePosition, 1.0);\n"
+  "}\n";
+
+static const char *cubeFragmentShaderCode =
+  "in vec4 fragColor;\n"
+  "out vec4 finalColor;\n"
+  "void main()\n"
+  "{\n"
+  "  finalColor = fragColor;\n"
+  "}\n";
+
+// a unit cube centered at the origin, as 12 triangles without indices
+static const float cubeVertices[] = {
+  -0.5f, -0.5f,  0.5f,   0.5f, -0.5f,  0.5f,   0.5f,  0.5f,  0.5f,
+  -0.5f, -0.5f,  0.5f,   0.5f,  0.5f,  0.5f,  -0.5f,  0.5f,  0.5f,
+  -0.5f, -0.5f, -0.5f,  -0.5f,  0.5f, -0.5f,   0.5f,  0.5f, -0.5f,
+  -0.5f, -0.5f, -0.5f,   0.5f,  0.5f, -0.5f,   0.5f, -0.5f, -0.5f,
+  -0.5f,  0.5f, -0.5f,  -0.5f,  0.5f,  0.5f,   0.5f,  0.5f,  0.5f,
+  -0.5f,  0.5f, -0.5f,   0.5f,  0.5f,  0.5f,   0.5f,  0.5f, -0.5f,
+  -0.5f, -0.5f, -0.5f,   0.5f, -0.5f, -0.5f,   0.5f, -0.5f,  0.5f,
+  -0.5f, -0.5f, -0.5f,   0.5f, -0.5f,  0.5f,  -0.5f, -0.5f,  0.5f,
+   0.5f, -0.5f, -0.5f,   0.5f,  0.5f, -0.5f,   0.5f,  0.5f,  0.5f,
+   0.5f, -0.5f, -0.5f,   0.5f,  0.5f,  0.5f,   0.5f, -0.5f,  0.5f,
+  -0.5f, -0.5f, -0.5f,  -0.5f, -0.5f,  0.5f,  -0.5f,  0.5f,  0.5f,
+  -0.5f, -0.5f, -0.5f,  -0.5f,  0.5f,  0.5f,  -0.5f,  0.5f, -0.5f,
+};
+
+void CubeBatchInit()
+{
+  cubeInstanceCount = 0;
+
+  // instanced arrays are core since GL 3.3 / GLES 3.0; older contexts (e.g.
+  // WebGL 1) would need an extension, so they just use DrawCube instead
+  const char *versionHeader = NULL;
+  switch (rlGetVersion())
+  {
+  case RL_OPENGL_33:
+  case RL_OPENGL_43:
+    versionHeader = "#version 330\n";
+    break;
+  case RL_OPENGL_ES_30:
+    versionHeader = "#version 300 es\nprecision mediump float;\n";
+    break;
+  default:
+    TraceLog(LOG_INFO, "CUBES: instancing not available, drawing cubes one by one");
+    return;
+  }
+
+  cubeShader = LoadShaderFromMemory(TextFormat("%s%s", versionHeader, cubeVertexShaderCode),
+    TextFormat("%s%s", versionHeader, cubeFragmentShaderCode));
+  if (!IsShaderValid(cubeShader))
+  {
+    TraceLog(LOG_WARNING, "CUBES: failed to load the instancing shader, drawing cubes one by one");
+    return;
+  }
+  cubeShaderMvpLoc = GetShaderLocation(cubeShader, "mvp");
+  // the attribute locations are not bound by name, so ask the shader where they ended up
+  int positionLoc = GetShaderLocationAttrib(cubeShader, "vertexPosition");
+  int instancePositionLoc = GetShaderLocationAttrib(cubeShader, "instancePosition");
+  int instanceSizeLoc = GetShaderLocationAttrib(cubeShader, "instanceSize");
+  int instanceColorLoc = GetShaderLocationAttrib(cubeShader, "instanceColor");
+
+  cubeVao = rlLoadVertexArray();
+  rlEnableVertexArray(cubeVao);
+  cubeVertexVbo = rlLoadVertexBuffer(cubeVertices, sizeof(cubeVertices), false);
+  rlSetVertexAttribute(positionLoc, 3, RL_FLOAT, false, 0, 0);
+  rlEnableVertexAttribute(positionLoc);
+
+  cubeInstanceVbo = rlLoadVertexBuffer(NULL, sizeof(cubeInstances), true);
+  rlSetVertexAttribute(instancePositionLoc, 3, RL_FLOAT, false, sizeof(CubeInstance), offsetof(CubeInstance, position));
+  rlEnableVertexAttribute(instancePositionLoc);
+  rlSetVertexAttributeDivisor(instancePositionLoc, 1);
+  rlSetVertexAttribute(instanceSizeLoc, 3, RL_FLOAT, false, sizeof(CubeInstance), offsetof(CubeInstance, size));
+  rlEnableVertexAttribute(instanceSizeLoc);
+  rlSetVertexAttributeDivisor(instanceSizeLoc, 1);
+  rlSetVertexAttribute(instanceColorLoc, 4, RL_UNSIGNED_BYTE, true, sizeof(CubeInstance), offsetof(CubeInstance, color));
+  rlEnableVertexAttribute(instanceColorLoc);
+  rlSetVertexAttributeDivisor(instanceColorLoc, 1);
+  rlDisableVertexArray();
+
+  cubeBatchIsInstanced = 1;
+}
+
+void CubeBatchUnload()
+{
+  if (cubeBatchIsInstanced)
+  {
+    rlUnloadVertexArray(cubeVao);
+    rlUnloadVertexBuffer(cubeVertexVbo);
+    rlUnloadVertexBuffer(cubeInstanceVbo);
+    UnloadShader(cubeShader);
+  }
+  cubeBatchIsInstanced = 0;
+  cubeInstanceCount = 0;
+}
+
+// the shader the cubes are drawn with, for sorting render commands
+unsigned int CubeBatchGetShaderId()
+{
+  return cubeBatchIsInstanced ? cubeShader.id : rlGetShaderIdDefault();
+}
+
+void CubeBatchAdd(Vector3 position, Vector3 size, Color color)
+{
+  if (cubeInstanceCount >= CUBE_BATCH_MAX_COUNT)
+  {
+    // more cubes than the buffer holds; draw what we have and start over
+    CubeBatchDraw();
+  }
+  cubeInstances[cubeInstanceCount++] = (CubeInstance){
+    .position = position,
+    .size = size,
+    .color = color,
+  };
+}
+
+// draws all cubes added since the last call; must be called inside BeginMode3D
+void CubeBatchDraw()
+{
+  if (cubeInstanceCount == 0)
+  {
+    return;
+  }
+
+  if (!cubeBatchIsInstanced)
+  {
+    for (int i = 0; i < cubeInstanceCount; i++)
+    {
+      CubeInstance *cube = &cubeInstances[i];
+      DrawCube(cube->position, cube->size.x, cube->size.y, cube->size.z, cube->color);
+    }
+    // raylib merges the untextured cubes into one draw of its batch
+    RenderQueueCountDrawCalls(1, cubeInstanceCount);
+    cubeInstanceCount = 0;
+    return;
+  }
+
+  // whatever raylib has batched so far must be drawn first, the instanced
+  // draw bypasses its batch
+  rlDrawRenderBatchActive();
+
+  Matrix mvp = MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection());
+  rlEnableShader(cubeShader.id);
+  rlSetUniformMatrix(cubeShaderMvpLoc, mvp);
+  rlEnableVertexArray(cubeVao);
+  rlUpdateVertexBuffer(cubeInstanceVbo, cubeInstances, cubeInstanceCount * sizeof(CubeInstance), 0);
+  rlDrawVertexArrayInstanced(0, 36, cubeInstanceCount);
+  rlDisableVertexArray();
+  rlDisableShader();
+
+  RenderQueueCountDrawCalls(1, cubeInstanceCount);
+  cubeInstanceCount = 0;
+}
@@ -17,9 +17,6 @@ EnemyClassConfig enemyClassConfigs[] = {
     },
 };
 
-Enemy enemies[ENEMY_MAX_COUNT];
-int enemyCount = 0;
-
 SpriteUnit enemySprites[] = {
     [ENEMY_TYPE_MINION] = {
       .srcRect = {0, 16, 16, 16},
@@ -29,13 +26,14 @@ SpriteUnit enemySprites[] = {
     },
 };
 
-void EnemyInit()
+void EnemyInit(World *world)
 {
   for (int i = 0; i < ENEMY_MAX_COUNT; i++)
   {
-    enemies[i] = (Enemy){0};
+    world->enemies[i] = (Enemy){0};
   }
-  enemyCount = 0;
+  world->enemyCount = 0;
+  world->enemyDamageEventCount = 0;
 }
 
 float EnemyGetCurrentMaxSpeed(Enemy *enemy)
@@ -48,7 +46,7 @@ float EnemyGetMaxHealth(Enemy *enemy)
   return enemyClassConfigs[enemy->enemyType].health;
 }
 
-int EnemyGetNextPosition(int16_t currentX, int16_t currentY, int16_t *nextX, int16_t *nextY)
+int EnemyGetNextPosition(World *world, int16_t currentX, int16_t currentY, int16_t *nextX, int16_t *nextY)
 {
   int16_t castleX = 0;
   int16_t castleY = 0;
@@ -60,7 +58,7 @@ int EnemyGetNextPosition(int16_t currentX, int16_t currentY, int16_t *nextX, int
     *nextY = currentY;
     return 1;
   }
-  Vector2 gradient = PathFindingGetGradient((Vector3){currentX, 0, currentY});
+  Vector2 gradient = PathFindingGetGradient(world, (Vector3){currentX, 0, currentY});
 
   if (gradient.x == 0 && gradient.y == 0)
   {
@@ -82,7 +80,7 @@ int EnemyGetNextPosition(int16_t currentX, int16_t currentY, int16_t *nextX, int
 
 
 // this function predicts the movement of the unit for the next deltaT seconds
-Vector2 EnemyGetPosition(Enemy *enemy, float deltaT, Vector2 *velocity, int *waypointPassedCount)
+Vector2 EnemyGetPosition(World *world, Enemy *enemy, float deltaT, Vector2 *velocity, int *waypointPassedCount)
 {
   const float pointReachedDistance = 0.25f;
   const float pointReachedDistance2 = pointReachedDistance * pointReachedDistance;
@@ -99,13 +97,11 @@ Vector2 EnemyGetPosition(Enemy *enemy, float deltaT, Vector2 *velocity, int *way
     float stepTime = fminf(deltaT - t, maxSimStepTime);
     Vector2 target = (Vector2){nextX, nextY};
     float speed = Vector2Length(*velocity);
-    // draw the target position for debugging
-    DrawCubeWires((Vector3){target.x, 0.2f, target.y}, 0.1f, 0.4f, 0.1f, RED);
     Vector2 lookForwardPos = Vector2Add(position, Vector2Scale(*velocity, speed));
     if (Vector2DistanceSqr(target, lookForwardPos) <= pointReachedDistance2)
     {
       // we reached the target position, let's move to the next waypoint
-      EnemyGetNextPosition(nextX, nextY, &nextX, &nextY);
+      EnemyGetNextPosition(world, nextX, nextY, &nextX, &nextY);
       target = (Vector2){nextX, nextY};
       // track how many waypoints we passed
       passedCount++;
@@ -134,17 +130,15 @@ Vector2 EnemyGetPosition(Enemy *enemy, float deltaT, Vector2 *velocity, int *way
   return position;
 }
 
-void EnemyDraw()
+void EnemyDraw(const RenderSnapshot *snapshot)
 {
-  for (int i = 0; i < enemyCount; i++)
+  for (int i = 0; i < snapshot->enemyCount; i++)
   {
-    Enemy enemy = enemies[i];
-    if (enemy.enemyType == ENEMY_TYPE_NONE)
+    const RenderSnapshotEnemy *enemy = &snapshot->enemies[i];
+    if (!VisibilityIsVisible(enemy->position.x, enemy->position.y))
     {
       continue;
     }
-
-    Vector2 position = EnemyGetPosition(&enemy, gameTime.time - enemy.startMovingTime, &enemy.simVelocity, 0);
     
     // don't draw any trails for now; might replace this with footprints later
     // if (enemy.movePathCount > 0)
@@ -159,63 +153,71 @@ void EnemyDraw()
     //   DrawLine3D(p, q, GREEN);
     // }
 
-    switch (enemy.enemyType)
+    switch (enemy->enemyType)
     {
     case ENEMY_TYPE_MINION:
-      DrawSpriteUnit(enemySprites[ENEMY_TYPE_MINION], (Vector3){position.x, 0.0f, position.y}, 
-        enemy.walkedDistance, 0, 0);
+      DrawSpriteUnit(enemySprites[ENEMY_TYPE_MINION], (Vector3){enemy->position.x, 0.0f, enemy->position.y}, 
+        enemy->walkedDistance, 0, 0);
       break;
     }
   }
 }
 
-void EnemyTriggerExplode(Enemy *enemy, Tower *tower, Vector3 explosionSource)
+// EnemyUpdate moves every enemy up to the game time, so the simulated position is the one to draw
+void EnemyWriteSnapshot(World *world, RenderSnapshot *snapshot)
+{
+  int count = 0;
+  for (int i = 0; i < world->enemyCount; i++)
+  {
+    Enemy *enemy = &world->enemies[i];
+    if (enemy->enemyType == ENEMY_TYPE_NONE)
+    {
+      continue;
+    }
+    float maxHealth = EnemyGetMaxHealth(enemy);
+    snapshot->enemies[count++] = (RenderSnapshotEnemy){
+      .position = enemy->simPosition,
+      .walkedDistance = enemy->walkedDistance,
+      .healthRatio = enemy->damage == 0.0f ? 1.0f : (maxHealth - enemy->damage) / maxHealth,
+      .enemyType = enemy->enemyType,
+    };
+  }
+  snapshot->enemyCount = count;
+}
+
+void EnemyTriggerExplode(World *world, Enemy *enemy, Tower *tower, Vector3 explosionSource)
 {
   // damage the tower
   float explosionDamge = enemyClassConfigs[enemy->enemyType].explosionDamage;
   float explosionRange = enemyClassConfigs[enemy->enemyType].explosionRange;
   float explosionPushbackPower = enemyClassConfigs[enemy->enemyType].explosionPushbackPower;
-  float explosionRange2 = explosionRange * explosionRange;
   tower->damage += enemyClassConfigs[enemy->enemyType].explosionDamage;
   // explode the enemy
   if (tower->damage >= TowerGetMaxHealth(tower))
   {
-    tower->towerType = TOWER_TYPE_NONE;
+    TowerDestroy(world, tower);
   }
 
-  ParticleAdd(PARTICLE_TYPE_EXPLOSION, 
+  ParticleAdd(world, PARTICLE_TYPE_EXPLOSION, 
     explosionSource, 
-    (Vector3){0, 0.1f, 0}, 1.0f);
+    (Vector3){0, 0.1f, 0});
+  ParticleEmitBurst(world, PARTICLE_TYPE_DEBRIS, explosionSource, 12, 1.5f);
 
   enemy->enemyType = ENEMY_TYPE_NONE;
 
   // push back enemies & dealing damage
-  for (int i = 0; i < enemyCount; i++)
-  {
-    Enemy *other = &enemies[i];
-    if (other->enemyType == ENEMY_TYPE_NONE)
-    {
-      continue;
-    }
-    float distanceSqr = Vector2DistanceSqr(enemy->simPosition, other->simPosition);
-    if (distanceSqr > 0 && distanceSqr < explosionRange2)
-    {
-      Vector2 direction = Vector2Normalize(Vector2Subtract(other->simPosition, enemy->simPosition));
-      other->simPosition = Vector2Add(other->simPosition, Vector2Scale(direction, explosionPushbackPower));
-      EnemyAddDamage(other, explosionDamge);
-    }
-  }
+  AreaDamageAdd(world, enemy->simPosition, explosionRange, explosionDamge, explosionPushbackPower);
 }
 
-void EnemyUpdate()
+void EnemyUpdate(World *world)
 {
   const float castleX = 0;
   const float castleY = 0;
   const float maxPathDistance2 = 0.25f * 0.25f;
   
-  for (int i = 0; i < enemyCount; i++)
+  for (int i = 0; i < world->enemyCount; i++)
   {
-    Enemy *enemy = &enemies[i];
+    Enemy *enemy = &world->enemies[i];
     if (enemy->enemyType == ENEMY_TYPE_NONE)
     {
       continue;
@@ -223,8 +225,8 @@ void EnemyUpdate()
 
     int waypointPassedCount = 0;
     Vector2 prevPosition = enemy->simPosition;
-    enemy->simPosition = EnemyGetPosition(enemy, gameTime.time - enemy->startMovingTime, &enemy->simVelocity, &waypointPassedCount);
-    enemy->startMovingTime = gameTime.time;
+    enemy->simPosition = EnemyGetPosition(world, enemy, world->gameTime.time - enemy->startMovingTime, &enemy->simVelocity, &waypointPassedCount);
+    enemy->startMovingTime = world->gameTime.time;
     enemy->walkedDistance += Vector2Distance(prevPosition, enemy->simPosition);
     // track path of unit
     if (enemy->movePathCount == 0 || Vector2DistanceSqr(enemy->simPosition, enemy->movePath[0]) > maxPathDistance2)
@@ -244,7 +246,7 @@ void EnemyUpdate()
     {
       enemy->currentX = enemy->nextX;
       enemy->currentY = enemy->nextY;
-      if (EnemyGetNextPosition(enemy->currentX, enemy->currentY, &enemy->nextX, &enemy->nextY) &&
+      if (EnemyGetNextPosition(world, enemy->currentX, enemy->currentY, &enemy->nextX, &enemy->nextY) &&
         Vector2DistanceSqr(enemy->simPosition, (Vector2){castleX, castleY}) <= 0.25f * 0.25f)
       {
         // enemy reached the castle; remove it
@@ -255,16 +257,16 @@ void EnemyUpdate()
   }
 
   // handle collisions between enemies
-  for (int i = 0; i < enemyCount - 1; i++)
+  for (int i = 0; i < world->enemyCount - 1; i++)
   {
-    Enemy *enemyA = &enemies[i];
+    Enemy *enemyA = &world->enemies[i];
     if (enemyA->enemyType == ENEMY_TYPE_NONE)
     {
       continue;
     }
-    for (int j = i + 1; j < enemyCount; j++)
+    for (int j = i + 1; j < world->enemyCount; j++)
     {
-      Enemy *enemyB = &enemies[j];
+      Enemy *enemyB = &world->enemies[j];
       if (enemyB->enemyType == ENEMY_TYPE_NONE)
       {
         continue;
@@ -291,14 +293,14 @@ void EnemyUpdate()
   }
 
   // handle collisions between enemies and towers
-  for (int i = 0; i < enemyCount; i++)
+  for (int i = 0; i < world->enemyCount; i++)
   {
-    Enemy *enemy = &enemies[i];
+    Enemy *enemy = &world->enemies[i];
     if (enemy->enemyType == ENEMY_TYPE_NONE)
     {
       continue;
     }
-    enemy->contactTime -= gameTime.deltaTime;
+    enemy->contactTime -= world->gameTime.deltaTime;
     if (enemy->contactTime < 0.0f)
     {
       enemy->contactTime = 0.0f;
@@ -307,9 +309,9 @@ void EnemyUpdate()
     float enemyRadius = enemyClassConfigs[enemy->enemyType].radius;
     // linear search over towers; could be optimized by using path finding tower map,
     // but for now, we keep it simple
-    for (int j = 0; j < towerCount; j++)
+    for (int j = 0; j < world->towerCount; j++)
     {
-      Tower *tower = &towers[j];
+      Tower *tower = &world->towers[j];
       if (tower->towerType == TOWER_TYPE_NONE)
       {
         continue;
@@ -373,28 +375,28 @@ void EnemyUpdate()
 
       if (enemyClassConfigs[enemy->enemyType].explosionDamage > 0.0f)
       {
-        enemy->contactTime += gameTime.deltaTime * 2.0f; // * 2 to undo the subtraction above
+        enemy->contactTime += world->gameTime.deltaTime * 2.0f; // * 2 to undo the subtraction above
         if (enemy->contactTime >= enemyClassConfigs[enemy->enemyType].requiredContactTime)
         {
-          EnemyTriggerExplode(enemy, tower, contactPoint);
+          EnemyTriggerExplode(world, enemy, tower, contactPoint);
         }
       }
     }
   }
 }
 
-EnemyId EnemyGetId(Enemy *enemy)
+EnemyId EnemyGetId(World *world, Enemy *enemy)
 {
-  return (EnemyId){enemy - enemies, enemy->generation};
+  return (EnemyId){enemy - world->enemies, enemy->generation};
 }
 
-Enemy *EnemyTryResolve(EnemyId enemyId)
+Enemy *EnemyTryResolve(World *world, EnemyId enemyId)
 {
   if (enemyId.index >= ENEMY_MAX_COUNT)
   {
     return 0;
   }
-  Enemy *enemy = &enemies[enemyId.index];
+  Enemy *enemy = &world->enemies[enemyId.index];
   if (enemy->generation != enemyId.generation || enemy->enemyType == ENEMY_TYPE_NONE)
   {
     return 0;
@@ -402,12 +404,12 @@ Enemy *EnemyTryResolve(EnemyId enemyId)
   return enemy;
 }
 
-Enemy *EnemyTryAdd(uint8_t enemyType, int16_t currentX, int16_t currentY)
+Enemy *EnemyTryAdd(World *world, uint8_t enemyType, int16_t currentX, int16_t currentY)
 {
   Enemy *spawn = 0;
-  for (int i = 0; i < enemyCount; i++)
+  for (int i = 0; i < world->enemyCount; i++)
   {
-    Enemy *enemy = &enemies[i];
+    Enemy *enemy = &world->enemies[i];
     if (enemy->enemyType == ENEMY_TYPE_NONE)
     {
       spawn = enemy;
@@ -415,9 +417,9 @@ Enemy *EnemyTryAdd(uint8_t enemyType, int16_t currentX, int16_t currentY)
     }
   }
 
-  if (enemyCount < ENEMY_MAX_COUNT && !spawn)
+  if (world->enemyCount < ENEMY_MAX_COUNT && !spawn)
   {
-    spawn = &enemies[enemyCount++];
+    spawn = &world->enemies[world->enemyCount++];
   }
 
   if (spawn)
@@ -429,7 +431,7 @@ Enemy *EnemyTryAdd(uint8_t enemyType, int16_t currentX, int16_t currentY)
     spawn->simPosition = (Vector2){currentX, currentY};
     spawn->simVelocity = (Vector2){0, 0};
     spawn->enemyType = enemyType;
-    spawn->startMovingTime = gameTime.time;
+    spawn->startMovingTime = world->gameTime.time;
     spawn->damage = 0.0f;
     spawn->futureDamage = 0.0f;
     spawn->generation++;
@@ -440,12 +442,12 @@ Enemy *EnemyTryAdd(uint8_t enemyType, int16_t currentX, int16_t currentY)
   return spawn;
 }
 
-int EnemyAddDamage(Enemy *enemy, float damage)
+int EnemyAddDamage(World *world, Enemy *enemy, float damage)
 {
   enemy->damage += damage;
   if (enemy->damage >= EnemyGetMaxHealth(enemy))
   {
-    currentLevel->playerGold += enemyClassConfigs[enemy->enemyType].goldValue;
+    world->level.playerGold += enemyClassConfigs[enemy->enemyType].goldValue;
     enemy->enemyType = ENEMY_TYPE_NONE;
     return 1;
   }
@@ -453,16 +455,64 @@ int EnemyAddDamage(Enemy *enemy, float damage)
   return 0;
 }
 
-Enemy* EnemyGetClosestToCastle(int16_t towerX, int16_t towerY, float range)
+void EnemyQueueDamage(World *world, Enemy *enemy, float damage, uint64_t sortKey)
+{
+  // reserve a slot without locking; concurrent producers get different slots
+  int index = __atomic_fetch_add(&world->enemyDamageEventCount, 1, __ATOMIC_RELAXED);
+  if (index >= ENEMY_DAMAGE_EVENT_MAX_COUNT)
+  {
+    // the buffer is full; the event is lost, EnemyApplyDamageEvents reports it
+    return;
+  }
+  world->enemyDamageEvents[index] = (EnemyDamageEvent){
+    .sortKey = sortKey,
+    .enemyId = EnemyGetId(world, enemy),
+    .damage = damage,
+  };
+}
+
+static int EnemyCompareDamageEvents(const void *a, const void *b)
+{
+  uint64_t keyA = ((const EnemyDamageEvent *)a)->sortKey;
+  uint64_t keyB = ((const EnemyDamageEvent *)b)->sortKey;
+  return keyA < keyB ? -1 : (keyA > keyB ? 1 : 0);
+}
+
+// must be called while no other thread is queueing damage
+void EnemyApplyDamageEvents(World *world)
+{
+  int count = world->enemyDamageEventCount;
+  if (count > ENEMY_DAMAGE_EVENT_MAX_COUNT)
+  {
+    TraceLog(LOG_WARNING, "ENEMY: damage event buffer overflow, %d events lost", count - ENEMY_DAMAGE_EVENT_MAX_COUNT);
+    count = ENEMY_DAMAGE_EVENT_MAX_COUNT;
+  }
+
+  // the events were added in whatever order the producers ran; sorting them
+  // makes damage, deaths and gold independent of that order
+  qsort(world->enemyDamageEvents, count, sizeof(EnemyDamageEvent), EnemyCompareDamageEvents);
+  for (int i = 0; i < count; i++)
+  {
+    // the enemy may have died from an earlier event
+    Enemy *enemy = EnemyTryResolve(world, world->enemyDamageEvents[i].enemyId);
+    if (enemy)
+    {
+      EnemyAddDamage(world, enemy, world->enemyDamageEvents[i].damage);
+    }
+  }
+  world->enemyDamageEventCount = 0;
+}
+
+Enemy* EnemyGetClosestToCastle(World *world, int16_t towerX, int16_t towerY, float range)
 {
   int16_t castleX = 0;
   int16_t castleY = 0;
   Enemy* closest = 0;
   int16_t closestDistance = 0;
   float range2 = range * range;
-  for (int i = 0; i < enemyCount; i++)
+  for (int i = 0; i < world->enemyCount; i++)
   {
-    Enemy* enemy = &enemies[i];
+    Enemy* enemy = &world->enemies[i];
     if (enemy->enemyType == ENEMY_TYPE_NONE)
     {
       continue;
@@ -491,12 +541,12 @@ Enemy* EnemyGetClosestToCastle(int16_t towerX, int16_t towerY, float range)
   return closest;
 }
 
-int EnemyCount()
+int EnemyCount(World *world)
 {
   int count = 0;
-  for (int i = 0; i < enemyCount; i++)
+  for (int i = 0; i < world->enemyCount; i++)
   {
-    if (enemies[i].enemyType != ENEMY_TYPE_NONE)
+    if (world->enemies[i].enemyType != ENEMY_TYPE_NONE)
     {
       count++;
     }
@@ -504,20 +554,16 @@ int EnemyCount()
   return count;
 }
 
-void EnemyDrawHealthbars(Camera3D camera)
+void EnemyDrawHealthbars(const RenderSnapshot *snapshot)
 {
-  for (int i = 0; i < enemyCount; i++)
+  for (int i = 0; i < snapshot->enemyCount; i++)
   {
-    Enemy *enemy = &enemies[i];
-    if (enemy->enemyType == ENEMY_TYPE_NONE || enemy->damage == 0.0f)
+    const RenderSnapshotEnemy *enemy = &snapshot->enemies[i];
+    if (enemy->healthRatio >= 1.0f)
     {
       continue;
     }
-    Vector3 position = (Vector3){enemy->simPosition.x, 0.5f, enemy->simPosition.y};
-    float maxHealth = EnemyGetMaxHealth(enemy);
-    float health = maxHealth - enemy->damage;
-    float healthRatio = health / maxHealth;
-    
-    DrawHealthBar(camera, position, healthRatio, GREEN, 15.0f);
+    Vector3 position = (Vector3){enemy->position.x, 0.5f, enemy->position.y};
+    HealthBarBatchAdd(position, enemy->healthRatio, GREEN, 15.0f);
   }
 }
\ No newline at end of file
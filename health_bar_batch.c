@@ -0,0 +1,136 @@
+#include "td_main.h"
+#include <raymath.h>
+#include <rlgl.h>
+
+// Health bars are collected during the frame and drawn together. Projecting
+// them one by one with GetWorldToScreen rebuilds the view and projection
+// matrices for every bar; here the view-projection matrix is built once and
+// the positions are projected 4 at a time. Bars that end up off screen are
+// skipped, the rest is emitted as one batch of 2D triangles.
+static float healthBarPositionX[HEALTH_BAR_BATCH_MAX_COUNT];
+static float healthBarPositionY[HEALTH_BAR_BATCH_MAX_COUNT];
+static float healthBarPositionZ[HEALTH_BAR_BATCH_MAX_COUNT];
+static float healthBarRatio[HEALTH_BAR_BATCH_MAX_COUNT];
+static float healthBarWidth[HEALTH_BAR_BATCH_MAX_COUNT];
+static Color healthBarColor[HEALTH_BAR_BATCH_MAX_COUNT];
+static int healthBarCount = 0;
+
+// the projected screen positions; w <= 0 means the position is behind the camera
+static float healthBarScreenX[HEALTH_BAR_BATCH_MAX_COUNT];
+static float healthBarScreenY[HEALTH_BAR_BATCH_MAX_COUNT];
+static float healthBarClipW[HEALTH_BAR_BATCH_MAX_COUNT];
+
+typedef float HealthBarFloat4 __attribute__((vector_size(16), aligned(4), may_alias));
+
+void HealthBarBatchAdd(Vector3 position, float healthRatio, Color barColor, float width)
+{
+  if (healthBarCount >= HEALTH_BAR_BATCH_MAX_COUNT)
+  {
+    return;
+  }
+  healthBarPositionX[healthBarCount] = position.x;
+  healthBarPositionY[healthBarCount] = position.y;
+  healthBarPositionZ[healthBarCount] = position.z;
+  healthBarRatio[healthBarCount] = healthRatio;
+  healthBarWidth[healthBarCount] = width;
+  healthBarColor[healthBarCount] = barColor;
+  healthBarCount++;
+}
+
+// same matrices GetWorldToScreen uses
+static Matrix HealthBarGetViewProjection(Camera3D camera, float screenWidth, float screenHeight)
+{
+  Matrix projection = MatrixIdentity();
+  if (camera.projection == CAMERA_PERSPECTIVE)
+  {
+    projection = MatrixPerspective(camera.fovy * DEG2RAD, (double)screenWidth / (double)screenHeight,
+      rlGetCullDistanceNear(), rlGetCullDistanceFar());
+  }
+  else if (camera.projection == CAMERA_ORTHOGRAPHIC)
+  {
+    double top = camera.fovy / 2.0;
+    double right = top * (screenWidth / screenHeight);
+    projection = MatrixOrtho(-right, right, -top, top, rlGetCullDistanceNear(), rlGetCullDistanceFar());
+  }
+  Matrix view = MatrixLookAt(camera.position, camera.target, camera.up);
+  return MatrixMultiply(view, projection);
+}
+
+static void HealthBarProject(Matrix m, float screenWidth, float screenHeight)
+{
+  int i = 0;
+  for (; i + 4 <= healthBarCount; i += 4)
+  {
+    HealthBarFloat4 x = *(HealthBarFloat4 *)&healthBarPositionX[i];
+    HealthBarFloat4 y = *(HealthBarFloat4 *)&healthBarPositionY[i];
+    HealthBarFloat4 z = *(HealthBarFloat4 *)&healthBarPositionZ[i];
+    HealthBarFloat4 clipX = x * m.m0 + y * m.m4 + z * m.m8 + m.m12;
+    HealthBarFloat4 clipY = x * m.m1 + y * m.m5 + z * m.m9 + m.m13;
+    HealthBarFloat4 clipW = x * m.m3 + y * m.m7 + z * m.m11 + m.m15;
+    *(HealthBarFloat4 *)&healthBarScreenX[i] = (clipX / clipW + 1.0f) * 0.5f * screenWidth;
+    *(HealthBarFloat4 *)&healthBarScreenY[i] = (-clipY / clipW + 1.0f) * 0.5f * screenHeight;
+    *(HealthBarFloat4 *)&healthBarClipW[i] = clipW;
+  }
+  for (; i < healthBarCount; i++)
+  {
+    float x = healthBarPositionX[i], y = healthBarPositionY[i], z = healthBarPositionZ[i];
+    float clipW = x * m.m3 + y * m.m7 + z * m.m11 + m.m15;
+    healthBarScreenX[i] = ((x * m.m0 + y * m.m4 + z * m.m8 + m.m12) / clipW + 1.0f) * 0.5f * screenWidth;
+    healthBarScreenY[i] = (-(x * m.m1 + y * m.m5 + z * m.m9 + m.m13) / clipW + 1.0f) * 0.5f * screenHeight;
+    healthBarClipW[i] = clipW;
+  }
+}
+
+static void HealthBarAddRectangle(int x, int y, int width, int height, Color color)
+{
+  rlColor4ub(color.r, color.g, color.b, color.a);
+  rlVertex2f(x, y);
+  rlVertex2f(x, y + height);
+  rlVertex2f(x + width, y + height);
+  rlVertex2f(x, y);
+  rlVertex2f(x + width, y + height);
+  rlVertex2f(x + width, y);
+}
+
+// draws all health bars added since the last call; must be called outside BeginMode3D
+void HealthBarBatchDraw(Camera3D camera)
+{
+  const float healthBarHeight = 6.0f;
+  const float healthBarOffset = 15.0f;
+  const float inset = 2.0f;
+  const float innerHeight = healthBarHeight - inset * 2;
+
+  float screenWidth = GetScreenWidth();
+  float screenHeight = GetScreenHeight();
+  HealthBarProject(HealthBarGetViewProjection(camera, screenWidth, screenHeight), screenWidth, screenHeight);
+
+  // plain colored triangles; make sure they don't pick up the texture of a previous draw
+  rlSetTexture(rlGetTextureIdDefault());
+  int i = 0;
+  while (i < healthBarCount)
+  {
+    // 2 rectangles per bar, 6 vertices each; emit up to 256 bars at a time
+    int end = i + 256 < healthBarCount ? i + 256 : healthBarCount;
+    rlCheckRenderBatchLimit((end - i) * 12);
+    rlBegin(RL_TRIANGLES);
+    for (; i < end; i++)
+    {
+      float width = healthBarWidth[i];
+      float left = healthBarScreenX[i] - width * 0.5f;
+      float top = healthBarScreenY[i] - healthBarOffset;
+      if (healthBarClipW[i] <= 0.0f || left + width < 0.0f || left > screenWidth ||
+        top + healthBarHeight < 0.0f || top > screenHeight)
+      {
+        continue;
+      }
+      // truncated to whole pixels, like DrawRectangle does
+      HealthBarAddRectangle(left, top, width, healthBarHeight, BLACK);
+      float innerWidth = width - inset * 2;
+      HealthBarAddRectangle(left + inset, top + inset, innerWidth * healthBarRatio[i], innerHeight, healthBarColor[i]);
+    }
+    rlEnd();
+  }
+  rlSetTexture(0);
+
+  healthBarCount = 0;
+}
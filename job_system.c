@@ -0,0 +1,281 @@
+#include "td_main.h"
+#include <stdlib.h>
+
+// A small pool of worker threads that run jobs. Jobs must not touch raylib's
+// GPU or window functions; those are only allowed on the main thread. The web
+// build has no threads, so there the jobs are executed right away on the
+// calling thread, which is also what happens when the pool is initialized
+// with 0 threads.
+//
+// Every worker has its own queue and the threads outside of the pool share
+// one more. A thread takes the job it submitted last from its own queue, so
+// a job that spawns more jobs usually keeps working on its own data; idle
+// threads steal the oldest jobs from the other queues.
+#if !defined(PLATFORM_WEB)
+#define JOB_SYSTEM_USE_THREADS
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifdef JOB_SYSTEM_USE_THREADS
+// ring buffer of queued jobs; the owner pops at the back, thieves at the front
+typedef struct JobQueue
+{
+  pthread_mutex_t mutex;
+  Job jobs[JOB_QUEUE_CAPACITY];
+  int head;
+  int count;
+} JobQueue;
+
+static pthread_t jobThreads[JOB_SYSTEM_MAX_THREADS];
+// queue 0 belongs to the threads outside of the pool, queue i to worker i
+static JobQueue jobQueues[JOB_SYSTEM_MAX_THREADS + 1];
+static __thread int jobThreadIndex = 0;
+static pthread_mutex_t jobSleepMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobAvailable = PTHREAD_COND_INITIALIZER;
+// workers waiting on jobAvailable; submitting only signals if there are any
+static int jobSleepingCount = 0;
+// never less than the number of jobs in the queues, so a worker only goes to
+// sleep when there is nothing to steal
+static int jobQueuedCount = 0;
+// fixed before the workers start, so they can read it without locking
+static int jobQueueCount = 0;
+#endif
+static int jobThreadCount = 0;
+static int jobSystemRunning = 0;
+// queued jobs plus the ones that are running
+static int jobPendingCount = 0;
+
+#ifdef JOB_SYSTEM_USE_THREADS
+static int JobQueuePush(JobQueue *queue, Job job)
+{
+  pthread_mutex_lock(&queue->mutex);
+  int isPushed = queue->count < JOB_QUEUE_CAPACITY;
+  if (isPushed)
+  {
+    queue->jobs[(queue->head + queue->count) % JOB_QUEUE_CAPACITY] = job;
+    __atomic_store_n(&queue->count, queue->count + 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return isPushed;
+}
+
+static int JobQueuePop(JobQueue *queue, int isStealing, Job *job)
+{
+  // a quick look without the lock; an empty queue is the common case when stealing.
+  // The count is only changed under the lock, but stored atomically for this
+  if (__atomic_load_n(&queue->count, __ATOMIC_RELAXED) == 0)
+  {
+    return 0;
+  }
+  pthread_mutex_lock(&queue->mutex);
+  int isPopped = queue->count > 0;
+  if (isPopped && isStealing)
+  {
+    *job = queue->jobs[queue->head];
+    queue->head = (queue->head + 1) % JOB_QUEUE_CAPACITY;
+    __atomic_store_n(&queue->count, queue->count - 1, __ATOMIC_RELAXED);
+  }
+  else if (isPopped)
+  {
+    __atomic_store_n(&queue->count, queue->count - 1, __ATOMIC_RELAXED);
+    *job = queue->jobs[(queue->head + queue->count) % JOB_QUEUE_CAPACITY];
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return isPopped;
+}
+
+// runs one job from the calling thread's queue or, if that is empty, one
+// stolen from another queue; returns 0 if there was nothing to do
+static int JobSystemRunOne()
+{
+  int queueCount = jobQueueCount;
+  Job job;
+  int isFound = JobQueuePop(&jobQueues[jobThreadIndex], 0, &job);
+  // start with the next queue, so the thieves don't all go for the same one
+  for (int i = 1; !isFound && i < queueCount; i++)
+  {
+    isFound = JobQueuePop(&jobQueues[(jobThreadIndex + i) % queueCount], 1, &job);
+  }
+  if (!isFound)
+  {
+    return 0;
+  }
+  __atomic_sub_fetch(&jobQueuedCount, 1, __ATOMIC_SEQ_CST);
+  job.function(job.data);
+  __atomic_sub_fetch(&jobPendingCount, 1, __ATOMIC_ACQ_REL);
+  return 1;
+}
+
+static void *JobSystemWorker(void *arg)
+{
+  jobThreadIndex = (int)(intptr_t)arg;
+  while (1)
+  {
+    if (JobSystemRunOne())
+    {
+      continue;
+    }
+    pthread_mutex_lock(&jobSleepMutex);
+    __atomic_add_fetch(&jobSleepingCount, 1, __ATOMIC_SEQ_CST);
+    while (jobSystemRunning && __atomic_load_n(&jobQueuedCount, __ATOMIC_SEQ_CST) == 0)
+    {
+      pthread_cond_wait(&jobAvailable, &jobSleepMutex);
+    }
+    __atomic_sub_fetch(&jobSleepingCount, 1, __ATOMIC_SEQ_CST);
+    int isRunning = jobSystemRunning;
+    pthread_mutex_unlock(&jobSleepMutex);
+    if (!isRunning)
+    {
+      break;
+    }
+  }
+  return 0;
+}
+#endif
+
+int JobSystemGetDefaultThreadCount()
+{
+  // TD_JOB_THREADS overrides the thread count; 0 runs all jobs on the main thread
+  const char *threadCount = getenv("TD_JOB_THREADS");
+  if (threadCount)
+  {
+    return atoi(threadCount);
+  }
+#if defined(JOB_SYSTEM_USE_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+  // keep one core for the main thread
+  return (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+#elif defined(JOB_SYSTEM_USE_THREADS)
+  return 3;
+#else
+  return 0;
+#endif
+}
+
+void JobSystemInit(int threadCount)
+{
+  if (jobSystemRunning)
+  {
+    return;
+  }
+  jobSystemRunning = 1;
+  jobPendingCount = 0;
+  jobThreadCount = 0;
+
+#ifdef JOB_SYSTEM_USE_THREADS
+  if (threadCount > JOB_SYSTEM_MAX_THREADS)
+  {
+    threadCount = JOB_SYSTEM_MAX_THREADS;
+  }
+  if (threadCount < 0)
+  {
+    threadCount = 0;
+  }
+  jobQueuedCount = 0;
+  jobSleepingCount = 0;
+  jobQueueCount = threadCount + 1;
+  for (int i = 0; i < jobQueueCount; i++)
+  {
+    pthread_mutex_init(&jobQueues[i].mutex, 0);
+    jobQueues[i].head = 0;
+    jobQueues[i].count = 0;
+  }
+  // a worker that fails to start leaves an empty queue behind, which does no harm
+  for (int i = 0; i < threadCount; i++)
+  {
+    if (pthread_create(&jobThreads[jobThreadCount], 0, JobSystemWorker, (void *)(intptr_t)(i + 1)) == 0)
+    {
+      jobThreadCount++;
+    }
+  }
+#endif
+  TraceLog(LOG_INFO, "JOBS: started %d worker threads", jobThreadCount);
+}
+
+void JobSystemShutdown()
+{
+  if (!jobSystemRunning)
+  {
+    return;
+  }
+#ifdef JOB_SYSTEM_USE_THREADS
+  pthread_mutex_lock(&jobSleepMutex);
+  jobSystemRunning = 0;
+  pthread_cond_broadcast(&jobAvailable);
+  pthread_mutex_unlock(&jobSleepMutex);
+  for (int i = 0; i < jobThreadCount; i++)
+  {
+    pthread_join(jobThreads[i], 0);
+  }
+  for (int i = 0; i < jobQueueCount; i++)
+  {
+    pthread_mutex_destroy(&jobQueues[i].mutex);
+  }
+  jobQueueCount = 0;
+#endif
+  jobSystemRunning = 0;
+  jobThreadCount = 0;
+}
+
+int JobSystemGetThreadCount()
+{
+  return jobThreadCount;
+}
+
+// 0 on threads outside of the pool, 1 to JobSystemGetThreadCount() on the workers
+int JobSystemGetThreadIndex()
+{
+#ifdef JOB_SYSTEM_USE_THREADS
+  return jobThreadIndex;
+#else
+  return 0;
+#endif
+}
+
+void JobSystemSubmit(JobFunction function, void *data)
+{
+#ifdef JOB_SYSTEM_USE_THREADS
+  if (jobThreadCount > 0)
+  {
+    __atomic_add_fetch(&jobPendingCount, 1, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&jobQueuedCount, 1, __ATOMIC_SEQ_CST);
+    if (JobQueuePush(&jobQueues[jobThreadIndex], (Job){function, data}))
+    {
+      if (__atomic_load_n(&jobSleepingCount, __ATOMIC_SEQ_CST) > 0)
+      {
+        pthread_mutex_lock(&jobSleepMutex);
+        pthread_cond_signal(&jobAvailable);
+        pthread_mutex_unlock(&jobSleepMutex);
+      }
+      return;
+    }
+    // the queue is full; instead of waiting, the caller does the work itself
+    __atomic_sub_fetch(&jobQueuedCount, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&jobPendingCount, 1, __ATOMIC_ACQ_REL);
+  }
+#endif
+  function(data);
+}
+
+// blocks until the counter drops to 0; the calling thread runs queued jobs
+// while it waits, so it counts as one more worker
+void JobSystemWaitForCounter(int *counter)
+{
+#ifdef JOB_SYSTEM_USE_THREADS
+  while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) > 0)
+  {
+    if (!JobSystemRunOne())
+    {
+      // the remaining jobs are running on other threads
+      sched_yield();
+    }
+  }
+#endif
+}
+
+// blocks until all submitted jobs are done; must not be called from a job
+void JobSystemWait()
+{
+  JobSystemWaitForCounter(&jobPendingCount);
+}
\ No newline at end of file
@@ -0,0 +1,331 @@
+#include "td_main.h"
+#include <raymath.h>
+
+// The level simulation: the waves, the state machine and the update of all
+// game systems. Nothing in here draws or reads input, so it runs the same
+// in the game and in the headless build; the front ends translate their
+// input into the LevelAction functions. All state lives in the World, so
+// any number of worlds can be simulated independently of each other.
+
+//# Variables
+// the level templates; a world starts with a copy of the first one
+static const Level levels[] = {
+  [0] = {
+    .state = LEVEL_STATE_BUILDING,
+    .initialGold = 20,
+    .waves[0] = {
+      .enemyType = ENEMY_TYPE_MINION,
+      .wave = 0,
+      .count = 10,
+      .interval = 2.5f,
+      .delay = 1.0f,
+      .spawnPosition = {0, 6},
+    },
+    .waves[1] = {
+      .enemyType = ENEMY_TYPE_MINION,
+      .wave = 1,
+      .count = 20,
+      .interval = 1.5f,
+      .delay = 1.0f,
+      .spawnPosition = {0, 6},
+    },
+    .waves[2] = {
+      .enemyType = ENEMY_TYPE_MINION,
+      .wave = 2,
+      .count = 30,
+      .interval = 1.2f,
+      .delay = 1.0f,
+      .spawnPosition = {0, 6},
+    }
+  },
+};
+
+void InitLevel(World *world)
+{
+  Level *level = &world->level;
+  // the game time makes every reset look different while staying reproducible
+  level->seed = world->seed + (int)(world->gameTime.time * 100.0f);
+
+  TowerInit(world);
+  EnemyInit(world);
+  ProjectileInit(world);
+  ParticleInit(world);
+  AreaDamageInit(world);
+  TowerTryAdd(world, TOWER_TYPE_BASE, 0, 0);
+
+  level->state = LEVEL_STATE_BUILDING;
+  level->nextState = LEVEL_STATE_NONE;
+  level->playerGold = level->initialGold;
+  level->currentWave = 0;
+
+  Camera *camera = &level->camera;
+  camera->position = (Vector3){4.0f, 8.0f, 8.0f};
+  camera->target = (Vector3){0.0f, 0.0f, 0.0f};
+  camera->up = (Vector3){0.0f, 1.0f, 0.0f};
+  camera->fovy = 10.0f;
+  camera->projection = CAMERA_ORTHOGRAPHIC;
+}
+
+int HasLevelNextWave(Level *level)
+{
+  for (int i = 0; i < 10; i++)
+  {
+    EnemyWave *wave = &level->waves[i];
+    if (wave->wave == level->currentWave)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void InitBattleStateConditions(Level *level)
+{
+  level->state = LEVEL_STATE_BATTLE;
+  level->nextState = LEVEL_STATE_NONE;
+  level->waveEndTimer = 0.0f;
+  for (int i = 0; i < 10; i++)
+  {
+    EnemyWave *wave = &level->waves[i];
+    wave->spawned = 0;
+    wave->timeToSpawnNext = wave->delay;
+  }
+}
+
+static void LevelUpdateWaves(World *world)
+{
+  Level *level = &world->level;
+  if (level->state != LEVEL_STATE_BATTLE)
+  {
+    return;
+  }
+  int activeWaves = 0;
+  for (int i = 0; i < 10; i++)
+  {
+    EnemyWave *wave = &level->waves[i];
+    if (wave->spawned >= wave->count || wave->wave != level->currentWave)
+    {
+      continue;
+    }
+    activeWaves++;
+    wave->timeToSpawnNext -= world->gameTime.deltaTime;
+    if (wave->timeToSpawnNext <= 0.0f)
+    {
+      Enemy *enemy = EnemyTryAdd(world, wave->enemyType, wave->spawnPosition.x, wave->spawnPosition.y);
+      if (enemy)
+      {
+        wave->timeToSpawnNext = wave->interval;
+        wave->spawned++;
+      }
+    }
+  }
+  if (GetTowerByType(world, TOWER_TYPE_BASE) == 0) {
+    level->waveEndTimer += world->gameTime.deltaTime;
+    if (level->waveEndTimer >= 2.0f)
+    {
+      level->nextState = LEVEL_STATE_LOST_WAVE;
+    }
+  }
+  else if (activeWaves == 0 && EnemyCount(world) == 0)
+  {
+    level->waveEndTimer += world->gameTime.deltaTime;
+    if (level->waveEndTimer >= 2.0f)
+    {
+      level->nextState = LEVEL_STATE_WON_WAVE;
+    }
+  }
+}
+
+// the systems of a tick in the order they used to be called in; the task graph
+// keeps that order only where the declared data overlaps
+static const Task levelUpdateTasks[] = {
+  {"waves", LevelUpdateWaves, .reads = WORLD_DATA_TOWERS, .writes = WORLD_DATA_LEVEL | WORLD_DATA_ENEMIES},
+  {"pathfinding", PathFindingMapUpdate, .reads = WORLD_DATA_TOWERS, .writes = WORLD_DATA_PATHFINDING},
+  // enemies that reach a tower explode, destroying it and spawning particles and area damage
+  {"enemies", EnemyUpdate, .reads = WORLD_DATA_PATHFINDING,
+    .writes = WORLD_DATA_ENEMIES | WORLD_DATA_TOWERS | WORLD_DATA_PARTICLES | WORLD_DATA_AREA_DAMAGE},
+  // towers predict the enemy positions along the path and add their future damage
+  {"towers", TowerUpdate, .reads = WORLD_DATA_PATHFINDING,
+    .writes = WORLD_DATA_ENEMIES | WORLD_DATA_TOWERS | WORLD_DATA_PROJECTILES},
+  {"projectiles", ProjectileUpdate, .reads = WORLD_DATA_ENEMIES,
+    .writes = WORLD_DATA_PROJECTILES | WORLD_DATA_AREA_DAMAGE | WORLD_DATA_DAMAGE_EVENTS},
+  {"area damage", AreaDamageUpdate,
+    .writes = WORLD_DATA_AREA_DAMAGE | WORLD_DATA_ENEMIES | WORLD_DATA_DAMAGE_EVENTS},
+  // killed enemies pay out their gold
+  {"damage", EnemyApplyDamageEvents, .writes = WORLD_DATA_DAMAGE_EVENTS | WORLD_DATA_ENEMIES | WORLD_DATA_LEVEL},
+  {"particles", ParticleUpdate, .writes = WORLD_DATA_PARTICLES},
+};
+
+void UpdateLevel(World *world)
+{
+  Level *level = &world->level;
+  TaskGraphRun(levelUpdateTasks, sizeof(levelUpdateTasks) / sizeof(levelUpdateTasks[0]), world, world->updateTrace);
+
+  if (level->nextState == LEVEL_STATE_RESET)
+  {
+    InitLevel(world);
+  }
+  
+  if (level->nextState == LEVEL_STATE_BATTLE)
+  {
+    InitBattleStateConditions(level);
+  }
+  
+  if (level->nextState == LEVEL_STATE_WON_WAVE)
+  {
+    level->currentWave++;
+    level->state = LEVEL_STATE_WON_WAVE;
+  }
+  
+  if (level->nextState == LEVEL_STATE_LOST_WAVE)
+  {
+    level->state = LEVEL_STATE_LOST_WAVE;
+  }
+
+  if (level->nextState == LEVEL_STATE_BUILDING)
+  {
+    level->state = LEVEL_STATE_BUILDING;
+  }
+
+  if (level->nextState == LEVEL_STATE_WON_LEVEL)
+  {
+    // make something of this later
+    InitLevel(world);
+  }
+
+  level->nextState = LEVEL_STATE_NONE;
+}
+
+//# World
+
+// creates a world with its own copy of the first level; the level seeds are derived from seed
+World *WorldCreate(int seed)
+{
+  World *world = (World *)MemAlloc(sizeof(World));
+  if (!world)
+  {
+    return 0;
+  }
+  world->seed = seed;
+  world->level = levels[0];
+  PathfindingMapInit(world, 20, 20, (Vector3){-10.0f, 0.0f, -10.0f}, 1.0f);
+  InitLevel(world);
+  return world;
+}
+
+void WorldDestroy(World *world)
+{
+  if (!world)
+  {
+    return;
+  }
+  PathfindingMapUnload(world);
+  MemFree(world);
+}
+
+// advances the world by one tick with the given player input; every front end
+// steps the world through here, so a recorded match plays back the same way.
+// Returns the number of actions that could not be applied
+int WorldStep(World *world, float deltaTime, const LevelAction *actions, int actionCount)
+{
+  world->gameTime.time += deltaTime;
+  world->gameTime.deltaTime = deltaTime;
+
+  int failedCount = 0;
+  for (int i = 0; i < actionCount; i++)
+  {
+    if (world->replayRecorder)
+    {
+      ReplayRecorderAddAction(world, actions[i]);
+    }
+    if (!LevelActionApply(world, actions[i]))
+    {
+      failedCount++;
+    }
+  }
+
+  UpdateLevel(world);
+  world->tick++;
+  world->stateHash = WorldHashState(world);
+  if (world->replayRecorder)
+  {
+    ReplayRecorderEndTick(world);
+  }
+  if (world->rewindHistory)
+  {
+    RewindHistoryRecord(world->rewindHistory, world);
+  }
+  return failedCount;
+}
+
+//# Level actions
+
+// places a tower and pays for it; returns 1 if the tower was placed
+int LevelActionPlaceTower(World *world, uint8_t towerType, int16_t x, int16_t y)
+{
+  Level *level = &world->level;
+  if (level->state != LEVEL_STATE_BUILDING || x < -5 || x > 5 || y < -5 || y > 5)
+  {
+    return 0;
+  }
+  if (level->playerGold < GetTowerCosts(towerType))
+  {
+    return 0;
+  }
+  if (!TowerTryAdd(world, towerType, x, y))
+  {
+    return 0;
+  }
+  level->playerGold -= GetTowerCosts(towerType);
+  return 1;
+}
+
+// requests a state change (e.g. LEVEL_STATE_BATTLE to begin the waves); it happens at the end of the next update
+void LevelActionSetNextState(World *world, int nextState)
+{
+  world->level.nextState = nextState;
+}
+
+// returns 0 if the action could not be applied, e.g. because the tower doesn't fit
+int LevelActionApply(World *world, LevelAction action)
+{
+  switch (action.actionType)
+  {
+  case LEVEL_ACTION_PLACE_TOWER:
+    return LevelActionPlaceTower(world, action.towerType, action.x, action.y);
+  case LEVEL_ACTION_SET_NEXT_STATE:
+    LevelActionSetNextState(world, action.nextState);
+    return 1;
+  }
+  return 0;
+}
+
+// copies what is needed to draw the world; the snapshot is all the renderer gets to see
+void LevelWriteSnapshot(World *world, RenderSnapshot *snapshot)
+{
+  Level *level = &world->level;
+  snapshot->time = world->gameTime.time;
+  snapshot->camera = level->camera;
+  snapshot->levelState = level->state;
+  snapshot->hasNextWave = HasLevelNextWave(level);
+  snapshot->levelSeed = level->seed;
+  snapshot->playerGold = level->playerGold;
+
+  snapshot->waveEnemyCount = 0;
+  snapshot->waveRemainingCount = EnemyCount(world);
+  for (int i = 0; i < 10; i++)
+  {
+    EnemyWave *wave = &level->waves[i];
+    if (wave->wave != level->currentWave)
+    {
+      continue;
+    }
+    snapshot->waveEnemyCount += wave->count;
+    snapshot->waveRemainingCount += wave->count - wave->spawned;
+  }
+
+  TowerWriteSnapshot(world, snapshot);
+  EnemyWriteSnapshot(world, snapshot);
+  ProjectileWriteSnapshot(world, snapshot);
+  ParticleWriteSnapshot(world, snapshot);
+}
@@ -0,0 +1,111 @@
+#include "td_main.h"
+// raymath declares its functions inline; raylib normally provides the out of
+// line copies, so without raylib this file emits them for the whole build
+#define RAYMATH_IMPLEMENTATION
+#include <raymath.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+
+// The headless build links the game systems without raylib, so there is no
+// window, no GL context and no GL libraries to load. The systems still have
+// their draw functions, which reference a few raylib and renderer functions;
+// this file provides stand-ins for them that do nothing (or the bare minimum,
+// for the few utility functions the simulation really uses), plus the
+// raymath definitions that would otherwise live in raylib.
+
+//# Variables
+Texture2D spriteSheet = {0};
+
+//# raylib
+
+static int nullRendererLogLevel = LOG_INFO;
+
+void SetTraceLogLevel(int logLevel)
+{
+  nullRendererLogLevel = logLevel;
+}
+
+void TraceLog(int logLevel, const char *text, ...)
+{
+  if (logLevel < nullRendererLogLevel)
+  {
+    return;
+  }
+  va_list args;
+  va_start(args, text);
+  vfprintf(stderr, text, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+void *MemAlloc(unsigned int size)
+{
+  return calloc(size, 1);
+}
+
+void *MemRealloc(void *ptr, unsigned int size)
+{
+  return realloc(ptr, size);
+}
+
+void MemFree(void *ptr)
+{
+  free(ptr);
+}
+
+double GetTime(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+Color ColorLerp(Color color1, Color color2, float factor)
+{
+  return color1;
+}
+
+Vector2 GetWorldToScreen(Vector3 position, Camera camera)
+{
+  return (Vector2){0};
+}
+
+void DrawCube(Vector3 position, float width, float height, float length, Color color)
+{
+}
+
+//# Renderer
+
+// nothing is ever visible, so the draw functions skip everything early
+int VisibilityIsVisible(float x, float z)
+{
+  return 0;
+}
+
+void CubeBatchAdd(Vector3 position, Vector3 size, Color color)
+{
+}
+
+void SpriteBatchAdd(Texture2D texture, Rectangle srcRect, Vector3 position, Vector2 size, Vector2 origin, Color tint)
+{
+}
+
+void HealthBarBatchAdd(Vector3 position, float healthRatio, Color barColor, float width)
+{
+}
+
+void RenderQueueAddModel(Model model, Matrix transform, Color tint)
+{
+}
+
+//# Assets
+
+void RequestGLBModel(char *filename, Model *model)
+{
+}
+
+void AssetCacheReleaseModel(Model model)
+{
+}
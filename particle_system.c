@@ -1,99 +1,196 @@
 #include "td_main.h"
 #include <raymath.h>
 
-static Particle particles[PARTICLE_MAX_COUNT];
-static int particleCount = 0;
+// Every particle type has its own emitter. All particles of an emitter live
+// equally long, so they die in the order they were spawned: the live particles
+// are a ring buffer from tail (oldest) to head (newest) and retiring them just
+// moves the tail forward - no free slot search, no holes to skip.
+// The particle data is stored as separate arrays per component (structure of
+// arrays), so the integration can process 4 particles per instruction.
 
-void ParticleInit()
+// how long the particles of each type live, in seconds
+static const float particleLifetimes[PARTICLE_TYPE_COUNT] = {
+  [PARTICLE_TYPE_EXPLOSION] = 1.0f,
+  [PARTICLE_TYPE_DEBRIS] = 0.6f,
+};
+
+// 4 floats that may be loaded from any float address
+typedef float ParticleFloat4 __attribute__((vector_size(16), aligned(4), may_alias));
+
+static float ParticleGetRandomFloat(World *world, float min, float max)
+{
+  // xorshift32
+  uint32_t state = world->particleRandomState;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  world->particleRandomState = state;
+  return min + (state >> 8) * (1.0f / 16777216.0f) * (max - min);
+}
+
+static ParticleEmitter *ParticleGetEmitter(World *world, uint8_t particleType)
+{
+  if (particleType == PARTICLE_TYPE_NONE || particleType >= PARTICLE_TYPE_COUNT)
+  {
+    return 0;
+  }
+  return &world->particleEmitters[particleType - 1];
+}
+
+void ParticleInit(World *world)
 {
-  for (int i = 0; i < PARTICLE_MAX_COUNT; i++)
+  world->particleRandomState = 0x12345678;
+  for (int i = 1; i < PARTICLE_TYPE_COUNT; i++)
   {
-    particles[i] = (Particle){0};
+    ParticleEmitter *emitter = ParticleGetEmitter(world, i);
+    emitter->particleType = i;
+    emitter->lifetime = particleLifetimes[i];
+    emitter->head = 0;
+    emitter->tail = 0;
   }
-  particleCount = 0;
 }
 
-static void DrawExplosionParticle(Particle *particle, float transition)
+static void DrawExplosionParticle(Vector3 position, float transition)
 {
   float size = 1.2f * (1.0f - transition);
   Color startColor = WHITE;
   Color endColor = RED;
   Color color = ColorLerp(startColor, endColor, transition);
-  DrawCube(particle->position, size, size, size, color);
+  CubeBatchAdd(position, (Vector3){size, size, size}, color);
 }
 
-void ParticleAdd(uint8_t particleType, Vector3 position, Vector3 velocity, float lifetime)
+static void DrawDebrisParticle(Vector3 position, float transition)
 {
-  if (particleCount >= PARTICLE_MAX_COUNT)
+  float size = 0.12f * (1.0f - transition * transition);
+  Color color = ColorLerp(ORANGE, DARKGRAY, transition);
+  CubeBatchAdd(position, (Vector3){size, size, size}, color);
+}
+
+void ParticleAdd(World *world, uint8_t particleType, Vector3 position, Vector3 velocity)
+{
+  ParticleEmitter *emitter = ParticleGetEmitter(world, particleType);
+  if (!emitter)
   {
     return;
   }
 
-  int index = -1;
-  for (int i = 0; i < particleCount; i++)
+  if (emitter->head - emitter->tail >= PARTICLE_EMITTER_CAPACITY)
   {
-    if (particles[i].particleType == PARTICLE_TYPE_NONE)
-    {
-      index = i;
-      break;
-    }
+    // the emitter is full; the oldest particle is closest to dying anyway
+    emitter->tail++;
   }
 
-  if (index == -1)
+  uint32_t index = emitter->head++ & (PARTICLE_EMITTER_CAPACITY - 1);
+  emitter->positionX[index] = position.x;
+  emitter->positionY[index] = position.y;
+  emitter->positionZ[index] = position.z;
+  emitter->velocityX[index] = velocity.x;
+  emitter->velocityY[index] = velocity.y;
+  emitter->velocityZ[index] = velocity.z;
+  emitter->spawnTime[index] = world->gameTime.time;
+}
+
+// spawns count particles at position, flying upwards and outwards with up to the given speed
+void ParticleEmitBurst(World *world, uint8_t particleType, Vector3 position, int count, float speed)
+{
+  for (int i = 0; i < count; i++)
   {
-    index = particleCount++;
+    Vector3 velocity = {
+      ParticleGetRandomFloat(world, -speed, speed),
+      ParticleGetRandomFloat(world, 0.25f * speed, speed),
+      ParticleGetRandomFloat(world, -speed, speed),
+    };
+    ParticleAdd(world, particleType, position, velocity);
   }
+}
 
-  Particle *particle = &particles[index];
-  particle->particleType = particleType;
-  particle->spawnTime = gameTime.time;
-  particle->lifetime = lifetime;
-  particle->position = position;
-  particle->velocity = velocity;
+static void ParticleIntegrate(float *position, const float *velocity, uint32_t start, uint32_t end, float deltaTime)
+{
+  uint32_t i = start;
+  ParticleFloat4 deltaTime4 = {deltaTime, deltaTime, deltaTime, deltaTime};
+  for (; i + 4 <= end; i += 4)
+  {
+    *(ParticleFloat4 *)&position[i] += *(const ParticleFloat4 *)&velocity[i] * deltaTime4;
+  }
+  for (; i < end; i++)
+  {
+    position[i] += velocity[i] * deltaTime;
+  }
 }
 
-void ParticleUpdate()
+void ParticleUpdate(World *world)
 {
-  for (int i = 0; i < particleCount; i++)
+  for (int i = 1; i < PARTICLE_TYPE_COUNT; i++)
   {
-    Particle *particle = &particles[i];
-    if (particle->particleType == PARTICLE_TYPE_NONE)
+    ParticleEmitter *emitter = ParticleGetEmitter(world, i);
+
+    // retire the particles that are too old; they are all at the tail
+    while (emitter->tail != emitter->head &&
+      world->gameTime.time - emitter->spawnTime[emitter->tail & (PARTICLE_EMITTER_CAPACITY - 1)] >= emitter->lifetime)
+    {
+      emitter->tail++;
+    }
+    if (emitter->tail == emitter->head)
     {
       continue;
     }
 
-    float age = gameTime.time - particle->spawnTime;
+    // the ages are derived from the spawn time, so only the positions need
+    // integrating; the live range wraps around at most once
+    uint32_t start = emitter->tail & (PARTICLE_EMITTER_CAPACITY - 1);
+    uint32_t count = emitter->head - emitter->tail;
+    uint32_t firstEnd = start + count > PARTICLE_EMITTER_CAPACITY ? PARTICLE_EMITTER_CAPACITY : start + count;
+    uint32_t wrappedEnd = start + count - firstEnd;
+    float deltaTime = world->gameTime.deltaTime;
+    ParticleIntegrate(emitter->positionX, emitter->velocityX, start, firstEnd, deltaTime);
+    ParticleIntegrate(emitter->positionY, emitter->velocityY, start, firstEnd, deltaTime);
+    ParticleIntegrate(emitter->positionZ, emitter->velocityZ, start, firstEnd, deltaTime);
+    ParticleIntegrate(emitter->positionX, emitter->velocityX, 0, wrappedEnd, deltaTime);
+    ParticleIntegrate(emitter->positionY, emitter->velocityY, 0, wrappedEnd, deltaTime);
+    ParticleIntegrate(emitter->positionZ, emitter->velocityZ, 0, wrappedEnd, deltaTime);
+  }
+}
 
-    if (particle->lifetime > age)
+void ParticleWriteSnapshot(World *world, RenderSnapshot *snapshot)
+{
+  int count = 0;
+  for (int i = 1; i < PARTICLE_TYPE_COUNT; i++)
+  {
+    ParticleEmitter *emitter = ParticleGetEmitter(world, i);
+    for (uint32_t p = emitter->tail; p != emitter->head; p++)
     {
-      particle->position = Vector3Add(particle->position, Vector3Scale(particle->velocity, gameTime.deltaTime));
-    }
-    else {
-      particle->particleType = PARTICLE_TYPE_NONE;
+      uint32_t index = p & (PARTICLE_EMITTER_CAPACITY - 1);
+      float age = world->gameTime.time - emitter->spawnTime[index];
+      snapshot->particles[count++] = (RenderSnapshotParticle){
+        .position = {emitter->positionX[index], emitter->positionY[index], emitter->positionZ[index]},
+        .transition = age / emitter->lifetime,
+        .particleType = emitter->particleType,
+      };
     }
   }
+  snapshot->particleCount = count;
 }
 
-void ParticleDraw()
+void ParticleDraw(const RenderSnapshot *snapshot)
 {
-  for (int i = 0; i < particleCount; i++)
+  for (int i = 0; i < snapshot->particleCount; i++)
   {
-    Particle particle = particles[i];
-    if (particle.particleType == PARTICLE_TYPE_NONE)
+    const RenderSnapshotParticle *particle = &snapshot->particles[i];
+    if (!VisibilityIsVisible(particle->position.x, particle->position.z))
     {
       continue;
     }
-
-    float age = gameTime.time - particle.spawnTime;
-    float transition = age / particle.lifetime;
-    switch (particle.particleType)
+    switch (particle->particleType)
     {
     case PARTICLE_TYPE_EXPLOSION:
-      DrawExplosionParticle(&particle, transition);
+      DrawExplosionParticle(particle->position, particle->transition);
+      break;
+    case PARTICLE_TYPE_DEBRIS:
+      DrawDebrisParticle(particle->position, particle->transition);
       break;
     default:
-      DrawCube(particle.position, 0.3f, 0.5f, 0.3f, RED);
+      CubeBatchAdd(particle->position, (Vector3){0.3f, 0.5f, 0.3f}, RED);
       break;
     }
   }
-}
\ No newline at end of file
+}
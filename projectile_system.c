@@ -1,28 +1,53 @@
 #include "td_main.h"
 #include <raymath.h>
 
-static Projectile projectiles[PROJECTILE_MAX_COUNT];
-static int projectileCount = 0;
+// The projectiles are kept densely packed: live projectiles are always stored
+// in world->projectiles[0] to world->projectiles[world->projectileCount - 1].
+// The array is ordered as a binary min-heap on the arrival time, so the next
+// projectile to land is always the first one and an update only has to touch
+// the projectiles that arrive in this tick, no matter how many are in flight.
 
-void ProjectileInit()
+void ProjectileInit(World *world)
 {
   for (int i = 0; i < PROJECTILE_MAX_COUNT; i++)
   {
-    projectiles[i] = (Projectile){0};
+    world->projectiles[i] = (Projectile){0};
   }
+  world->projectileCount = 0;
 }
 
-void ProjectileDraw()
+// only the projectiles that are still in flight are copied, together with how far they got
+void ProjectileWriteSnapshot(World *world, RenderSnapshot *snapshot)
 {
-  for (int i = 0; i < projectileCount; i++)
+  int count = 0;
+  for (int i = 0; i < world->projectileCount; i++)
   {
-    Projectile projectile = projectiles[i];
-    if (projectile.projectileType == PROJECTILE_TYPE_NONE)
+    Projectile *projectile = &world->projectiles[i];
+    float transition = (world->gameTime.time - projectile->shootTime) / (projectile->arrivalTime - projectile->shootTime);
+    if (transition >= 1.0f)
     {
       continue;
     }
-    float transition = (gameTime.time - projectile.shootTime) / (projectile.arrivalTime - projectile.shootTime);
-    if (transition >= 1.0f)
+    snapshot->projectiles[count++] = (RenderSnapshotProjectile){
+      .position = projectile->position,
+      .target = projectile->target,
+      .transition = transition,
+      .distance = projectile->distance,
+      .projectileType = projectile->projectileType,
+    };
+  }
+  snapshot->projectileCount = count;
+}
+
+void ProjectileDraw(const RenderSnapshot *snapshot)
+{
+  for (int i = 0; i < snapshot->projectileCount; i++)
+  {
+    RenderSnapshotProjectile projectile = snapshot->projectiles[i];
+    float transition = projectile.transition;
+    // the trail is short, so it's enough to check where the projectile is right now
+    Vector3 head = Vector3Lerp(projectile.position, projectile.target, transition);
+    if (!VisibilityIsVisible(head.x, head.z))
     {
       continue;
     }
@@ -44,56 +69,115 @@ void ProjectileDraw()
         parabolaT = 1.0f - 4.0f * parabolaT * parabolaT;
         position.y += 0.15f * parabolaT * projectile.distance;
       }
+      else if (projectile.projectileType == PROJECTILE_TYPE_CATAPULT)
+      {
+        // rocks are lobbed higher than arrows and don't leave a colored trail
+        color = ColorLerp(DARKGRAY, GRAY, transitionOffset);
+        float parabolaT = t - 0.5f;
+        parabolaT = 1.0f - 4.0f * parabolaT * parabolaT;
+        position.y += 0.3f * parabolaT * projectile.distance;
+      }
 
       float size = 0.06f * (transitionOffset + 0.25f);
-      DrawCube(position, size, size, size, color);
+      CubeBatchAdd(position, (Vector3){size, size, size}, color);
     }
   }
 }
 
-void ProjectileUpdate()
+// returns the index at which the projectile ended up
+static int ProjectileHeapSiftUp(World *world, int index)
 {
-  for (int i = 0; i < projectileCount; i++)
+  Projectile projectile = world->projectiles[index];
+  while (index > 0)
   {
-    Projectile *projectile = &projectiles[i];
-    if (projectile->projectileType == PROJECTILE_TYPE_NONE)
+    int parent = (index - 1) / 2;
+    if (world->projectiles[parent].arrivalTime <= projectile.arrivalTime)
     {
-      continue;
+      break;
     }
-    float transition = (gameTime.time - projectile->shootTime) / (projectile->arrivalTime - projectile->shootTime);
-    if (transition >= 1.0f)
+    world->projectiles[index] = world->projectiles[parent];
+    index = parent;
+  }
+  world->projectiles[index] = projectile;
+  return index;
+}
+
+static void ProjectileHeapSiftDown(World *world, int index)
+{
+  Projectile projectile = world->projectiles[index];
+  while (1)
+  {
+    int child = index * 2 + 1;
+    if (child >= world->projectileCount)
     {
-      projectile->projectileType = PROJECTILE_TYPE_NONE;
-      Enemy *enemy = EnemyTryResolve(projectile->targetEnemy);
-      if (enemy)
-      {
-        EnemyAddDamage(enemy, projectile->damage);
-      }
-      continue;
+      break;
+    }
+    if (child + 1 < world->projectileCount && world->projectiles[child + 1].arrivalTime < world->projectiles[child].arrivalTime)
+    {
+      child++;
+    }
+    if (projectile.arrivalTime <= world->projectiles[child].arrivalTime)
+    {
+      break;
     }
+    world->projectiles[index] = world->projectiles[child];
+    index = child;
   }
+  world->projectiles[index] = projectile;
 }
 
-Projectile *ProjectileTryAdd(uint8_t projectileType, Enemy *enemy, Vector3 position, Vector3 target, float speed, float damage)
+void ProjectileUpdate(World *world)
 {
-  for (int i = 0; i < PROJECTILE_MAX_COUNT; i++)
+  // pop all projectiles that arrive in this tick
+  int impactCount = 0;
+  while (world->projectileCount > 0 && world->projectiles[0].arrivalTime <= world->gameTime.time)
+  {
+    world->projectileImpacts[impactCount++] = world->projectiles[0];
+    world->projectiles[0] = world->projectiles[--world->projectileCount];
+    if (world->projectileCount > 0)
+    {
+      ProjectileHeapSiftDown(world, 0);
+    }
+  }
+
+  for (int i = 0; i < impactCount; i++)
   {
-    Projectile *projectile = &projectiles[i];
-    if (projectile->projectileType == PROJECTILE_TYPE_NONE)
+    Projectile *projectile = &world->projectileImpacts[i];
+    if (projectile->areaDamageRadius > 0.0f)
     {
-      projectile->projectileType = projectileType;
-      projectile->shootTime = gameTime.time;
-      float distance = Vector3Distance(position, target);
-      projectile->arrivalTime = gameTime.time + distance / speed;
-      projectile->damage = damage;
-      projectile->position = position;
-      projectile->target = target;
-      projectile->directionNormal = Vector3Scale(Vector3Subtract(target, position), 1.0f / distance);
-      projectile->distance = distance;
-      projectile->targetEnemy = EnemyGetId(enemy);
-      projectileCount = projectileCount <= i ? i + 1 : projectileCount;
-      return projectile;
+      // splash damage hits whatever is around the impact point
+      AreaDamageAdd(world, (Vector2){projectile->target.x, projectile->target.z}, projectile->areaDamageRadius, projectile->damage, 0.0f);
+      continue;
     }
+    Enemy *enemy = EnemyTryResolve(world, projectile->targetEnemy);
+    if (enemy)
+    {
+      // impacts are popped in arrival order, which makes their index a deterministic sequence number
+      EnemyQueueDamage(world, enemy, projectile->damage, ENEMY_DAMAGE_SORT_KEY(ENEMY_DAMAGE_SOURCE_PROJECTILE, i));
+    }
+  }
+}
+
+// the returned pointer is only valid until the next projectile is added or removed
+Projectile *ProjectileTryAdd(World *world, uint8_t projectileType, Enemy *enemy, Vector3 position, Vector3 target, float speed, float damage, float areaDamageRadius)
+{
+  if (world->projectileCount >= PROJECTILE_MAX_COUNT)
+  {
+    return 0;
   }
-  return 0;
+
+  Projectile *projectile = &world->projectiles[world->projectileCount];
+  projectile->projectileType = projectileType;
+  projectile->shootTime = world->gameTime.time;
+  float distance = Vector3Distance(position, target);
+  projectile->arrivalTime = world->gameTime.time + distance / speed;
+  projectile->damage = damage;
+  projectile->areaDamageRadius = areaDamageRadius;
+  projectile->position = position;
+  projectile->target = target;
+  projectile->directionNormal = Vector3Scale(Vector3Subtract(target, position), 1.0f / distance);
+  projectile->distance = distance;
+  projectile->targetEnemy = EnemyGetId(world, enemy);
+  int index = ProjectileHeapSiftUp(world, world->projectileCount++);
+  return &world->projectiles[index];
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "td_main.h"
+#include <raymath.h>
+#include <rlgl.h>
+#include <stdlib.h>
+
+// The systems don't draw their models directly anymore but record render
+// commands. Before submitting them, the commands are sorted by shader,
+// texture and mesh, so that everything using the same state is drawn back to
+// back. The batches (scenery, cubes, sprites) are recorded as single
+// commands with the state they draw with, so they get sorted in between.
+static RenderCommand renderCommands[RENDER_QUEUE_MAX_COUNT];
+static int renderCommandCount = 0;
+static RenderQueueStats renderQueueStats = {0};
+// counted while the frame is drawn, including the batches that are flushed
+// early because they are full; published by RenderQueueSubmit
+static int renderQueueDrawCallCount = 0;
+static int renderQueueObjectCount = 0;
+
+static uint64_t RenderQueueGetSortKey(uint8_t layer, unsigned int shaderId, unsigned int textureId, unsigned int meshId)
+{
+  return ((uint64_t)(layer & 0xf) << 60) | ((uint64_t)(shaderId & 0xfff) << 48) |
+    ((uint64_t)(textureId & 0xffff) << 32) | meshId;
+}
+
+void RenderQueueBegin()
+{
+  renderCommandCount = 0;
+  renderQueueDrawCallCount = 0;
+  renderQueueObjectCount = 0;
+}
+
+// called by the batches for the draw calls they issue
+void RenderQueueCountDrawCalls(int drawCallCount, int objectCount)
+{
+  renderQueueDrawCallCount += drawCallCount;
+  renderQueueObjectCount += objectCount;
+}
+
+static void RenderQueueExecute(RenderCommand *command)
+{
+  if (command->drawBatch)
+  {
+    command->drawBatch();
+    return;
+  }
+
+  // same as DrawModel: the tint is applied to the material color while drawing
+  Color *materialColor = &command->material->maps[MATERIAL_MAP_DIFFUSE].color;
+  Color color = *materialColor;
+  *materialColor = command->color;
+  DrawMesh(*command->mesh, *command->material, command->transform);
+  *materialColor = color;
+  RenderQueueCountDrawCalls(1, 1);
+}
+
+static RenderCommand *RenderQueueAdd(uint64_t sortKey)
+{
+  if (renderCommandCount >= RENDER_QUEUE_MAX_COUNT)
+  {
+    return 0;
+  }
+  RenderCommand *command = &renderCommands[renderCommandCount];
+  *command = (RenderCommand){0};
+  command->sortKey = sortKey;
+  command->sequence = renderCommandCount++;
+  return command;
+}
+
+// records all meshes of the model; the arguments work like the ones of DrawModelEx
+void RenderQueueAddModel(Model model, Matrix transform, Color tint)
+{
+  transform = MatrixMultiply(model.transform, transform);
+  for (int i = 0; i < model.meshCount; i++)
+  {
+    Material *material = &model.materials[model.meshMaterial[i]];
+    Color materialColor = material->maps[MATERIAL_MAP_DIFFUSE].color;
+    Color color = {
+      materialColor.r * tint.r / 255,
+      materialColor.g * tint.g / 255,
+      materialColor.b * tint.b / 255,
+      materialColor.a * tint.a / 255,
+    };
+    RenderCommand *command = RenderQueueAdd(RenderQueueGetSortKey(RENDER_LAYER_OPAQUE, material->shader.id,
+      material->maps[MATERIAL_MAP_DIFFUSE].texture.id, model.meshes[i].vaoId));
+    RenderCommand immediateCommand = {0};
+    if (!command)
+    {
+      // the queue is full; draw it right away instead of dropping it
+      command = &immediateCommand;
+    }
+    command->mesh = &model.meshes[i];
+    command->material = material;
+    command->color = color;
+    command->transform = transform;
+    if (command == &immediateCommand)
+    {
+      RenderQueueExecute(command);
+    }
+  }
+}
+
+// records a batch that draws itself with the given shader and texture
+void RenderQueueAddBatch(RenderBatchFunction drawBatch, uint8_t layer, unsigned int shaderId, unsigned int textureId)
+{
+  RenderCommand *command = RenderQueueAdd(RenderQueueGetSortKey(layer, shaderId, textureId, 0));
+  if (!command)
+  {
+    drawBatch();
+    return;
+  }
+  command->drawBatch = drawBatch;
+}
+
+static int RenderQueueCompareCommands(const void *a, const void *b)
+{
+  const RenderCommand *commandA = a;
+  const RenderCommand *commandB = b;
+  if (commandA->sortKey != commandB->sortKey)
+  {
+    return commandA->sortKey < commandB->sortKey ? -1 : 1;
+  }
+  // keep the recording order for equal keys
+  return commandA->sequence < commandB->sequence ? -1 : (commandA->sequence > commandB->sequence ? 1 : 0);
+}
+
+// counts how often layer, shader or texture change from one command to the next
+static int RenderQueueCountStateChanges()
+{
+  int stateChanges = 0;
+  uint64_t previousState = 0;
+  for (int i = 0; i < renderCommandCount; i++)
+  {
+    uint64_t state = renderCommands[i].sortKey >> 32;
+    if (i == 0 || state != previousState)
+    {
+      stateChanges++;
+    }
+    previousState = state;
+  }
+  return stateChanges;
+}
+
+// sorts and draws all recorded commands; must be called inside BeginMode3D
+void RenderQueueSubmit()
+{
+  renderQueueStats.commandCount = renderCommandCount;
+  renderQueueStats.unsortedStateChanges = RenderQueueCountStateChanges();
+  qsort(renderCommands, renderCommandCount, sizeof(RenderCommand), RenderQueueCompareCommands);
+  renderQueueStats.sortedStateChanges = RenderQueueCountStateChanges();
+
+  for (int i = 0; i < renderCommandCount; i++)
+  {
+    RenderQueueExecute(&renderCommands[i]);
+  }
+  renderCommandCount = 0;
+  renderQueueStats.drawCallCount = renderQueueDrawCallCount;
+  renderQueueStats.objectCount = renderQueueObjectCount;
+}
+
+RenderQueueStats RenderQueueGetStats()
+{
+  return renderQueueStats;
+}
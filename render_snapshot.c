@@ -0,0 +1,65 @@
+#include "td_main.h"
+
+// A triple buffer of render snapshots between the simulation thread, which
+// writes them, and the main thread, which draws them. Each side owns one
+// snapshot; the third one is the latest published snapshot. Publishing and
+// acquiring swap the own snapshot with that one, so neither side ever waits
+// for the other: the writer never overwrites what is being drawn, and the
+// reader always gets the newest complete snapshot. If the simulation runs
+// faster than the frame rate, the snapshots in between are simply dropped.
+
+// set on the published index until the reader has taken it
+#define RENDER_SNAPSHOT_FRESH 4
+
+static RenderSnapshot *renderSnapshots[3] = {0};
+static int renderSnapshotWriteIndex = 0;
+static int renderSnapshotReadIndex = 1;
+// the only index both threads touch; always accessed atomically
+static int renderSnapshotPublishedIndex = 2;
+static uint32_t renderSnapshotSequence = 0;
+
+void RenderSnapshotInit()
+{
+  for (int i = 0; i < 3; i++)
+  {
+    renderSnapshots[i] = MemAlloc(sizeof(RenderSnapshot));
+  }
+  renderSnapshotWriteIndex = 0;
+  renderSnapshotReadIndex = 1;
+  renderSnapshotPublishedIndex = 2;
+  renderSnapshotSequence = 0;
+}
+
+void RenderSnapshotUnload()
+{
+  for (int i = 0; i < 3; i++)
+  {
+    MemFree(renderSnapshots[i]);
+    renderSnapshots[i] = 0;
+  }
+}
+
+// the snapshot to fill for the next RenderSnapshotPublish; writer side only
+RenderSnapshot *RenderSnapshotBeginWrite()
+{
+  return renderSnapshots[renderSnapshotWriteIndex];
+}
+
+void RenderSnapshotPublish()
+{
+  renderSnapshots[renderSnapshotWriteIndex]->sequence = ++renderSnapshotSequence;
+  int previous = __atomic_exchange_n(&renderSnapshotPublishedIndex, renderSnapshotWriteIndex | RENDER_SNAPSHOT_FRESH,
+    __ATOMIC_ACQ_REL);
+  renderSnapshotWriteIndex = previous & ~RENDER_SNAPSHOT_FRESH;
+}
+
+// the newest published snapshot; it stays valid until the next call. Reader side only.
+const RenderSnapshot *RenderSnapshotAcquire()
+{
+  if (__atomic_load_n(&renderSnapshotPublishedIndex, __ATOMIC_ACQUIRE) & RENDER_SNAPSHOT_FRESH)
+  {
+    int previous = __atomic_exchange_n(&renderSnapshotPublishedIndex, renderSnapshotReadIndex, __ATOMIC_ACQ_REL);
+    renderSnapshotReadIndex = previous & ~RENDER_SNAPSHOT_FRESH;
+  }
+  return renderSnapshots[renderSnapshotReadIndex];
+}
\ No newline at end of file
@@ -0,0 +1,442 @@
+#include "td_main.h"
+#include <stdio.h>
+#include <string.h>
+
+// Records a match as its seed and the player input of every tick. The
+// simulation is deterministic, so that is all it takes to play the match
+// again. To jump around in a long replay without simulating it from the start,
+// the full world state is stored as a keyframe every keyframeInterval ticks;
+// seeking loads the keyframe before the target tick and simulates less than
+// one interval from there.
+//
+// The file is a ReplayHeader followed by records:
+//   0                                      end
+//   1 <tick delta> <7 bytes action>        an action applied on that tick
+//   2 <u32 tick> <size> <world state>      a keyframe taken before that tick
+//   3 <u32 hash>                           the end of a tick, with the low bits
+//                                          of WorldHashState after it
+// and a table of (u32 tick, u32 file offset) pairs for the keyframes at
+// indexOffset. Tick deltas and sizes are LEB128 varints; the tick delta is
+// counted from the tick of the previous record. The header is written again
+// with the final counts when the recorder is closed.
+//
+// The hashes let a replay check itself: a build whose simulation takes other
+// decisions than the recording one (e.g. an optimized or multithreaded path
+// that isn't bit exact) is caught in the first tick that differs.
+
+#define REPLAY_RECORD_END 0
+#define REPLAY_RECORD_ACTION 1
+#define REPLAY_RECORD_KEYFRAME 2
+#define REPLAY_RECORD_TICK_END 3
+
+typedef struct ReplayKeyframe
+{
+  uint32_t tick;
+  uint32_t offset;
+} ReplayKeyframe;
+
+struct ReplayRecorder
+{
+  FILE *file;
+  ReplayHeader header;
+  uint32_t lastRecordTick;
+  ReplayKeyframe *keyframes;
+  int keyframeCapacity;
+  // reused for every keyframe
+  ByteBuffer state;
+};
+
+struct ReplayPlayer
+{
+  uint8_t *data;
+  uint32_t size;
+  ReplayHeader header;
+  const ReplayKeyframe *keyframes;
+  // the next record to read and the tick its delta counts from
+  uint32_t readOffset;
+  uint32_t lastRecordTick;
+  // the tick the read position belongs to; UINT32_MAX until the first seek
+  uint32_t tick;
+  // the first tick whose hash didn't match, UINT32_MAX if none did
+  uint32_t desyncTick;
+};
+
+//# Recorder
+
+static void ReplayWriteVarint(FILE *file, uint32_t value)
+{
+  while (value >= 0x80)
+  {
+    fputc((value & 0x7F) | 0x80, file);
+    value >>= 7;
+  }
+  fputc(value, file);
+}
+
+static void ReplayRecorderWriteKeyframe(ReplayRecorder *recorder, World *world)
+{
+  if (recorder->header.keyframeCount == recorder->keyframeCapacity)
+  {
+    int capacity = recorder->keyframeCapacity > 0 ? recorder->keyframeCapacity * 2 : 64;
+    ReplayKeyframe *keyframes = MemRealloc(recorder->keyframes, capacity * sizeof(ReplayKeyframe));
+    if (!keyframes)
+    {
+      return;
+    }
+    recorder->keyframes = keyframes;
+    recorder->keyframeCapacity = capacity;
+  }
+
+  recorder->state.size = 0;
+  WorldWriteState(world, &recorder->state);
+  if (recorder->state.isOverflow)
+  {
+    TraceLog(LOG_WARNING, "REPLAY: out of memory, skipping the keyframe of tick %u", world->tick);
+    recorder->state.isOverflow = 0;
+    return;
+  }
+  recorder->keyframes[recorder->header.keyframeCount++] = (ReplayKeyframe){
+    .tick = world->tick,
+    .offset = (uint32_t)ftell(recorder->file),
+  };
+  fputc(REPLAY_RECORD_KEYFRAME, recorder->file);
+  fwrite(&world->tick, sizeof(world->tick), 1, recorder->file);
+  ReplayWriteVarint(recorder->file, recorder->state.size);
+  fwrite(recorder->state.data, 1, recorder->state.size, recorder->file);
+  recorder->lastRecordTick = world->tick;
+}
+
+// starts recording the world from its current tick on; WorldStep feeds the
+// recorder until ReplayRecorderClose is called
+ReplayRecorder *ReplayRecorderOpen(const char *filename, World *world, float deltaTime, int keyframeInterval)
+{
+  FILE *file = fopen(filename, "wb");
+  if (!file)
+  {
+    TraceLog(LOG_WARNING, "REPLAY: could not open %s for writing", filename);
+    return 0;
+  }
+  ReplayRecorder *recorder = MemAlloc(sizeof(ReplayRecorder));
+  recorder->file = file;
+  recorder->header = (ReplayHeader){
+    .magic = REPLAY_MAGIC,
+    .version = REPLAY_VERSION,
+    .headerSize = sizeof(ReplayHeader),
+    .seed = world->seed,
+    .deltaTime = deltaTime,
+    .keyframeInterval = keyframeInterval > 0 ? keyframeInterval : REPLAY_DEFAULT_KEYFRAME_INTERVAL,
+    .startTick = world->tick,
+  };
+  // the header is written again with the final counts on close
+  fwrite(&recorder->header, sizeof(ReplayHeader), 1, file);
+  ReplayRecorderWriteKeyframe(recorder, world);
+  world->replayRecorder = recorder;
+  return recorder;
+}
+
+void ReplayRecorderAddAction(World *world, LevelAction action)
+{
+  ReplayRecorder *recorder = world->replayRecorder;
+  fputc(REPLAY_RECORD_ACTION, recorder->file);
+  ReplayWriteVarint(recorder->file, world->tick - recorder->lastRecordTick);
+  uint8_t bytes[7] = {action.actionType, action.towerType, action.nextState};
+  memcpy(bytes + 3, &action.x, sizeof(int16_t));
+  memcpy(bytes + 5, &action.y, sizeof(int16_t));
+  fwrite(bytes, 1, sizeof(bytes), recorder->file);
+  recorder->lastRecordTick = world->tick;
+}
+
+// called by WorldStep after each tick
+void ReplayRecorderEndTick(World *world)
+{
+  ReplayRecorder *recorder = world->replayRecorder;
+  uint32_t hash = (uint32_t)world->stateHash;
+  fputc(REPLAY_RECORD_TICK_END, recorder->file);
+  fwrite(&hash, sizeof(hash), 1, recorder->file);
+  recorder->lastRecordTick = world->tick;
+  if ((world->tick - recorder->header.startTick) % recorder->header.keyframeInterval == 0)
+  {
+    ReplayRecorderWriteKeyframe(recorder, world);
+  }
+}
+
+void ReplayRecorderClose(World *world)
+{
+  ReplayRecorder *recorder = world->replayRecorder;
+  if (!recorder)
+  {
+    return;
+  }
+  world->replayRecorder = 0;
+
+  fputc(REPLAY_RECORD_END, recorder->file);
+  recorder->header.tickCount = world->tick - recorder->header.startTick;
+  recorder->header.indexOffset = (uint32_t)ftell(recorder->file);
+  fwrite(recorder->keyframes, sizeof(ReplayKeyframe), recorder->header.keyframeCount, recorder->file);
+  fseek(recorder->file, 0, SEEK_SET);
+  fwrite(&recorder->header, sizeof(ReplayHeader), 1, recorder->file);
+  if (ferror(recorder->file))
+  {
+    TraceLog(LOG_WARNING, "REPLAY: could not write the replay");
+  }
+  fclose(recorder->file);
+
+  ByteBufferFree(&recorder->state);
+  MemFree(recorder->keyframes);
+  MemFree(recorder);
+}
+
+//# Player
+
+// the whole file is loaded, the keyframes make up most of it anyway
+ReplayPlayer *ReplayPlayerOpen(const char *filename)
+{
+  FILE *file = fopen(filename, "rb");
+  if (!file)
+  {
+    TraceLog(LOG_WARNING, "REPLAY: could not open %s", filename);
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t *data = size > (long)sizeof(ReplayHeader) ? MemAlloc(size) : 0;
+  int isRead = data && fread(data, 1, size, file) == (size_t)size;
+  fclose(file);
+
+  ReplayHeader header = {0};
+  if (isRead)
+  {
+    memcpy(&header, data, sizeof(ReplayHeader));
+  }
+  if (!isRead || header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION ||
+    header.headerSize != sizeof(ReplayHeader) || header.keyframeCount == 0 || header.keyframeInterval == 0 ||
+    header.indexOffset > size || (size - header.indexOffset) / sizeof(ReplayKeyframe) < header.keyframeCount)
+  {
+    TraceLog(LOG_WARNING, "REPLAY: %s is not a replay, an unsupported version or was not closed", filename);
+    MemFree(data);
+    return 0;
+  }
+
+  ReplayPlayer *player = MemAlloc(sizeof(ReplayPlayer));
+  player->data = data;
+  player->size = size;
+  player->header = header;
+  // the index follows byte sized records and may not be aligned, so it gets copied
+  ReplayKeyframe *keyframes = MemAlloc(header.keyframeCount * sizeof(ReplayKeyframe));
+  memcpy(keyframes, data + header.indexOffset, header.keyframeCount * sizeof(ReplayKeyframe));
+  player->keyframes = keyframes;
+  // seeking searches the keyframes by tick, so they have to be in order
+  for (uint32_t i = 1; i < header.keyframeCount; i++)
+  {
+    if (keyframes[i].tick <= keyframes[i - 1].tick)
+    {
+      TraceLog(LOG_WARNING, "REPLAY: the keyframe index of %s is out of order", filename);
+      ReplayPlayerClose(player);
+      return 0;
+    }
+  }
+  player->tick = UINT32_MAX;
+  player->desyncTick = UINT32_MAX;
+  return player;
+}
+
+void ReplayPlayerClose(ReplayPlayer *player)
+{
+  if (!player)
+  {
+    return;
+  }
+  MemFree((void *)player->keyframes);
+  MemFree(player->data);
+  MemFree(player);
+}
+
+const ReplayHeader *ReplayPlayerGetHeader(ReplayPlayer *player)
+{
+  return &player->header;
+}
+
+static int ReplayReadVarint(ReplayPlayer *player, uint32_t *value)
+{
+  *value = 0;
+  for (int shift = 0; shift < 35 && player->readOffset < player->size; shift += 7)
+  {
+    uint8_t byte = player->data[player->readOffset++];
+    *value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// loads the keyframe with the given index into the world and continues reading after it
+static int ReplayPlayerLoadKeyframe(ReplayPlayer *player, World *world, int keyframeIndex)
+{
+  player->readOffset = player->keyframes[keyframeIndex].offset;
+  uint32_t tick, size;
+  if (player->readOffset + 5 > player->size || player->data[player->readOffset++] != REPLAY_RECORD_KEYFRAME)
+  {
+    return 0;
+  }
+  memcpy(&tick, player->data + player->readOffset, sizeof(tick));
+  player->readOffset += sizeof(tick);
+  if (!ReplayReadVarint(player, &size) || size > player->size - player->readOffset)
+  {
+    return 0;
+  }
+  ByteBuffer state = {.data = player->data + player->readOffset, .size = size, .capacity = size};
+  player->readOffset += size;
+  player->lastRecordTick = tick;
+  player->tick = tick;
+  return WorldReadState(world, &state) && world->tick == tick;
+}
+
+// runs the next tick of the replay on the world; returns 0 when the replay is
+// over or the world is not where the player left it (seek first then)
+int ReplayPlayerStep(ReplayPlayer *player, World *world)
+{
+  ReplayHeader *header = &player->header;
+  if (world->tick != player->tick || world->tick >= header->startTick + header->tickCount)
+  {
+    return 0;
+  }
+
+  LevelAction actions[REPLAY_MAX_TICK_ACTION_COUNT];
+  int actionCount = 0;
+  while (player->readOffset < player->size)
+  {
+    uint32_t recordOffset = player->readOffset;
+    uint8_t recordType = player->data[player->readOffset++];
+    if (recordType == REPLAY_RECORD_ACTION)
+    {
+      uint32_t delta;
+      if (!ReplayReadVarint(player, &delta) || player->readOffset + 7 > player->size)
+      {
+        return 0;
+      }
+      if (player->lastRecordTick + delta != world->tick)
+      {
+        // an action of a later tick; read it again next time
+        player->readOffset = recordOffset;
+        break;
+      }
+      const uint8_t *bytes = player->data + player->readOffset;
+      player->readOffset += 7;
+      player->lastRecordTick = world->tick;
+      LevelAction action = {.actionType = bytes[0], .towerType = bytes[1], .nextState = bytes[2]};
+      memcpy(&action.x, bytes + 3, sizeof(int16_t));
+      memcpy(&action.y, bytes + 5, sizeof(int16_t));
+      if (actionCount == REPLAY_MAX_TICK_ACTION_COUNT)
+      {
+        // dropping actions would desync everything after this tick
+        TraceLog(LOG_WARNING, "REPLAY: tick %u has more than %d actions", world->tick, REPLAY_MAX_TICK_ACTION_COUNT);
+        return 0;
+      }
+      actions[actionCount++] = action;
+    }
+    else if (recordType == REPLAY_RECORD_KEYFRAME)
+    {
+      uint32_t tick, size;
+      if (player->readOffset + sizeof(tick) > player->size)
+      {
+        return 0;
+      }
+      memcpy(&tick, player->data + player->readOffset, sizeof(tick));
+      if (tick != world->tick)
+      {
+        player->readOffset = recordOffset;
+        break;
+      }
+      // we are already in this state, so the keyframe is skipped
+      player->readOffset += sizeof(tick);
+      if (!ReplayReadVarint(player, &size) || size > player->size - player->readOffset)
+      {
+        return 0;
+      }
+      player->readOffset += size;
+      player->lastRecordTick = tick;
+    }
+    else
+    {
+      player->readOffset = recordOffset;
+      break;
+    }
+  }
+
+  WorldStep(world, header->deltaTime, actions, actionCount);
+  player->tick = world->tick;
+
+  uint32_t hash;
+  if (player->readOffset + 5 <= player->size && player->data[player->readOffset] == REPLAY_RECORD_TICK_END)
+  {
+    memcpy(&hash, player->data + player->readOffset + 1, sizeof(hash));
+    player->readOffset += 5;
+    player->lastRecordTick = world->tick;
+    if (hash != (uint32_t)world->stateHash && player->desyncTick == UINT32_MAX)
+    {
+      TraceLog(LOG_WARNING, "REPLAY: desync, the state after tick %u differs from the recording", world->tick - 1);
+      player->desyncTick = world->tick - 1;
+    }
+  }
+  return 1;
+}
+
+// returns 1 and the first tick that ended in another state than in the recording, if there was one
+int ReplayPlayerGetDesyncTick(ReplayPlayer *player, uint32_t *tick)
+{
+  *tick = player->desyncTick;
+  return player->desyncTick != UINT32_MAX;
+}
+
+// puts the world into the state it had before the given tick; the world must
+// have been created with the seed of the replay. Returns 0 if the tick is not
+// in the replay
+int ReplayPlayerSeek(ReplayPlayer *player, World *world, uint32_t tick)
+{
+  ReplayHeader *header = &player->header;
+  if (tick < header->startTick || tick > header->startTick + header->tickCount)
+  {
+    return 0;
+  }
+  // the last keyframe at or before the tick; the recorder may have skipped
+  // some, so their index doesn't follow from the interval
+  uint32_t low = 0, high = header->keyframeCount;
+  while (high - low > 1)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if (player->keyframes[middle].tick <= tick)
+    {
+      low = middle;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  uint32_t keyframeIndex = low;
+  if (player->keyframes[keyframeIndex].tick > tick)
+  {
+    return 0;
+  }
+  // when seeking a little forward, stepping on from where we are is shorter
+  int isAhead = world->tick == player->tick && world->tick <= tick && world->tick >= player->keyframes[keyframeIndex].tick;
+  if (!isAhead)
+  {
+    if (!ReplayPlayerLoadKeyframe(player, world, keyframeIndex))
+    {
+      TraceLog(LOG_WARNING, "REPLAY: the keyframe of tick %u is broken", player->keyframes[keyframeIndex].tick);
+      return 0;
+    }
+  }
+  while (world->tick < tick)
+  {
+    if (!ReplayPlayerStep(player, world))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
\ No newline at end of file
@@ -0,0 +1,365 @@
+#include "td_main.h"
+#include <string.h>
+
+// A rolling history of the last ticks of a world, for stepping backwards
+// while looking into balance problems. Every tick the packed world state
+// (see world_state.c) is stored, but only every keyframeInterval-th one in
+// full; the others are XORed with the state of the tick before and stored as
+// runs of zero bytes and literal bytes. From one tick to the next most fields
+// don't change at all, and the floats that do keep their sign and exponent
+// bytes, so the XOR is mostly zeros.
+//
+// The frames live in a byte ring of fixed size. When a new frame doesn't fit,
+// the oldest keyframe and the deltas that depend on it are dropped, so the
+// history covers as many seconds as the budget allows. Restoring a tick
+// decodes its keyframe and applies at most keyframeInterval - 1 deltas.
+//
+// A delta frame is: <varint state size> then (<varint zero run> <varint
+// literal count> <literal bytes>) pairs until the state size is covered.
+
+typedef struct RewindFrame
+{
+  uint32_t tick;
+  uint32_t offset;
+  uint32_t size;
+  uint8_t isKeyframe;
+} RewindFrame;
+
+struct RewindHistory
+{
+  uint8_t *data;
+  int capacity;
+  int writeOffset;
+  // ring of frames, oldest first
+  RewindFrame *frames;
+  int frameCapacity;
+  int frameStart;
+  int frameCount;
+  int keyframeInterval;
+  int framesSinceKeyframe;
+  // the packed state of this tick and the last one, and the encoded delta
+  ByteBuffer state;
+  ByteBuffer previousState;
+  ByteBuffer delta;
+};
+
+// the smallest average frame size the frame table is sized for
+#define REWIND_MIN_FRAME_SIZE 64
+
+RewindHistory *RewindHistoryCreate(int memoryBudget, int keyframeInterval)
+{
+  RewindHistory *history = MemAlloc(sizeof(RewindHistory));
+  if (!history)
+  {
+    return 0;
+  }
+  history->frameCapacity = memoryBudget / (REWIND_MIN_FRAME_SIZE + sizeof(RewindFrame));
+  history->frameCapacity = history->frameCapacity < 16 ? 16 : history->frameCapacity;
+  history->capacity = memoryBudget - history->frameCapacity * sizeof(RewindFrame);
+  history->frames = MemAlloc(history->frameCapacity * sizeof(RewindFrame));
+  history->data = history->capacity > 0 ? MemAlloc(history->capacity) : 0;
+  history->keyframeInterval = keyframeInterval > 0 ? keyframeInterval : REWIND_DEFAULT_KEYFRAME_INTERVAL;
+  if (!history->frames || !history->data)
+  {
+    RewindHistoryDestroy(history);
+    return 0;
+  }
+  return history;
+}
+
+void RewindHistoryDestroy(RewindHistory *history)
+{
+  if (!history)
+  {
+    return;
+  }
+  ByteBufferFree(&history->state);
+  ByteBufferFree(&history->previousState);
+  ByteBufferFree(&history->delta);
+  MemFree(history->frames);
+  MemFree(history->data);
+  MemFree(history);
+}
+
+static RewindFrame *RewindHistoryGetFrame(RewindHistory *history, int index)
+{
+  return &history->frames[(history->frameStart + index) % history->frameCapacity];
+}
+
+//# Delta coding
+
+static void RewindPutVarint(uint8_t **cursor, uint32_t value)
+{
+  while (value >= 0x80)
+  {
+    *(*cursor)++ = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  *(*cursor)++ = value;
+}
+
+static uint32_t RewindGetVarint(const uint8_t **cursor, const uint8_t *end)
+{
+  uint32_t value = 0;
+  for (int shift = 0; shift < 35 && *cursor < end; shift += 7)
+  {
+    uint8_t byte = *(*cursor)++;
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+    {
+      break;
+    }
+  }
+  return value;
+}
+
+// XORs the state with the previous one; the shorter one counts as padded with zeros
+static void RewindEncodeDelta(ByteBuffer *delta, const ByteBuffer *state, const ByteBuffer *previous)
+{
+  int size = state->size;
+  int sharedSize = previous->size < size ? previous->size : size;
+  const uint8_t *a = state->data;
+  const uint8_t *b = previous->data;
+  // every literal run but the last is followed by at least two zeros, so the
+  // two varints of a run never take more than the bytes it covers, plus a few
+  delta->size = 0;
+  uint8_t *start = ByteBufferReserve(delta, 16 + 2 * size);
+  if (!start)
+  {
+    return;
+  }
+  uint8_t *cursor = start;
+  RewindPutVarint(&cursor, size);
+  int i = 0;
+  while (i < size)
+  {
+    int zeroStart = i;
+    while (i < sharedSize && a[i] == b[i])
+    {
+      i++;
+    }
+    while (i >= sharedSize && i < size && a[i] == 0)
+    {
+      i++;
+    }
+    // a literal run ends at two zeros in a row, a single one is cheaper to keep
+    int literalStart = i;
+    while (i < size)
+    {
+      uint8_t next = i + 1 < size ? a[i + 1] ^ (i + 1 < sharedSize ? b[i + 1] : 0) : 1;
+      if ((a[i] ^ (i < sharedSize ? b[i] : 0)) == 0 && next == 0)
+      {
+        break;
+      }
+      i++;
+    }
+    RewindPutVarint(&cursor, literalStart - zeroStart);
+    RewindPutVarint(&cursor, i - literalStart);
+    for (int j = literalStart; j < i; j++)
+    {
+      *cursor++ = a[j] ^ (j < sharedSize ? b[j] : 0);
+    }
+  }
+  delta->size = cursor - start;
+}
+
+// applies a delta to the state of the tick before, in place
+static void RewindDecodeDelta(ByteBuffer *state, const uint8_t *delta, int deltaSize)
+{
+  const uint8_t *cursor = delta;
+  const uint8_t *end = delta + deltaSize;
+  int size = RewindGetVarint(&cursor, end);
+  if (size > state->size)
+  {
+    uint8_t *grown = ByteBufferReserve(state, size - state->size);
+    if (!grown)
+    {
+      return;
+    }
+    memset(grown, 0, size - state->size);
+  }
+  state->size = size;
+  int i = 0;
+  while (i < size && cursor < end)
+  {
+    i += RewindGetVarint(&cursor, end);
+    int literalCount = RewindGetVarint(&cursor, end);
+    if (literalCount > size - i || literalCount > end - cursor)
+    {
+      return;
+    }
+    for (int j = 0; j < literalCount; j++)
+    {
+      state->data[i + j] ^= cursor[j];
+    }
+    cursor += literalCount;
+    i += literalCount;
+  }
+}
+
+//# Frames
+
+// drops the oldest keyframe with its deltas; returns 0 if it's the only one
+static int RewindHistoryDropOldest(RewindHistory *history)
+{
+  int groupSize = 1;
+  while (groupSize < history->frameCount && !RewindHistoryGetFrame(history, groupSize)->isKeyframe)
+  {
+    groupSize++;
+  }
+  if (groupSize == history->frameCount)
+  {
+    return 0;
+  }
+  history->frameStart = (history->frameStart + groupSize) % history->frameCapacity;
+  history->frameCount -= groupSize;
+  return 1;
+}
+
+// finds room for a frame in the byte ring without dropping anything; returns -1 if there is none
+static int RewindHistoryFindRoom(RewindHistory *history, int size)
+{
+  if (history->frameCount == 0)
+  {
+    history->writeOffset = 0;
+    return size <= history->capacity ? 0 : -1;
+  }
+  if (history->frameCount == history->frameCapacity)
+  {
+    return -1;
+  }
+  int tail = RewindHistoryGetFrame(history, 0)->offset;
+  int isWrapped = RewindHistoryGetFrame(history, history->frameCount - 1)->offset < (uint32_t)tail;
+  if (!isWrapped)
+  {
+    if (history->writeOffset + size <= history->capacity)
+    {
+      return history->writeOffset;
+    }
+    return size <= tail ? 0 : -1;
+  }
+  return history->writeOffset + size <= tail ? history->writeOffset : -1;
+}
+
+// stores the state of the world after a tick; WorldStep calls this for the
+// world's rewindHistory
+void RewindHistoryRecord(RewindHistory *history, World *world)
+{
+  history->state.size = 0;
+  WorldWriteState(world, &history->state);
+  if (history->state.isOverflow)
+  {
+    history->state.isOverflow = 0;
+    return;
+  }
+
+  int isKeyframe = history->frameCount == 0 || history->framesSinceKeyframe + 1 >= history->keyframeInterval;
+  const ByteBuffer *payload = 0;
+  int offset = -1;
+  while (offset < 0)
+  {
+    if (isKeyframe)
+    {
+      payload = &history->state;
+    }
+    else
+    {
+      RewindEncodeDelta(&history->delta, &history->state, &history->previousState);
+      payload = &history->delta;
+    }
+    offset = RewindHistoryFindRoom(history, payload->size);
+    if (offset < 0 && !RewindHistoryDropOldest(history))
+    {
+      if (history->frameCount == 0)
+      {
+        TraceLog(LOG_WARNING, "REWIND: a state of %d bytes doesn't fit into the history", payload->size);
+        return;
+      }
+      // the delta would need its own keyframe to go; start over with a new keyframe
+      history->frameCount = 0;
+      isKeyframe = 1;
+    }
+  }
+
+  memcpy(history->data + offset, payload->data, payload->size);
+  *RewindHistoryGetFrame(history, history->frameCount++) = (RewindFrame){
+    .tick = world->tick,
+    .offset = offset,
+    .size = payload->size,
+    .isKeyframe = isKeyframe,
+  };
+  history->writeOffset = offset + payload->size;
+  history->framesSinceKeyframe = isKeyframe ? 0 : history->framesSinceKeyframe + 1;
+
+  ByteBuffer swap = history->previousState;
+  history->previousState = history->state;
+  history->state = swap;
+}
+
+// puts the world back into its state after the given tick and forgets the
+// ticks after it, so the world can go on from there; returns 0 if the tick is
+// not in the history
+int RewindHistoryRestore(RewindHistory *history, World *world, uint32_t tick)
+{
+  if (history->frameCount == 0)
+  {
+    return 0;
+  }
+  uint32_t oldestTick = RewindHistoryGetFrame(history, 0)->tick;
+  // the ticks of the frames are consecutive
+  uint32_t index = tick - oldestTick;
+  if (tick < oldestTick || index >= (uint32_t)history->frameCount)
+  {
+    return 0;
+  }
+  int keyframeIndex = index;
+  while (!RewindHistoryGetFrame(history, keyframeIndex)->isKeyframe)
+  {
+    keyframeIndex--;
+  }
+
+  ByteBuffer *state = &history->previousState;
+  RewindFrame *keyframe = RewindHistoryGetFrame(history, keyframeIndex);
+  state->size = 0;
+  ByteBufferWrite(state, history->data + keyframe->offset, keyframe->size);
+  for (int i = keyframeIndex + 1; i <= (int)index; i++)
+  {
+    RewindFrame *frame = RewindHistoryGetFrame(history, i);
+    RewindDecodeDelta(state, history->data + frame->offset, frame->size);
+  }
+  if (state->isOverflow)
+  {
+    state->isOverflow = 0;
+    history->frameCount = 0;
+    return 0;
+  }
+  state->readOffset = 0;
+  if (!WorldReadState(world, state))
+  {
+    history->frameCount = 0;
+    return 0;
+  }
+
+  RewindFrame *frame = RewindHistoryGetFrame(history, index);
+  history->frameCount = index + 1;
+  history->writeOffset = frame->offset + frame->size;
+  history->framesSinceKeyframe = index - keyframeIndex;
+  return 1;
+}
+
+void RewindHistoryGetStats(RewindHistory *history, RewindStats *stats)
+{
+  *stats = (RewindStats){.frameCount = history->frameCount, .memoryBudget = history->capacity +
+    history->frameCapacity * (int)sizeof(RewindFrame)};
+  for (int i = 0; i < history->frameCount; i++)
+  {
+    RewindFrame *frame = RewindHistoryGetFrame(history, i);
+    stats->keyframeCount += frame->isKeyframe;
+    stats->usedBytes += frame->size + sizeof(RewindFrame);
+  }
+  if (history->frameCount > 0)
+  {
+    stats->oldestTick = RewindHistoryGetFrame(history, 0)->tick;
+    stats->newestTick = RewindHistoryGetFrame(history, history->frameCount - 1)->tick;
+  }
+}
\ No newline at end of file
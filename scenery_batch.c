@@ -0,0 +1,189 @@
+#include "td_main.h"
+#include <raymath.h>
+
+// Static scenery (the ground tiles and the trees, rocks and grass around the
+// map) never moves, so instead of drawing every model on its own each frame,
+// the models are transformed once on the CPU and merged into a few big meshes,
+// one per texture and visibility chunk. Drawing the scenery is then a handful
+// of DrawMesh calls, and chunks outside the camera view are skipped entirely.
+static SceneryBatchMesh sceneryMeshes[SCENERY_BATCH_MAX_MESH_COUNT];
+static int sceneryMeshCount = 0;
+
+void SceneryBatchClear()
+{
+  for (int i = 0; i < sceneryMeshCount; i++)
+  {
+    SceneryBatchMesh *batch = &sceneryMeshes[i];
+    if (batch->isUploaded)
+    {
+      UnloadMesh(batch->mesh);
+    }
+    else
+    {
+      MemFree(batch->mesh.vertices);
+      MemFree(batch->mesh.texcoords);
+      MemFree(batch->mesh.normals);
+      MemFree(batch->mesh.colors);
+      MemFree(batch->mesh.indices);
+    }
+    // UnloadMaterial would also unload the texture, which belongs to the asset cache
+    MemFree(batch->material.maps);
+    sceneryMeshes[i] = (SceneryBatchMesh){0};
+  }
+  sceneryMeshCount = 0;
+}
+
+static SceneryBatchMesh *SceneryBatchGetMesh(Texture2D texture, int chunk, int vertexCount, int indexCount)
+{
+  // meshes use 16 bit indices, so a batch can't grow beyond 65535 vertices
+  SceneryBatchMesh *batch = 0;
+  for (int i = sceneryMeshCount - 1; i >= 0; i--)
+  {
+    if (sceneryMeshes[i].textureId == texture.id && sceneryMeshes[i].chunk == chunk &&
+      sceneryMeshes[i].mesh.vertexCount + vertexCount <= 0xffff)
+    {
+      batch = &sceneryMeshes[i];
+      break;
+    }
+  }
+  if (!batch)
+  {
+    if (sceneryMeshCount >= SCENERY_BATCH_MAX_MESH_COUNT || vertexCount > 0xffff)
+    {
+      TraceLog(LOG_WARNING, "SCENERY: can't batch a mesh with %d vertices", vertexCount);
+      return 0;
+    }
+    batch = &sceneryMeshes[sceneryMeshCount++];
+    *batch = (SceneryBatchMesh){0};
+    batch->textureId = texture.id;
+    batch->chunk = chunk;
+    batch->material = LoadMaterialDefault();
+    batch->material.maps[MATERIAL_MAP_DIFFUSE].texture = texture;
+  }
+
+  Mesh *mesh = &batch->mesh;
+  if (mesh->vertexCount + vertexCount > batch->vertexCapacity)
+  {
+    int capacity = batch->vertexCapacity ? batch->vertexCapacity : 1024;
+    while (capacity < mesh->vertexCount + vertexCount)
+    {
+      capacity *= 2;
+    }
+    mesh->vertices = MemRealloc(mesh->vertices, capacity * 3 * sizeof(float));
+    mesh->texcoords = MemRealloc(mesh->texcoords, capacity * 2 * sizeof(float));
+    mesh->normals = MemRealloc(mesh->normals, capacity * 3 * sizeof(float));
+    mesh->colors = MemRealloc(mesh->colors, capacity * 4 * sizeof(unsigned char));
+    batch->vertexCapacity = capacity;
+  }
+  if (mesh->triangleCount * 3 + indexCount > batch->indexCapacity)
+  {
+    int capacity = batch->indexCapacity ? batch->indexCapacity : 2048;
+    while (capacity < mesh->triangleCount * 3 + indexCount)
+    {
+      capacity *= 2;
+    }
+    mesh->indices = MemRealloc(mesh->indices, capacity * sizeof(unsigned short));
+    batch->indexCapacity = capacity;
+  }
+  return batch;
+}
+
+// appends the meshes of the model, transformed like DrawModelEx would, to the batch
+void SceneryBatchAddModel(Model model, Matrix transform)
+{
+  transform = MatrixMultiply(model.transform, transform);
+  // the normals are only rotated (the scenery has no non-uniform scaling)
+  Matrix normalTransform = transform;
+  normalTransform.m12 = normalTransform.m13 = normalTransform.m14 = 0.0f;
+  // the whole model goes into the chunk of its origin
+  int chunk = VisibilityGetChunk(transform.m12, transform.m14);
+
+  for (int i = 0; i < model.meshCount; i++)
+  {
+    Mesh *source = &model.meshes[i];
+    if (!source->vertices)
+    {
+      // the cpu data was freed after uploading; nothing we can merge
+      continue;
+    }
+    Material *material = &model.materials[model.meshMaterial[i]];
+    Color materialColor = material->maps[MATERIAL_MAP_DIFFUSE].color;
+    int indexCount = source->indices ? source->triangleCount * 3 : source->vertexCount;
+    SceneryBatchMesh *batch = SceneryBatchGetMesh(material->maps[MATERIAL_MAP_DIFFUSE].texture, chunk, source->vertexCount, indexCount);
+    if (!batch)
+    {
+      continue;
+    }
+    batch->sourceMeshCount++;
+
+    Mesh *mesh = &batch->mesh;
+    int baseVertex = mesh->vertexCount;
+    for (int v = 0; v < source->vertexCount; v++)
+    {
+      int index = baseVertex + v;
+      Vector3 position = {source->vertices[v * 3], source->vertices[v * 3 + 1], source->vertices[v * 3 + 2]};
+      position = Vector3Transform(position, transform);
+      mesh->vertices[index * 3] = position.x;
+      mesh->vertices[index * 3 + 1] = position.y;
+      mesh->vertices[index * 3 + 2] = position.z;
+
+      Vector3 normal = {0.0f, 1.0f, 0.0f};
+      if (source->normals)
+      {
+        normal = (Vector3){source->normals[v * 3], source->normals[v * 3 + 1], source->normals[v * 3 + 2]};
+        normal = Vector3Normalize(Vector3Transform(normal, normalTransform));
+      }
+      mesh->normals[index * 3] = normal.x;
+      mesh->normals[index * 3 + 1] = normal.y;
+      mesh->normals[index * 3 + 2] = normal.z;
+
+      mesh->texcoords[index * 2] = source->texcoords ? source->texcoords[v * 2] : 0.0f;
+      mesh->texcoords[index * 2 + 1] = source->texcoords ? source->texcoords[v * 2 + 1] : 0.0f;
+
+      // the material color is baked into the vertex colors, so all meshes
+      // with the same texture can share one material
+      Color color = WHITE;
+      if (source->colors)
+      {
+        color = (Color){source->colors[v * 4], source->colors[v * 4 + 1], source->colors[v * 4 + 2], source->colors[v * 4 + 3]};
+      }
+      mesh->colors[index * 4] = color.r * materialColor.r / 255;
+      mesh->colors[index * 4 + 1] = color.g * materialColor.g / 255;
+      mesh->colors[index * 4 + 2] = color.b * materialColor.b / 255;
+      mesh->colors[index * 4 + 3] = color.a * materialColor.a / 255;
+    }
+
+    unsigned short *indices = &mesh->indices[mesh->triangleCount * 3];
+    for (int n = 0; n < indexCount; n++)
+    {
+      indices[n] = baseVertex + (source->indices ? source->indices[n] : n);
+    }
+    mesh->vertexCount += source->vertexCount;
+    mesh->triangleCount += indexCount / 3;
+  }
+}
+
+void SceneryBatchUpload()
+{
+  for (int i = 0; i < sceneryMeshCount; i++)
+  {
+    SceneryBatchMesh *batch = &sceneryMeshes[i];
+    if (!batch->isUploaded)
+    {
+      UploadMesh(&batch->mesh, false);
+      batch->isUploaded = 1;
+    }
+  }
+}
+
+void SceneryBatchDraw()
+{
+  for (int i = 0; i < sceneryMeshCount; i++)
+  {
+    if (VisibilityIsChunkVisible(sceneryMeshes[i].chunk))
+    {
+      DrawMesh(sceneryMeshes[i].mesh, sceneryMeshes[i].material, MatrixIdentity());
+      RenderQueueCountDrawCalls(1, sceneryMeshes[i].sourceMeshCount);
+    }
+  }
+}
@@ -0,0 +1,122 @@
+#include "td_main.h"
+#include <raymath.h>
+#include <rlgl.h>
+
+// Camera facing sprites (the units) are collected during the frame and drawn
+// together in SpriteBatchDraw. The camera basis is the same for all of them,
+// so it is computed once in SpriteBatchBegin instead of once per billboard,
+// and the quads are emitted grouped by texture, so the whole batch needs
+// only one texture switch per texture.
+static SpriteBatchQuad spriteQuads[SPRITE_BATCH_MAX_COUNT];
+static int spriteQuadCount = 0;
+// the distinct textures of the batch, in the order they first appeared
+static unsigned int spriteTextureIds[SPRITE_BATCH_MAX_TEXTURE_COUNT];
+static int spriteTextureCount = 0;
+
+static Vector3 spriteBatchRight = {1, 0, 0};
+static Vector3 spriteBatchUp = {0, 1, 0};
+
+void SpriteBatchBegin(Camera3D camera)
+{
+  spriteQuadCount = 0;
+  spriteTextureCount = 0;
+
+  // the sprites face the camera: their up vector is perpendicular to the view
+  // direction and as close to the world up as possible
+  Vector3 forward = Vector3Subtract(camera.target, camera.position);
+  Vector3 up = {0, 1, 0};
+  Vector3 right = Vector3CrossProduct(forward, up);
+  spriteBatchUp = Vector3Normalize(Vector3CrossProduct(right, forward));
+  // the right vector is taken from the view matrix, like DrawBillboardPro does
+  Matrix view = MatrixLookAt(camera.position, camera.target, camera.up);
+  spriteBatchRight = (Vector3){view.m0, view.m4, view.m8};
+}
+
+// adds a camera facing quad; size, origin and a negative srcRect width (for
+// flipping) work the same as for DrawBillboardPro without rotation
+void SpriteBatchAdd(Texture2D texture, Rectangle srcRect, Vector3 position, Vector2 size, Vector2 origin, Color tint)
+{
+  int isNewTexture = 1;
+  for (int i = 0; i < spriteTextureCount; i++)
+  {
+    if (spriteTextureIds[i] == texture.id)
+    {
+      isNewTexture = 0;
+      break;
+    }
+  }
+  if (spriteQuadCount >= SPRITE_BATCH_MAX_COUNT || (isNewTexture && spriteTextureCount >= SPRITE_BATCH_MAX_TEXTURE_COUNT))
+  {
+    // the batch is full; draw what we have and keep going
+    SpriteBatchDraw();
+    isNewTexture = 1;
+  }
+  if (isNewTexture)
+  {
+    spriteTextureIds[spriteTextureCount++] = texture.id;
+  }
+
+  Vector3 right = Vector3Scale(spriteBatchRight, size.x);
+  Vector3 up = Vector3Scale(spriteBatchUp, size.y);
+  Vector3 bottomLeft = Vector3Subtract(position,
+    Vector3Add(Vector3Scale(spriteBatchRight, origin.x), Vector3Scale(spriteBatchUp, origin.y)));
+
+  SpriteBatchQuad *quad = &spriteQuads[spriteQuadCount++];
+  quad->texture = texture;
+  quad->tint = tint;
+  quad->points[0] = bottomLeft;
+  quad->points[1] = Vector3Add(bottomLeft, right);
+  quad->points[2] = Vector3Add(quad->points[1], up);
+  quad->points[3] = Vector3Add(bottomLeft, up);
+  quad->texcoords[0] = (Vector2){srcRect.x / texture.width, (srcRect.y + srcRect.height) / texture.height};
+  quad->texcoords[1] = (Vector2){(srcRect.x + srcRect.width) / texture.width, (srcRect.y + srcRect.height) / texture.height};
+  quad->texcoords[2] = (Vector2){(srcRect.x + srcRect.width) / texture.width, srcRect.y / texture.height};
+  quad->texcoords[3] = (Vector2){srcRect.x / texture.width, srcRect.y / texture.height};
+}
+
+static void SpriteBatchDrawTexture(unsigned int textureId)
+{
+  rlSetTexture(textureId);
+  int i = 0;
+  int quadCount = 0;
+  while (i < spriteQuadCount)
+  {
+    // make sure raylib's vertex buffer has room, then emit up to 1024 quads in one go
+    int end = i + 1024 < spriteQuadCount ? i + 1024 : spriteQuadCount;
+    rlCheckRenderBatchLimit((end - i) * 4);
+    rlBegin(RL_QUADS);
+    for (; i < end; i++)
+    {
+      SpriteBatchQuad *quad = &spriteQuads[i];
+      if (quad->texture.id != textureId)
+      {
+        continue;
+      }
+      quadCount++;
+      rlColor4ub(quad->tint.r, quad->tint.g, quad->tint.b, quad->tint.a);
+      for (int v = 0; v < 4; v++)
+      {
+        rlTexCoord2f(quad->texcoords[v].x, quad->texcoords[v].y);
+        rlVertex3f(quad->points[v].x, quad->points[v].y, quad->points[v].z);
+      }
+    }
+    rlEnd();
+  }
+  rlSetTexture(0);
+  // raylib draws the quads of one texture with a single draw call
+  RenderQueueCountDrawCalls(1, quadCount);
+}
+
+// draws all sprites added since SpriteBatchBegin; must be called inside BeginMode3D
+void SpriteBatchDraw()
+{
+  // there are only a few textures, so instead of sorting we go over the
+  // quads once per texture; the quads of one texture stay in the order they
+  // were added
+  for (int i = 0; i < spriteTextureCount; i++)
+  {
+    SpriteBatchDrawTexture(spriteTextureIds[i]);
+  }
+  spriteQuadCount = 0;
+  spriteTextureCount = 0;
+}
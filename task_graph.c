@@ -0,0 +1,169 @@
+#include "td_main.h"
+#include <stdio.h>
+
+// Runs a list of systems on the job system, at the same time where their
+// data allows it. Each task declares the world data it reads and writes; a
+// task waits for every earlier task in the list that writes something it
+// touches or touches something it writes. Everything else may overlap, so
+// the result is the same as running the tasks one after another in list
+// order, no matter how many threads there are.
+
+typedef struct TaskGraphExecution TaskGraphExecution;
+
+typedef struct TaskGraphJob
+{
+  TaskGraphExecution *execution;
+  int taskIndex;
+  // earlier tasks that haven't finished yet; the last one to finish submits this one
+  int waitCount;
+  // bit i is set if task i waits for this one
+  uint32_t dependents;
+  int threadIndex;
+  double startTime;
+  double endTime;
+} TaskGraphJob;
+
+struct TaskGraphExecution
+{
+  const Task *tasks;
+  int taskCount;
+  World *world;
+  int isTimed;
+  // tasks that haven't finished yet
+  int remainingCount;
+  TaskGraphJob jobs[TASK_GRAPH_MAX_TASKS];
+};
+
+static int TaskGraphIsConflict(const Task *a, const Task *b)
+{
+  return (a->writes & (b->reads | b->writes)) || (b->writes & a->reads);
+}
+
+static void TaskGraphRunJob(void *data)
+{
+  TaskGraphJob *job = data;
+  TaskGraphExecution *execution = job->execution;
+  const Task *task = &execution->tasks[job->taskIndex];
+  if (execution->isTimed)
+  {
+    job->threadIndex = JobSystemGetThreadIndex();
+    job->startTime = GetTime();
+  }
+  task->function(execution->world);
+  if (execution->isTimed)
+  {
+    job->endTime = GetTime();
+  }
+
+  for (int i = job->taskIndex + 1; i < execution->taskCount; i++)
+  {
+    TaskGraphJob *dependent = &execution->jobs[i];
+    if ((job->dependents & (1u << i)) && __atomic_sub_fetch(&dependent->waitCount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+      JobSystemSubmit(TaskGraphRunJob, dependent);
+    }
+  }
+  __atomic_sub_fetch(&execution->remainingCount, 1, __ATOMIC_RELEASE);
+}
+
+// runs the tasks on the world and returns when all of them are done; the calling
+// thread works on the tasks, too. The trace is optional.
+void TaskGraphRun(const Task *tasks, int taskCount, World *world, TaskTrace *trace)
+{
+  if (taskCount > TASK_GRAPH_MAX_TASKS)
+  {
+    TraceLog(LOG_ERROR, "TASKS: %d tasks given, but only up to %d are supported", taskCount, TASK_GRAPH_MAX_TASKS);
+    taskCount = TASK_GRAPH_MAX_TASKS;
+  }
+  TaskGraphExecution execution = {
+    .tasks = tasks,
+    .taskCount = taskCount,
+    .world = world,
+    .isTimed = trace != 0,
+    .remainingCount = taskCount,
+  };
+  // the dependents of a task are only submitted when it is done, so the
+  // tasks without dependencies are all that is needed to get going
+  uint32_t roots = 0;
+  for (int i = 0; i < taskCount; i++)
+  {
+    execution.jobs[i].execution = &execution;
+    execution.jobs[i].taskIndex = i;
+    for (int j = 0; j < i; j++)
+    {
+      if (TaskGraphIsConflict(&tasks[j], &tasks[i]))
+      {
+        execution.jobs[j].dependents |= 1u << i;
+        execution.jobs[i].waitCount++;
+      }
+    }
+    if (execution.jobs[i].waitCount == 0)
+    {
+      roots |= 1u << i;
+    }
+  }
+
+  double startTime = trace ? GetTime() : 0.0;
+  // the wait counts change as soon as the first task is running, so the roots
+  // were picked before
+  for (int i = 0; i < taskCount; i++)
+  {
+    if (roots & (1u << i))
+    {
+      JobSystemSubmit(TaskGraphRunJob, &execution.jobs[i]);
+    }
+  }
+  JobSystemWaitForCounter(&execution.remainingCount);
+  if (!trace)
+  {
+    return;
+  }
+
+  trace->runCount++;
+  trace->runTime += GetTime() - startTime;
+  for (int i = 0; i < taskCount; i++)
+  {
+    TaskGraphJob *job = &execution.jobs[i];
+    trace->taskTime += job->endTime - job->startTime;
+    if (trace->eventCount < TASK_TRACE_MAX_EVENTS)
+    {
+      trace->events[trace->eventCount++] = (TaskTraceEvent){
+        .name = tasks[i].name,
+        .threadIndex = job->threadIndex,
+        .startTime = job->startTime,
+        .endTime = job->endTime,
+      };
+    }
+  }
+}
+
+// writes the recorded events in the Chrome trace event format, which can be
+// viewed in chrome://tracing or ui.perfetto.dev; one row per thread
+int TaskTraceSave(TaskTrace *trace, const char *filename)
+{
+  FILE *file = fopen(filename, "w");
+  if (!file)
+  {
+    TraceLog(LOG_ERROR, "TASKS: could not write trace to %s", filename);
+    return 0;
+  }
+  double baseTime = trace->eventCount > 0 ? trace->events[0].startTime : 0.0;
+  for (int i = 1; i < trace->eventCount; i++)
+  {
+    if (trace->events[i].startTime < baseTime)
+    {
+      baseTime = trace->events[i].startTime;
+    }
+  }
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (int i = 0; i < trace->eventCount; i++)
+  {
+    TaskTraceEvent *event = &trace->events[i];
+    fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+      event->name, event->threadIndex, (event->startTime - baseTime) * 1e6,
+      (event->endTime - event->startTime) * 1e6, i + 1 < trace->eventCount ? "," : "");
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+  return 1;
+}
\ No newline at end of file
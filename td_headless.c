@@ -0,0 +1,559 @@
+#include "td_main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Runs the level simulation without a window, GPU or assets, as fast as the
+// CPU allows. The player input comes from a script of timed actions, so runs
+// are reproducible and can be used for benchmarks and regression checks:
+//
+//   tower_defense_headless [--ticks N] [--seed S] [--dt SECONDS]
+//     [--worlds N] [--threads N] [--trace FILE] [--record FILE]
+//     [--load FILE] [--save FILE] [--rewind MEGABYTES] [script]
+//   tower_defense_headless --play FILE [--seek TICK] [--threads N]
+//   tower_defense_headless --state-bench ENEMIES
+//
+// With --worlds, that many independent matches (with the seeds S, S + 1, ...)
+// are played at the same time, spread over the job system's threads; the
+// throughput is reported as the number of matches one core can keep running
+// in real time. --threads alone runs a single match with the systems of each
+// tick spread over the threads where the task graph allows it.
+//
+// --trace records the timings of the first world's systems, prints how many
+// of them ran at the same time on average and writes the first ticks to FILE
+// in the Chrome trace event format.
+//
+// --record writes the first world's match to a replay file (see replay.c).
+// --play runs a replay to its end and prints the same summary as the match
+// that was recorded; with --seek, it first jumps to that tick and reports how
+// long the jump took. The replay holds the state hash of every tick, so
+// playing it with other --threads than it was recorded with (or with another
+// build) checks that the results are bit exact and reports the first tick
+// that isn't.
+//
+// --load starts every world from a state saved with --save instead of a new
+// level; --save writes the first world when the run is over. --state-bench
+// fills a world with that many enemies and measures how big its saved state is
+// and how long saving and loading it take; the build needs a large enough
+// ENEMY_MAX_COUNT for that (e.g. make headless CFLAGS+=-DENEMY_MAX_COUNT=10000).
+//
+// --rewind keeps a rewind history of the first world in that much memory and
+// reports how many seconds of it fit and how long stepping back takes.
+//
+// Each script line is "<tick> <action> [arguments]" with the actions
+//   place <tower type> <x> <y>
+//   battle
+//   build
+//   reset
+// Lines starting with '#' are ignored. Without a script, a few towers are
+// placed and the waves are started one after another.
+
+#define HEADLESS_MAX_ACTION_COUNT 1024
+
+typedef struct HeadlessAction
+{
+  int tick;
+  LevelAction action;
+} HeadlessAction;
+
+// one match played by the headless runner
+typedef struct HeadlessMatch
+{
+  World *world;
+  int nextAction;
+  int scriptStartTick;
+  int peakEnemyCount;
+} HeadlessMatch;
+
+// the script and the run settings; only read while the matches are running
+static HeadlessAction headlessActions[HEADLESS_MAX_ACTION_COUNT];
+static int headlessActionCount = 0;
+static int headlessIsDefaultScript = 1;
+static int headlessTickCount = 60 * 60 * 5;
+static float headlessDeltaTime = 1.0f / 60.0f;
+
+static const char *headlessDefaultScript =
+  "0 place 2 1 1\n"
+  "0 place 2 -1 -1\n"
+  "0 place 5 0 2\n"
+  "1 battle\n";
+
+static int HeadlessParseAction(const char *line, HeadlessAction *action)
+{
+  char name[16];
+  int tick, towerType, x, y;
+  if (sscanf(line, "%d %15s", &tick, name) != 2)
+  {
+    return 0;
+  }
+  *action = (HeadlessAction){.tick = tick, .action.actionType = LEVEL_ACTION_SET_NEXT_STATE};
+  if (strcmp(name, "place") == 0)
+  {
+    if (sscanf(line, "%*d %*s %d %d %d", &towerType, &x, &y) != 3 ||
+      towerType <= TOWER_TYPE_NONE || towerType >= TOWER_TYPE_COUNT)
+    {
+      return 0;
+    }
+    action->action = (LevelAction){.actionType = LEVEL_ACTION_PLACE_TOWER, .towerType = towerType, .x = x, .y = y};
+  }
+  else if (strcmp(name, "battle") == 0) action->action.nextState = LEVEL_STATE_BATTLE;
+  else if (strcmp(name, "build") == 0) action->action.nextState = LEVEL_STATE_BUILDING;
+  else if (strcmp(name, "reset") == 0) action->action.nextState = LEVEL_STATE_RESET;
+  else return 0;
+  return 1;
+}
+
+// parses the script line by line; returns 0 if a line is malformed
+static int HeadlessLoadScript(const char *script)
+{
+  int lineNumber = 0;
+  while (*script)
+  {
+    const char *end = strchr(script, '\n');
+    size_t length = end ? (size_t)(end - script) : strlen(script);
+    char line[128];
+    if (length >= sizeof(line))
+    {
+      length = sizeof(line) - 1;
+    }
+    memcpy(line, script, length);
+    line[length] = 0;
+    script += end ? length + 1 : length;
+    lineNumber++;
+
+    const char *text = line + strspn(line, " \t\r");
+    if (*text == 0 || *text == '\r' || *text == '#')
+    {
+      continue;
+    }
+    if (headlessActionCount >= HEADLESS_MAX_ACTION_COUNT)
+    {
+      TraceLog(LOG_ERROR, "HEADLESS: too many actions, ignoring everything after line %d", lineNumber);
+      break;
+    }
+    if (!HeadlessParseAction(text, &headlessActions[headlessActionCount]))
+    {
+      TraceLog(LOG_ERROR, "HEADLESS: invalid action in line %d: %s", lineNumber, text);
+      return 0;
+    }
+    headlessActionCount++;
+  }
+  // sort by tick; insertion sort keeps the script order of actions on the same tick
+  for (int i = 1; i < headlessActionCount; i++)
+  {
+    HeadlessAction action = headlessActions[i];
+    int j = i - 1;
+    for (; j >= 0 && headlessActions[j].tick > action.tick; j--)
+    {
+      headlessActions[j + 1] = headlessActions[j];
+    }
+    headlessActions[j + 1] = action;
+  }
+  return 1;
+}
+
+static char *HeadlessReadFile(const char *filename)
+{
+  FILE *file = fopen(filename, "rb");
+  if (!file)
+  {
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *text = malloc(size + 1);
+  if (text)
+  {
+    size = fread(text, 1, size, file);
+    text[size] = 0;
+  }
+  fclose(file);
+  return text;
+}
+
+static void HeadlessMatchUpdatePeak(HeadlessMatch *match)
+{
+  World *world = match->world;
+  if (world->enemyCount > match->peakEnemyCount)
+  {
+    match->peakEnemyCount = world->enemyCount;
+  }
+}
+
+static void HeadlessMatchStep(HeadlessMatch *match, int tick)
+{
+  World *world = match->world;
+  Level *level = &world->level;
+  LevelAction actions[HEADLESS_MAX_ACTION_COUNT + 1];
+  int actionCount = 0;
+
+  // the waves are restarted whenever one is over, so a long run keeps the systems busy
+  if (headlessIsDefaultScript)
+  {
+    if (level->state == LEVEL_STATE_WON_WAVE || level->state == LEVEL_STATE_LOST_WAVE)
+    {
+      actions[actionCount++] = (LevelAction){.actionType = LEVEL_ACTION_SET_NEXT_STATE,
+        .nextState = HasLevelNextWave(level) ? LEVEL_STATE_BATTLE : LEVEL_STATE_RESET};
+    }
+    else if (level->state == LEVEL_STATE_BUILDING && match->nextAction == headlessActionCount)
+    {
+      // after a reset: run the script again to place the towers
+      match->nextAction = 0;
+      match->scriptStartTick = tick;
+    }
+  }
+  while (match->nextAction < headlessActionCount &&
+    match->scriptStartTick + headlessActions[match->nextAction].tick <= tick)
+  {
+    actions[actionCount++] = headlessActions[match->nextAction++].action;
+  }
+
+  int failedCount = WorldStep(world, headlessDeltaTime, actions, actionCount);
+  if (failedCount > 0)
+  {
+    TraceLog(LOG_WARNING, "HEADLESS: tick %d: %d of %d actions could not be applied", tick, failedCount, actionCount);
+  }
+  HeadlessMatchUpdatePeak(match);
+}
+
+// job that plays a whole match; the matches share nothing but the read only script
+static void HeadlessMatchJob(void *data)
+{
+  HeadlessMatch *match = data;
+  for (int tick = 0; tick < headlessTickCount; tick++)
+  {
+    HeadlessMatchStep(match, tick);
+  }
+}
+
+static void HeadlessPrintMatch(int index, HeadlessMatch *match)
+{
+  World *world = match->world;
+  printf("world %d: state: %d, wave: %d, gold: %d, towers: %d, enemies: %d (peak %d), hash: %016" PRIx64 "\n", index,
+    world->level.state, world->level.currentWave, world->level.playerGold, world->towerCount, world->enemyCount,
+    match->peakEnemyCount, world->stateHash);
+}
+
+// spawns the enemies all over the map and measures saving and loading the world
+static int HeadlessStateBench(int enemyCount, int seed)
+{
+  World *world = WorldCreate(seed);
+  World *loadedWorld = WorldCreate(seed);
+  LevelActionPlaceTower(world, TOWER_TYPE_ARCHER, 1, 1);
+  LevelActionPlaceTower(world, TOWER_TYPE_ARCHER, -1, -1);
+  LevelActionPlaceTower(world, TOWER_TYPE_WALL, 0, 2);
+  LevelActionSetNextState(world, LEVEL_STATE_BATTLE);
+  uint32_t random = 12345;
+  for (int i = 0; i < enemyCount; i++)
+  {
+    random = random * 1664525u + 1013904223u;
+    int16_t x = (int16_t)((random >> 16) % 19) - 9;
+    int16_t y = (int16_t)((random >> 8) % 4) + 5;
+    if (!EnemyTryAdd(world, ENEMY_TYPE_MINION, x, y))
+    {
+      TraceLog(LOG_ERROR, "HEADLESS: only %d enemies fit, build with a larger ENEMY_MAX_COUNT", i);
+      return 1;
+    }
+  }
+  // a few ticks to get them moving and pushing each other
+  for (int i = 0; i < 10; i++)
+  {
+    WorldStep(world, headlessDeltaTime, 0, 0);
+  }
+
+  int iterationCount = 100;
+  ByteBuffer buffer = {0};
+  double startTime = GetTime();
+  for (int i = 0; i < iterationCount; i++)
+  {
+    buffer.size = 0;
+    WorldWriteState(world, &buffer);
+  }
+  double saveTime = (GetTime() - startTime) / iterationCount;
+  startTime = GetTime();
+  int isLoaded = 1;
+  for (int i = 0; i < iterationCount; i++)
+  {
+    buffer.readOffset = 0;
+    isLoaded = isLoaded && WorldReadState(loadedWorld, &buffer);
+  }
+  double loadTime = (GetTime() - startTime) / iterationCount;
+  startTime = GetTime();
+  uint64_t hash = 0;
+  for (int i = 0; i < iterationCount; i++)
+  {
+    hash ^= WorldHashState(world);
+  }
+  double hashTime = (GetTime() - startTime) / iterationCount;
+
+  // the loaded world must write exactly the same state
+  ByteBuffer check = {0};
+  WorldWriteState(loadedWorld, &check);
+  int isExact = isLoaded && check.size == buffer.size && memcmp(check.data, buffer.data, buffer.size) == 0;
+
+  int liveCount = EnemyCount(world);
+  printf("state: %d enemies (%d alive), %d towers, %d projectiles\n", world->enemyCount, liveCount, world->towerCount,
+    world->projectileCount);
+  printf("size: %d bytes, %.1f bytes per enemy (%zu bytes per Enemy struct)\n", buffer.size,
+    liveCount > 0 ? (double)buffer.size / liveCount : 0.0, sizeof(Enemy));
+  printf("save: %.3f ms, load: %.3f ms (including the flow field), exact: %s\n", saveTime * 1000.0,
+    loadTime * 1000.0, isExact ? "yes" : "NO");
+  printf("hash: %.3f ms, same after loading: %s\n", hashTime * 1000.0,
+    loadedWorld->stateHash == WorldHashState(world) ? "yes" : "NO");
+
+  ByteBufferFree(&buffer);
+  ByteBufferFree(&check);
+  WorldDestroy(world);
+  WorldDestroy(loadedWorld);
+  return isExact ? 0 : 1;
+}
+
+// the restores go into a scratch world with the same seed, so the match
+// itself stays at its last tick for the summary, the save and the replay
+static void HeadlessReportRewind(World *world, int seed)
+{
+  RewindHistory *history = world->rewindHistory;
+  RewindStats stats;
+  RewindHistoryGetStats(history, &stats);
+  float seconds = stats.frameCount * headlessDeltaTime;
+  printf("rewind: ticks %u to %u (%.1f s) in %d of %d bytes, %d keyframes, %.1f KB per second\n", stats.oldestTick,
+    stats.newestTick, seconds, stats.usedBytes, stats.memoryBudget, stats.keyframeCount,
+    seconds > 0.0f ? stats.usedBytes / 1024.0 / seconds : 0.0);
+  if (stats.frameCount < REWIND_DEFAULT_KEYFRAME_INTERVAL + 1)
+  {
+    return;
+  }
+
+  // one tick back is a keyframe and a few deltas; the tick before the second
+  // keyframe needs the most deltas
+  World *scratch = WorldCreate(seed);
+  double startTime = GetTime();
+  int isRestored = RewindHistoryRestore(history, scratch, stats.newestTick - 1);
+  double stepTime = GetTime() - startTime;
+  startTime = GetTime();
+  isRestored = isRestored && RewindHistoryRestore(history, scratch, stats.oldestTick + REWIND_DEFAULT_KEYFRAME_INTERVAL - 1);
+  double worstTime = GetTime() - startTime;
+  WorldDestroy(scratch);
+  printf("rewind: one tick back in %.3f ms, %d deltas back in %.3f ms%s\n", stepTime * 1000.0,
+    REWIND_DEFAULT_KEYFRAME_INTERVAL - 1, worstTime * 1000.0, isRestored ? "" : " (FAILED)");
+}
+
+// plays a replay to its end, optionally jumping to seekTick first
+static int HeadlessPlay(const char *filename, long seekTick)
+{
+  ReplayPlayer *player = ReplayPlayerOpen(filename);
+  if (!player)
+  {
+    return 1;
+  }
+  const ReplayHeader *header = ReplayPlayerGetHeader(player);
+  HeadlessMatch match = {.world = WorldCreate(header->seed)};
+  uint32_t endTick = header->startTick + header->tickCount;
+  printf("replay: seed %d, ticks %u to %u, %u keyframes every %u ticks\n", header->seed, header->startTick, endTick,
+    header->keyframeCount, header->keyframeInterval);
+
+  double startTime = GetTime();
+  if (!ReplayPlayerSeek(player, match.world, header->startTick))
+  {
+    TraceLog(LOG_ERROR, "HEADLESS: could not start the replay");
+    return 1;
+  }
+  if (seekTick >= 0)
+  {
+    if (!ReplayPlayerSeek(player, match.world, seekTick))
+    {
+      TraceLog(LOG_ERROR, "HEADLESS: tick %ld is not in the replay", seekTick);
+      return 1;
+    }
+    printf("seek: to tick %ld in %.3f ms\n", seekTick, (GetTime() - startTime) * 1000.0);
+  }
+  int tickCount = 0;
+  while (ReplayPlayerStep(player, match.world))
+  {
+    HeadlessMatchUpdatePeak(&match);
+    tickCount++;
+  }
+  double elapsed = GetTime() - startTime;
+  printf("played: %d ticks in %.3f s\n", tickCount, elapsed);
+  uint32_t desyncTick;
+  int isDesynced = ReplayPlayerGetDesyncTick(player, &desyncTick);
+  if (isDesynced)
+  {
+    printf("hash: DESYNC, tick %u ended in another state than in the recording\n", desyncTick);
+  }
+  else
+  {
+    printf("hash: all %d ticks match the recording\n", tickCount);
+  }
+  // after a seek, the peak only counts the ticks from there on
+  HeadlessPrintMatch(0, &match);
+  int isComplete = match.world->tick == endTick && !isDesynced;
+
+  WorldDestroy(match.world);
+  ReplayPlayerClose(player);
+  return isComplete ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+  int seed = 0;
+  int worldCount = 1;
+  int threadCount = -1;
+  const char *scriptFilename = 0;
+  const char *traceFilename = 0;
+  const char *recordFilename = 0;
+  const char *playFilename = 0;
+  const char *loadFilename = 0;
+  const char *saveFilename = 0;
+  int stateBenchEnemyCount = 0;
+  float rewindMegabytes = 0.0f;
+  long seekTick = -1;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) headlessTickCount = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc) headlessDeltaTime = atof(argv[++i]);
+    else if (strcmp(argv[i], "--worlds") == 0 && i + 1 < argc) worldCount = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threadCount = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) traceFilename = argv[++i];
+    else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) recordFilename = argv[++i];
+    else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) playFilename = argv[++i];
+    else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) seekTick = atol(argv[++i]);
+    else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) loadFilename = argv[++i];
+    else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) saveFilename = argv[++i];
+    else if (strcmp(argv[i], "--state-bench") == 0 && i + 1 < argc) stateBenchEnemyCount = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) rewindMegabytes = atof(argv[++i]);
+    else if (argv[i][0] != '-') scriptFilename = argv[i];
+    else
+    {
+      fprintf(stderr, "usage: %s [--ticks N] [--seed S] [--dt SECONDS] [--worlds N] [--threads N] [--trace FILE] "
+        "[--record FILE] [--load FILE] [--save FILE] [--rewind MEGABYTES] [script]\n       %s --play FILE [--seek TICK] [--threads N]\n"
+        "       %s --state-bench ENEMIES\n", argv[0], argv[0], argv[0]);
+      return 1;
+    }
+  }
+  if (playFilename)
+  {
+    if (threadCount >= 0)
+    {
+      JobSystemInit(threadCount);
+    }
+    int result = HeadlessPlay(playFilename, seekTick);
+    JobSystemShutdown();
+    return result;
+  }
+  if (stateBenchEnemyCount > 0)
+  {
+    return HeadlessStateBench(stateBenchEnemyCount, seed);
+  }
+  if (worldCount < 1)
+  {
+    worldCount = 1;
+  }
+
+  char *script = scriptFilename ? HeadlessReadFile(scriptFilename) : 0;
+  if (scriptFilename && !script)
+  {
+    TraceLog(LOG_ERROR, "HEADLESS: could not read %s", scriptFilename);
+    return 1;
+  }
+  int isScriptValid = HeadlessLoadScript(script ? script : headlessDefaultScript);
+  free(script);
+  if (!isScriptValid)
+  {
+    return 1;
+  }
+  headlessIsDefaultScript = scriptFilename == 0;
+
+  HeadlessMatch *matches = calloc(worldCount, sizeof(HeadlessMatch));
+  for (int i = 0; i < worldCount; i++)
+  {
+    matches[i].world = WorldCreate(seed + i);
+    if (!matches[i].world)
+    {
+      TraceLog(LOG_ERROR, "HEADLESS: out of memory after %d worlds", i);
+      return 1;
+    }
+    if (loadFilename && !WorldLoadFile(matches[i].world, loadFilename))
+    {
+      return 1;
+    }
+  }
+  TaskTrace *trace = traceFilename ? calloc(1, sizeof(TaskTrace)) : 0;
+  matches[0].world->updateTrace = trace;
+  if (recordFilename && !ReplayRecorderOpen(recordFilename, matches[0].world, headlessDeltaTime,
+    REPLAY_DEFAULT_KEYFRAME_INTERVAL))
+  {
+    return 1;
+  }
+  if (rewindMegabytes > 0.0f)
+  {
+    matches[0].world->rewindHistory = RewindHistoryCreate(rewindMegabytes * 1024 * 1024,
+      REWIND_DEFAULT_KEYFRAME_INTERVAL);
+    if (matches[0].world->rewindHistory)
+    {
+      RewindHistoryRecord(matches[0].world->rewindHistory, matches[0].world);
+    }
+  }
+
+  // the matches are spread over the worker threads, with the main thread
+  // helping while it waits for them; without workers everything runs on the
+  // main thread
+  if (worldCount > 1 || threadCount >= 0)
+  {
+    JobSystemInit(threadCount >= 0 ? threadCount : JobSystemGetDefaultThreadCount());
+  }
+  int coreCount = JobSystemGetThreadCount() + 1;
+  double startTime = GetTime();
+  for (int i = 0; i < worldCount; i++)
+  {
+    JobSystemSubmit(HeadlessMatchJob, &matches[i]);
+  }
+  JobSystemWait();
+  double elapsed = GetTime() - startTime;
+  JobSystemShutdown();
+
+  double tickRate = elapsed > 0.0 ? (double)headlessTickCount * worldCount / elapsed : 0.0;
+  printf("ticks: %d per world (%.1f s of game time)\n", headlessTickCount, headlessTickCount * headlessDeltaTime);
+  printf("elapsed: %.3f s, %.0f ticks per second\n", elapsed, tickRate);
+  // a match runs in real time at 1 / dt ticks per second
+  printf("worlds: %d on %d threads, %zu bytes each, %.1f matches per core in real time\n", worldCount, coreCount,
+    sizeof(World), tickRate * headlessDeltaTime / coreCount);
+  for (int i = 0; i < worldCount && i < 8; i++)
+  {
+    HeadlessPrintMatch(i, &matches[i]);
+  }
+  if (matches[0].world->rewindHistory)
+  {
+    HeadlessReportRewind(matches[0].world, seed);
+    RewindHistoryDestroy(matches[0].world->rewindHistory);
+  }
+  if (saveFilename && WorldSaveFile(matches[0].world, saveFilename))
+  {
+    printf("state: saved to %s\n", saveFilename);
+  }
+  if (recordFilename)
+  {
+    ReplayRecorderClose(matches[0].world);
+    printf("replay: written to %s\n", recordFilename);
+  }
+  if (trace)
+  {
+    printf("task graph: %.3f ms per tick in the systems, %.3f ms per tick from start to end, %.2f systems at once\n",
+      trace->taskTime * 1000.0 / trace->runCount, trace->runTime * 1000.0 / trace->runCount,
+      trace->runTime > 0.0 ? trace->taskTime / trace->runTime : 0.0);
+    if (TaskTraceSave(trace, traceFilename))
+    {
+      printf("trace: %d events written to %s\n", trace->eventCount, traceFilename);
+    }
+    free(trace);
+  }
+
+  for (int i = 0; i < worldCount; i++)
+  {
+    WorldDestroy(matches[i].world);
+  }
+  free(matches);
+  return 0;
+}
@@ -1,11 +1,22 @@
 #include "td_main.h"
 #include <raymath.h>
+#include <rlgl.h>
 #include <stdlib.h>
 #include <math.h>
 
+// the simulation runs on its own thread and hands render snapshots to the
+// main thread; the web build has no threads, so there it runs before drawing
+#if !defined(PLATFORM_WEB)
+#define GAME_USE_SIMULATION_THREAD
+#include <pthread.h>
+#endif
+
 //# Variables
 GUIState guiState = {0};
-GameTime gameTime = {0};
+
+// the match that is played; only the simulation touches it, the main thread
+// draws the render snapshots and sends the player input as level actions
+static World *gameWorld = 0;
 
 Model floorTileAModel = {0};
 Model floorTileBModel = {0};
@@ -16,120 +27,145 @@ Model grassPatchModel[1] = {0};
 
 Texture2D palette, spriteSheet;
 
-Level levels[] = {
-  [0] = {
-    .state = LEVEL_STATE_BUILDING,
-    .initialGold = 20,
-    .waves[0] = {
-      .enemyType = ENEMY_TYPE_MINION,
-      .wave = 0,
-      .count = 10,
-      .interval = 2.5f,
-      .delay = 1.0f,
-      .spawnPosition = {0, 6},
-    },
-    .waves[1] = {
-      .enemyType = ENEMY_TYPE_MINION,
-      .wave = 1,
-      .count = 20,
-      .interval = 1.5f,
-      .delay = 1.0f,
-      .spawnPosition = {0, 6},
-    },
-    .waves[2] = {
-      .enemyType = ENEMY_TYPE_MINION,
-      .wave = 2,
-      .count = 30,
-      .interval = 1.2f,
-      .delay = 1.0f,
-      .spawnPosition = {0, 6},
-    }
-  },
-};
-
-Level *currentLevel = levels;
-
 //# Game
 
-static Model LoadGLBModel(char *filename)
+void RequestGLBModel(char *filename, Model *model)
 {
-  Model model = LoadModel(TextFormat("data/%s.glb",filename));
-  if (model.materialCount > 1)
-  {
-    model.materials[1].maps[MATERIAL_MAP_DIFFUSE].texture = palette;
-  }
-  return model;
+  AssetCacheRequestModel(TextFormat("data/%s.glb",filename), model, &palette);
 }
 
+static double assetLoadStartTime = 0.0;
+
+// starts loading all assets in the background; UpdateLoadingAssets finishes them
 void LoadAssets()
 {
+  assetLoadStartTime = GetTime();
+  // all assets are looked up in the asset pack first (see 'make pack-assets');
+  // without a pack, and for files that changed since they were packed, the
+  // individual files in the data directory are loaded
+  AssetPackOpen(ASSET_PACK_PATH);
+
   // load a sprite sheet that contains all units
-  spriteSheet = LoadTexture("data/spritesheet.png");
-  SetTextureFilter(spriteSheet, TEXTURE_FILTER_BILINEAR);
+  AssetCacheRequestTexture("data/spritesheet.png", &spriteSheet, TEXTURE_FILTER_BILINEAR);
 
   // we'll use a palette texture to colorize the all buildings and environment art
-  palette = LoadTexture("data/palette.png");
   // The texture uses gradients on very small space, so we'll enable bilinear filtering
-  SetTextureFilter(palette, TEXTURE_FILTER_BILINEAR);
-
-  floorTileAModel = LoadGLBModel("floor-tile-a");
-  floorTileBModel = LoadGLBModel("floor-tile-b");
-  treeModel[0] = LoadGLBModel("leaftree-large-1-a");
-  treeModel[1] = LoadGLBModel("leaftree-large-1-b");
-  firTreeModel[0] = LoadGLBModel("firtree-1-a");
-  firTreeModel[1] = LoadGLBModel("firtree-1-b");
-  rockModels[0] = LoadGLBModel("rock-1");
-  rockModels[1] = LoadGLBModel("rock-2");
-  rockModels[2] = LoadGLBModel("rock-3");
-  rockModels[3] = LoadGLBModel("rock-4");
-  rockModels[4] = LoadGLBModel("rock-5");
-  grassPatchModel[0] = LoadGLBModel("grass-patch-1");
+  AssetCacheRequestTexture("data/palette.png", &palette, TEXTURE_FILTER_BILINEAR);
+
+  RequestGLBModel("floor-tile-a", &floorTileAModel);
+  RequestGLBModel("floor-tile-b", &floorTileBModel);
+  RequestGLBModel("leaftree-large-1-a", &treeModel[0]);
+  RequestGLBModel("leaftree-large-1-b", &treeModel[1]);
+  RequestGLBModel("firtree-1-a", &firTreeModel[0]);
+  RequestGLBModel("firtree-1-b", &firTreeModel[1]);
+  RequestGLBModel("rock-1", &rockModels[0]);
+  RequestGLBModel("rock-2", &rockModels[1]);
+  RequestGLBModel("rock-3", &rockModels[2]);
+  RequestGLBModel("rock-4", &rockModels[3]);
+  RequestGLBModel("rock-5", &rockModels[4]);
+  RequestGLBModel("grass-patch-1", &grassPatchModel[0]);
+
+  TowerLoadAssets();
+  CubeBatchInit();
 }
 
-void InitLevel(Level *level)
+// uploads the assets that have been decoded so far; returns the loading progress
+float UpdateLoadingAssets()
 {
-  level->seed = (int)(GetTime() * 100.0f);
-
-  TowerInit();
-  EnemyInit();
-  ProjectileInit();
-  ParticleInit();
-  TowerTryAdd(TOWER_TYPE_BASE, 0, 0);
+  // leave enough of the frame to draw the progress
+  float progress = AssetCacheUpdateRequests(1.0 / 60.0);
+  if (progress >= 1.0f && assetLoadStartTime > 0.0)
+  {
+    AssetLoadStats stats = AssetCacheGetStats();
+    TraceLog(LOG_INFO, "ASSETS: %s loader: %d file reads, %ld bytes read, %ld bytes copied, %.2f ms (%.2f ms total, %d worker threads)",
+      AssetPackIsOpen() ? "asset pack" : "file", stats.fileReads, stats.bytesRead, stats.bytesCopied, 
+      stats.loadTime * 1000.0, (GetTime() - assetLoadStartTime) * 1000.0, JobSystemGetThreadCount());
+    assetLoadStartTime = 0.0;
+  }
+  return progress;
+}
 
-  level->placementMode = 0;
-  level->state = LEVEL_STATE_BUILDING;
-  level->nextState = LEVEL_STATE_NONE;
-  level->playerGold = level->initialGold;
-  level->currentWave = 0;
+void DrawLoadingScreen(float progress)
+{
+  const int width = 400;
+  const int height = 20;
+  int x = (GetScreenWidth() - width) / 2;
+  int y = (GetScreenHeight() - height) / 2;
+  const char *text = "Loading";
+  int textWidth = MeasureText(text, 20);
+  DrawText(text, (GetScreenWidth() - textWidth) * 0.5f, y - 30, 20, WHITE);
+  DrawRectangle(x, y, width, height, BLACK);
+  DrawRectangle(x + 2, y + 2, (width - 4) * progress, height - 4, WHITE);
+}
 
-  Camera *camera = &level->camera;
-  camera->position = (Vector3){4.0f, 8.0f, 8.0f};
-  camera->target = (Vector3){0.0f, 0.0f, 0.0f};
-  camera->up = (Vector3){0.0f, 1.0f, 0.0f};
-  camera->fovy = 10.0f;
-  camera->projection = CAMERA_ORTHOGRAPHIC;
+void UnloadAssets()
+{
+  TowerUnloadAssets();
+  CubeBatchUnload();
+  SceneryBatchClear();
+  // the cache owns all GPU resources; unloading it frees everything at once
+  AssetCacheUnloadAll();
+  AssetPackClose();
 }
 
-void DrawLevelHud(Level *level)
+// the time scales the speed button cycles through; 0 runs the simulation as fast as it can
+static const int gameTimeScales[] = {1, 2, 4, 8, 16, 0};
+
+void DrawLevelHud(const RenderSnapshot *snapshot)
 {
-  const char *text = TextFormat("Gold: %d", level->playerGold);
+  const char *text = TextFormat("Gold: %d", snapshot->playerGold);
   Font font = GetFontDefault();
   DrawTextEx(font, text, (Vector2){GetScreenWidth() - 120, 10}, font.baseSize * 2.0f, 2.0f, BLACK);
   DrawTextEx(font, text, (Vector2){GetScreenWidth() - 122, 8}, font.baseSize * 2.0f, 2.0f, YELLOW);
+
+  int timeScale = GameGetTimeScale();
+  const char *speedText = timeScale > 0 ? TextFormat("Speed x%d", timeScale) : "Speed max";
+  if (Button(speedText, GetScreenWidth() - 130, 40, 120, 30, 0) || IsKeyPressed(KEY_F))
+  {
+    int count = sizeof(gameTimeScales) / sizeof(gameTimeScales[0]);
+    int index = 0;
+    while (index < count - 1 && gameTimeScales[index] != timeScale)
+    {
+      index++;
+    }
+    GameSetTimeScale(gameTimeScales[(index + 1) % count]);
+  }
+
+  // F3 shows what the render queue and the batches saved in the last frame
+  static int showRenderStats = 0;
+  if (IsKeyPressed(KEY_F3))
+  {
+    showRenderStats = !showRenderStats;
+  }
+  if (showRenderStats)
+  {
+    RenderQueueStats stats = RenderQueueGetStats();
+    const char *statsText = TextFormat("%d draw calls for %d objects", stats.drawCallCount, stats.objectCount);
+    DrawText(statsText, GetScreenWidth() - MeasureText(statsText, 10) - 10, 80, 10, WHITE);
+    statsText = TextFormat("%d state changes instead of %d", stats.sortedStateChanges, stats.unsortedStateChanges);
+    DrawText(statsText, GetScreenWidth() - MeasureText(statsText, 10) - 10, 92, 10, WHITE);
+  }
+}
+
+// drawn instead of the level while the simulation runs as fast as it can, so
+// the frames cost next to nothing and the time goes into the ticks
+void DrawLevelFastForward(const RenderSnapshot *snapshot)
+{
+  const char *text = TextFormat("Fast forward: %.0f s", snapshot->time);
+  int textWidth = MeasureText(text, 20);
+  DrawText(text, (GetScreenWidth() - textWidth) * 0.5f, GetScreenHeight() * 0.5f - 10, 20, WHITE);
+  DrawLevelHud(snapshot);
 }
 
-void DrawLevelReportLostWave(Level *level)
+void DrawLevelReportLostWave(const RenderSnapshot *snapshot)
 {
-  BeginMode3D(level->camera);
-  DrawLevelGround(level);
-  TowerDraw();
-  EnemyDraw();
-  ProjectileDraw();
-  ParticleDraw();
+  BeginMode3D(snapshot->camera);
+  DrawLevelScene(snapshot);
   guiState.isBlocked = 0;
   EndMode3D();
 
-  TowerDrawHealthBars(level->camera);
+  TowerDrawHealthBars(snapshot);
+  HealthBarBatchDraw(snapshot->camera);
 
   const char *text = "Wave lost";
   int textWidth = MeasureText(text, 20);
@@ -137,35 +173,19 @@ void DrawLevelReportLostWave(Level *level)
 
   if (Button("Reset level", 20, GetScreenHeight() - 40, 160, 30, 0))
   {
-    level->nextState = LEVEL_STATE_RESET;
+    GameQueueNextState(LEVEL_STATE_RESET);
   }
 }
 
-int HasLevelNextWave(Level *level)
+void DrawLevelReportWonWave(const RenderSnapshot *snapshot)
 {
-  for (int i = 0; i < 10; i++)
-  {
-    EnemyWave *wave = &level->waves[i];
-    if (wave->wave == level->currentWave)
-    {
-      return 1;
-    }
-  }
-  return 0;
-}
-
-void DrawLevelReportWonWave(Level *level)
-{
-  BeginMode3D(level->camera);
-  DrawLevelGround(level);
-  TowerDraw();
-  EnemyDraw();
-  ProjectileDraw();
-  ParticleDraw();
+  BeginMode3D(snapshot->camera);
+  DrawLevelScene(snapshot);
   guiState.isBlocked = 0;
   EndMode3D();
 
-  TowerDrawHealthBars(level->camera);
+  TowerDrawHealthBars(snapshot);
+  HealthBarBatchDraw(snapshot->camera);
 
   const char *text = "Wave won";
   int textWidth = MeasureText(text, 20);
@@ -174,34 +194,34 @@ void DrawLevelReportWonWave(Level *level)
 
   if (Button("Reset level", 20, GetScreenHeight() - 40, 160, 30, 0))
   {
-    level->nextState = LEVEL_STATE_RESET;
+    GameQueueNextState(LEVEL_STATE_RESET);
   }
 
-  if (HasLevelNextWave(level))
+  if (snapshot->hasNextWave)
   {
     if (Button("Prepare for next wave", GetScreenWidth() - 300, GetScreenHeight() - 40, 300, 30, 0))
     {
-      level->nextState = LEVEL_STATE_BUILDING;
+      GameQueueNextState(LEVEL_STATE_BUILDING);
     }
   }
   else {
     if (Button("Level won", GetScreenWidth() - 300, GetScreenHeight() - 40, 300, 30, 0))
     {
-      level->nextState = LEVEL_STATE_WON_LEVEL;
+      GameQueueNextState(LEVEL_STATE_WON_LEVEL);
     }
   }
 }
 
-void DrawBuildingBuildButton(Level *level, int x, int y, int width, int height, uint8_t towerType, const char *name)
+void DrawBuildingBuildButton(const RenderSnapshot *snapshot, int x, int y, int width, int height, uint8_t towerType, const char *name)
 {
   static ButtonState buttonStates[8] = {0};
   int cost = GetTowerCosts(towerType);
   const char *text = TextFormat("%s: %d", name, cost);
-  buttonStates[towerType].isSelected = level->placementMode == towerType;
-  buttonStates[towerType].isDisabled = level->playerGold < cost;
+  buttonStates[towerType].isSelected = guiState.placementMode == towerType;
+  buttonStates[towerType].isDisabled = snapshot->playerGold < cost;
   if (Button(text, x, y, width, height, &buttonStates[towerType]))
   {
-    level->placementMode = buttonStates[towerType].isSelected ? 0 : towerType;
+    guiState.placementMode = buttonStates[towerType].isSelected ? 0 : towerType;
   }
 }
 
@@ -211,20 +231,37 @@ float GetRandomFloat(float min, float max)
   return ((float)random / (float)0xfffffff) * (max - min) + min;
 }
 
-void DrawLevelGround(Level *level)
+// the scenery is generated from the level seed; it is only rebuilt when the seed changes
+static int levelGroundSeed = 0;
+static int levelGroundIsBaked = 0;
+
+// adds the model to the scenery batch the way DrawModelEx would draw it; it has
+// the same signature so the random rolls in its arguments happen in the same
+// order as they did when the scenery was drawn directly (the tint is always white)
+static void AddLevelGroundModelEx(Model model, Vector3 position, Vector3 rotationAxis, float rotationAngle, Vector3 scale, Color tint)
 {
-  // draw checkerboard ground pattern
+  Matrix matScale = MatrixScale(scale.x, scale.y, scale.z);
+  Matrix matRotation = MatrixRotate(rotationAxis, rotationAngle * DEG2RAD);
+  Matrix matTranslation = MatrixTranslate(position.x, position.y, position.z);
+  SceneryBatchAddModel(model, MatrixMultiply(MatrixMultiply(matScale, matRotation), matTranslation));
+}
+
+static void BakeLevelGround(int seed)
+{
+  SceneryBatchClear();
+
+  // checkerboard ground pattern
   for (int x = -5; x <= 5; x += 1)
   {
     for (int y = -5; y <= 5; y += 1)
     {
       Model *model = (x + y) % 2 == 0 ? &floorTileAModel : &floorTileBModel;
-      DrawModel(*model, (Vector3){x, 0.0f, y}, 1.0f, WHITE);
+      SceneryBatchAddModel(*model, MatrixTranslate(x, 0.0f, y));
     }
   }
 
   int oldSeed = GetRandomValue(0, 0xfffffff);
-  SetRandomSeed(level->seed);
+  SetRandomSeed(seed);
   // increase probability for trees via duplicated entries
   Model borderModels[64];
   int maxRockCount = GetRandomValue(2, 6);
@@ -236,7 +273,10 @@ void DrawLevelGround(Level *level)
   int modelCount = 0;
   for (int i = 0; i < maxRockCount && modelCount < 63; i++)
   {
-    borderModels[modelCount++] = rockModels[GetRandomValue(0, 5)];
+    // the roll has to stay 0..5 to keep the random sequence of existing seeds,
+    // but there are only 5 rock models
+    int rockIndex = GetRandomValue(0, 5);
+    borderModels[modelCount++] = rockModels[rockIndex < 5 ? rockIndex : 4];
   }
   for (int i = 0; i < maxLeafTreeCount && modelCount < 63; i++)
   {
@@ -251,7 +291,7 @@ void DrawLevelGround(Level *level)
     borderModels[modelCount++] = grassPatchModel[0];
   }
 
-  // draw some objects around the border of the map
+  // place some objects around the border of the map
   Vector3 up = {0, 1, 0};
   // a pseudo random number generator to get the same result every time
   const float wiggle = 0.75f;
@@ -261,53 +301,82 @@ void DrawLevelGround(Level *level)
     int layerPos = 6 + layer;
     for (int x = -6 + layer; x <= 6 + layer; x += 1)
     {
-      DrawModelEx(borderModels[GetRandomValue(0, modelCount - 1)], 
+      AddLevelGroundModelEx(borderModels[GetRandomValue(0, modelCount - 1)], 
         (Vector3){x + GetRandomFloat(0.0f, wiggle), 0.0f, -layerPos + GetRandomFloat(0.0f, wiggle)}, 
         up, GetRandomFloat(0.0f, 360), Vector3One(), WHITE);
-      DrawModelEx(borderModels[GetRandomValue(0, modelCount - 1)], 
+      AddLevelGroundModelEx(borderModels[GetRandomValue(0, modelCount - 1)], 
         (Vector3){x + GetRandomFloat(0.0f, wiggle), 0.0f, layerPos + GetRandomFloat(0.0f, wiggle)}, 
         up, GetRandomFloat(0.0f, 360), Vector3One(), WHITE);
     }
 
     for (int z = -5 + layer; z <= 5 + layer; z += 1)
     {
-      DrawModelEx(borderModels[GetRandomValue(0, modelCount - 1)], 
+      AddLevelGroundModelEx(borderModels[GetRandomValue(0, modelCount - 1)], 
         (Vector3){-layerPos + GetRandomFloat(0.0f, wiggle), 0.0f, z + GetRandomFloat(0.0f, wiggle)}, 
         up, GetRandomFloat(0.0f, 360), Vector3One(), WHITE);
-      DrawModelEx(borderModels[GetRandomValue(0, modelCount - 1)], 
+      AddLevelGroundModelEx(borderModels[GetRandomValue(0, modelCount - 1)], 
         (Vector3){layerPos + GetRandomFloat(0.0f, wiggle), 0.0f, z + GetRandomFloat(0.0f, wiggle)}, 
         up, GetRandomFloat(0.0f, 360), Vector3One(), WHITE);
     }
   }
 
   SetRandomSeed(oldSeed);
+  SceneryBatchUpload();
+}
+
+void DrawLevelGround(const RenderSnapshot *snapshot)
+{
+  if (!levelGroundIsBaked || levelGroundSeed != snapshot->levelSeed)
+  {
+    BakeLevelGround(snapshot->levelSeed);
+    levelGroundSeed = snapshot->levelSeed;
+    levelGroundIsBaked = 1;
+  }
+  RenderQueueAddBatch(SceneryBatchDraw, RENDER_LAYER_OPAQUE, rlGetShaderIdDefault(), palette.id);
+}
+
+// draws the ground and everything on it; must be called inside BeginMode3D
+void DrawLevelScene(const RenderSnapshot *snapshot)
+{
+  VisibilityUpdate();
+  SpriteBatchBegin(snapshot->camera);
+  RenderQueueBegin();
+  DrawLevelGround(snapshot);
+  TowerDraw(snapshot);
+  EnemyDraw(snapshot);
+  ProjectileDraw(snapshot);
+  ParticleDraw(snapshot);
+  // the batches are filled now; they are drawn in their place in the sorted queue
+  RenderQueueAddBatch(CubeBatchDraw, RENDER_LAYER_OPAQUE, CubeBatchGetShaderId(), rlGetTextureIdDefault());
+  RenderQueueAddBatch(SpriteBatchDraw, RENDER_LAYER_TRANSPARENT, rlGetShaderIdDefault(), spriteSheet.id);
+  RenderQueueSubmit();
 }
 
-void DrawLevelBuildingState(Level *level)
+void DrawLevelBuildingState(const RenderSnapshot *snapshot)
 {
-  BeginMode3D(level->camera);
-  DrawLevelGround(level);
-  TowerDraw();
-  EnemyDraw();
-  ProjectileDraw();
-  ParticleDraw();
+  BeginMode3D(snapshot->camera);
+  DrawLevelScene(snapshot);
 
-  Ray ray = GetScreenToWorldRay(GetMousePosition(), level->camera);
+  Ray ray = GetScreenToWorldRay(GetMousePosition(), snapshot->camera);
   float planeDistance = ray.position.y / -ray.direction.y;
   float planeX = ray.direction.x * planeDistance + ray.position.x;
   float planeY = ray.direction.z * planeDistance + ray.position.z;
   int16_t mapX = (int16_t)floorf(planeX + 0.5f);
   int16_t mapY = (int16_t)floorf(planeY + 0.5f);
-  if (level->placementMode && !guiState.isBlocked && mapX >= -5 && mapX <= 5 && mapY >= -5 && mapY <= 5)
+  if (guiState.placementMode && !guiState.isBlocked && mapX >= -5 && mapX <= 5 && mapY >= -5 && mapY <= 5)
   {
     DrawCubeWires((Vector3){mapX, 0.2f, mapY}, 1.0f, 0.4f, 1.0f, RED);
-    if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON))
+    // the placement happens on the simulation thread; the snapshot tells
+    // whether it is going to work, so the selection can be cleared right away
+    if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && GameCanPlaceTower(snapshot, guiState.placementMode, mapX, mapY))
     {
-      if (TowerTryAdd(level->placementMode, mapX, mapY))
-      {
-        level->playerGold -= GetTowerCosts(level->placementMode);
-        level->placementMode = TOWER_TYPE_NONE;
-      }
+      GameQueueAction((LevelAction){
+        .actionType = LEVEL_ACTION_PLACE_TOWER,
+        .towerType = guiState.placementMode,
+        .x = mapX,
+        .y = mapY,
+      });
+      guiState.placementMode = TOWER_TYPE_NONE;
     }
   }
 
@@ -315,26 +384,27 @@ void DrawLevelBuildingState(Level *level)
 
   EndMode3D();
 
-  TowerDrawHealthBars(level->camera);
+  TowerDrawHealthBars(snapshot);
+  HealthBarBatchDraw(snapshot->camera);
 
   static ButtonState buildWallButtonState = {0};
   static ButtonState buildGunButtonState = {0};
-  buildWallButtonState.isSelected = level->placementMode == TOWER_TYPE_WALL;
-  buildGunButtonState.isSelected = level->placementMode == TOWER_TYPE_ARCHER;
+  buildWallButtonState.isSelected = guiState.placementMode == TOWER_TYPE_WALL;
+  buildGunButtonState.isSelected = guiState.placementMode == TOWER_TYPE_ARCHER;
 
-  DrawBuildingBuildButton(level, 10, 10, 110, 30, TOWER_TYPE_WALL, "Wall");
-  DrawBuildingBuildButton(level, 10, 50, 110, 30, TOWER_TYPE_ARCHER, "Archer");
-  DrawBuildingBuildButton(level, 10, 90, 110, 30, TOWER_TYPE_BALLISTA, "Ballista");
-  DrawBuildingBuildButton(level, 10, 130, 110, 30, TOWER_TYPE_CATAPULT, "Catapult");
+  DrawBuildingBuildButton(snapshot, 10, 10, 110, 30, TOWER_TYPE_WALL, "Wall");
+  DrawBuildingBuildButton(snapshot, 10, 50, 110, 30, TOWER_TYPE_ARCHER, "Archer");
+  DrawBuildingBuildButton(snapshot, 10, 90, 110, 30, TOWER_TYPE_BALLISTA, "Ballista");
+  DrawBuildingBuildButton(snapshot, 10, 130, 110, 30, TOWER_TYPE_CATAPULT, "Catapult");
 
   if (Button("Reset level", 20, GetScreenHeight() - 40, 160, 30, 0))
   {
-    level->nextState = LEVEL_STATE_RESET;
+    GameQueueNextState(LEVEL_STATE_RESET);
   }
   
   if (Button("Begin waves", GetScreenWidth() - 160, GetScreenHeight() - 40, 160, 30, 0))
   {
-    level->nextState = LEVEL_STATE_BATTLE;
+    GameQueueNextState(LEVEL_STATE_BATTLE);
   }
 
   const char *text = "Building phase";
@@ -342,242 +412,337 @@ void DrawLevelBuildingState(Level *level)
   DrawText(text, (GetScreenWidth() - textWidth) * 0.5f, 20, 20, WHITE);
 }
 
-void InitBattleStateConditions(Level *level)
-{
-  level->state = LEVEL_STATE_BATTLE;
-  level->nextState = LEVEL_STATE_NONE;
-  level->waveEndTimer = 0.0f;
-  for (int i = 0; i < 10; i++)
-  {
-    EnemyWave *wave = &level->waves[i];
-    wave->spawned = 0;
-    wave->timeToSpawnNext = wave->delay;
-  }
-}
-
-void DrawLevelBattleState(Level *level)
+void DrawLevelBattleState(const RenderSnapshot *snapshot)
 {
-  BeginMode3D(level->camera);
-  DrawLevelGround(level);
-  TowerDraw();
-  EnemyDraw();
-  ProjectileDraw();
-  ParticleDraw();
+  BeginMode3D(snapshot->camera);
+  DrawLevelScene(snapshot);
   guiState.isBlocked = 0;
   EndMode3D();
 
-  EnemyDrawHealthbars(level->camera);
-  TowerDrawHealthBars(level->camera);
+  EnemyDrawHealthbars(snapshot);
+  TowerDrawHealthBars(snapshot);
+  HealthBarBatchDraw(snapshot->camera);
 
   if (Button("Reset level", 20, GetScreenHeight() - 40, 160, 30, 0))
   {
-    level->nextState = LEVEL_STATE_RESET;
+    GameQueueNextState(LEVEL_STATE_RESET);
   }
 
-  int maxCount = 0;
-  int remainingCount = 0;
-  for (int i = 0; i < 10; i++)
-  {
-    EnemyWave *wave = &level->waves[i];
-    if (wave->wave != level->currentWave)
-    {
-      continue;
-    }
-    maxCount += wave->count;
-    remainingCount += wave->count - wave->spawned;
-  }
-  int aliveCount = EnemyCount();
-  remainingCount += aliveCount;
+  int maxCount = snapshot->waveEnemyCount;
+  int remainingCount = snapshot->waveRemainingCount;
 
   const char *text = TextFormat("Battle phase: %03d%%", 100 - remainingCount * 100 / maxCount);
   int textWidth = MeasureText(text, 20);
   DrawText(text, (GetScreenWidth() - textWidth) * 0.5f, 20, 20, WHITE);
 }
 
-void DrawLevel(Level *level)
+void DrawLevel(const RenderSnapshot *snapshot)
 {
-  switch (level->state)
+  switch (snapshot->levelState)
   {
-    case LEVEL_STATE_BUILDING: DrawLevelBuildingState(level); break;
-    case LEVEL_STATE_BATTLE: DrawLevelBattleState(level); break;
-    case LEVEL_STATE_WON_WAVE: DrawLevelReportWonWave(level); break;
-    case LEVEL_STATE_LOST_WAVE: DrawLevelReportLostWave(level); break;
+    case LEVEL_STATE_BUILDING: DrawLevelBuildingState(snapshot); break;
+    case LEVEL_STATE_BATTLE: DrawLevelBattleState(snapshot); break;
+    case LEVEL_STATE_WON_WAVE: DrawLevelReportWonWave(snapshot); break;
+    case LEVEL_STATE_LOST_WAVE: DrawLevelReportLostWave(snapshot); break;
     default: break;
   }
 
-  DrawLevelHud(level);
+  DrawLevelHud(snapshot);
 }
 
-void UpdateLevel(Level *level)
+//# Immediate GUI functions
+
+int Button(const char *text, int x, int y, int width, int height, ButtonState *state)
 {
-  if (level->state == LEVEL_STATE_BATTLE)
+  Rectangle bounds = {x, y, width, height};
+  int isPressed = 0;
+  int isSelected = state && state->isSelected;
+  int isDisabled = state && state->isDisabled;
+  if (CheckCollisionPointRec(GetMousePosition(), bounds) && !guiState.isBlocked && !isDisabled)
   {
-    int activeWaves = 0;
-    for (int i = 0; i < 10; i++)
-    {
-      EnemyWave *wave = &level->waves[i];
-      if (wave->spawned >= wave->count || wave->wave != level->currentWave)
-      {
-        continue;
-      }
-      activeWaves++;
-      wave->timeToSpawnNext -= gameTime.deltaTime;
-      if (wave->timeToSpawnNext <= 0.0f)
-      {
-        Enemy *enemy = EnemyTryAdd(wave->enemyType, wave->spawnPosition.x, wave->spawnPosition.y);
-        if (enemy)
-        {
-          wave->timeToSpawnNext = wave->interval;
-          wave->spawned++;
-        }
-      }
-    }
-    if (GetTowerByType(TOWER_TYPE_BASE) == 0) {
-      level->waveEndTimer += gameTime.deltaTime;
-      if (level->waveEndTimer >= 2.0f)
-      {
-        level->nextState = LEVEL_STATE_LOST_WAVE;
-      }
-    }
-    else if (activeWaves == 0 && EnemyCount() == 0)
+    Color color = isSelected ? DARKGRAY : GRAY;
+    DrawRectangle(x, y, width, height, color);
+    if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON))
     {
-      level->waveEndTimer += gameTime.deltaTime;
-      if (level->waveEndTimer >= 2.0f)
-      {
-        level->nextState = LEVEL_STATE_WON_WAVE;
-      }
+      isPressed = 1;
     }
+    guiState.isBlocked = 1;
   }
+  else
+  {
+    Color color = isSelected ? WHITE : LIGHTGRAY;
+    DrawRectangle(x, y, width, height, color);
+  }
+  Font font = GetFontDefault();
+  Vector2 textSize = MeasureTextEx(font, text, font.baseSize * 2.0f, 1);
+  Color textColor = isDisabled ? GRAY : BLACK;
+  DrawTextEx(font, text, (Vector2){x + width / 2 - textSize.x / 2, y + height / 2 - textSize.y / 2}, font.baseSize * 2.0f, 1, textColor);
+  return isPressed;
+}
 
-  PathFindingMapUpdate();
-  EnemyUpdate();
-  TowerUpdate();
-  ProjectileUpdate();
-  ParticleUpdate();
-
-  if (level->nextState == LEVEL_STATE_RESET)
+//# Simulation
+
+// the simulation advances in fixed ticks, no matter how fast frames are drawn
+#define GAME_TICK_TIME (1.0 / 60.0)
+// after a stall only this many ticks are caught up, like the old 0.1 s cap on the frame time
+#define GAME_MAX_CATCH_UP_TICKS 6
+#define GAME_ACTION_QUEUE_CAPACITY 64
+// how long a fast forward step ticks before it publishes a snapshot
+#define GAME_FAST_FORWARD_STEP_TIME (1.0 / 30.0)
+
+// the player input on its way from the main thread to the simulation; a ring
+// buffer with the main thread as the only writer and the simulation as the only reader
+static LevelAction gameActionQueue[GAME_ACTION_QUEUE_CAPACITY];
+static uint32_t gameActionQueueHead = 0;
+static uint32_t gameActionQueueTail = 0;
+// the real time the simulation has caught up to
+static double gameSimulationTime = 0.0;
+// ticks to rewind, requested by the main thread; see GameQueueRewind
+static int gameRewindTickCount = 0;
+// ticks per GAME_TICK_TIME of real time, 0 for as many as possible
+static int gameTimeScale = 1;
+
+#ifdef GAME_USE_SIMULATION_THREAD
+static pthread_t gameSimulationThread;
+static int gameSimulationIsRunning = 0;
+#endif
+
+void GameQueueAction(LevelAction action)
+{
+  uint32_t head = gameActionQueueHead;
+  if (head - __atomic_load_n(&gameActionQueueTail, __ATOMIC_ACQUIRE) >= GAME_ACTION_QUEUE_CAPACITY)
   {
-    InitLevel(level);
+    TraceLog(LOG_WARNING, "GAME: too much input, dropping an action");
+    return;
   }
-  
-  if (level->nextState == LEVEL_STATE_BATTLE)
+  gameActionQueue[head % GAME_ACTION_QUEUE_CAPACITY] = action;
+  __atomic_store_n(&gameActionQueueHead, head + 1, __ATOMIC_RELEASE);
+}
+
+void GameQueueNextState(int nextState)
+{
+  GameQueueAction((LevelAction){.actionType = LEVEL_ACTION_SET_NEXT_STATE, .nextState = nextState});
+  if (nextState == LEVEL_STATE_RESET)
   {
-    InitBattleStateConditions(level);
+    guiState.placementMode = TOWER_TYPE_NONE;
   }
-  
-  if (level->nextState == LEVEL_STATE_WON_WAVE)
+}
+
+// steps the world back by the given number of ticks, as far as its rewind history reaches
+void GameQueueRewind(int tickCount)
+{
+  __atomic_fetch_add(&gameRewindTickCount, tickCount, __ATOMIC_RELAXED);
+}
+
+static void GameApplyRewind(World *world)
+{
+  int tickCount = __atomic_exchange_n(&gameRewindTickCount, 0, __ATOMIC_RELAXED);
+  if (tickCount <= 0 || !world->rewindHistory)
   {
-    level->currentWave++;
-    level->state = LEVEL_STATE_WON_WAVE;
+    return;
   }
-  
-  if (level->nextState == LEVEL_STATE_LOST_WAVE)
+  RewindStats stats;
+  RewindHistoryGetStats(world->rewindHistory, &stats);
+  uint32_t tick = world->tick - tickCount;
+  if (tick < stats.oldestTick || tick > world->tick)
   {
-    level->state = LEVEL_STATE_LOST_WAVE;
+    tick = stats.oldestTick;
   }
-
-  if (level->nextState == LEVEL_STATE_BUILDING)
+  if (world->replayRecorder)
   {
-    level->state = LEVEL_STATE_BUILDING;
+    // a replay can only go forward
+    TraceLog(LOG_WARNING, "GAME: rewinding, the recording stops here");
+    ReplayRecorderClose(world);
   }
-
-  if (level->nextState == LEVEL_STATE_WON_LEVEL)
+  if (!RewindHistoryRestore(world->rewindHistory, world, tick))
   {
-    // make something of this later
-    InitLevel(level);
+    TraceLog(LOG_WARNING, "GAME: could not rewind to tick %u", tick);
   }
+}
 
-  level->nextState = LEVEL_STATE_NONE;
+// the ticks stay the same at any time scale, only more of them run per
+// second, so a match plays out exactly like at 1x
+void GameSetTimeScale(int timeScale)
+{
+  __atomic_store_n(&gameTimeScale, timeScale, __ATOMIC_RELAXED);
 }
 
-float nextSpawnTime = 0.0f;
+int GameGetTimeScale()
+{
+  return __atomic_load_n(&gameTimeScale, __ATOMIC_RELAXED);
+}
 
-void ResetGame()
+// checks on the snapshot what LevelActionPlaceTower is going to check on the world
+int GameCanPlaceTower(const RenderSnapshot *snapshot, uint8_t towerType, int16_t x, int16_t y)
 {
-  InitLevel(currentLevel);
+  if (snapshot->levelState != LEVEL_STATE_BUILDING || snapshot->playerGold < GetTowerCosts(towerType))
+  {
+    return 0;
+  }
+  for (int i = 0; i < snapshot->towerCount; i++)
+  {
+    if (snapshot->towers[i].x == x && snapshot->towers[i].y == y)
+    {
+      return 0;
+    }
+  }
+  return 1;
 }
 
-void InitGame()
+void GameUpdate(World *world)
 {
-  TowerInit();
-  EnemyInit();
-  ProjectileInit();
-  ParticleInit();
-  PathfindingMapInit(20, 20, (Vector3){-10.0f, 0.0f, -10.0f}, 1.0f);
+  LevelAction actions[GAME_ACTION_QUEUE_CAPACITY];
+  int actionCount = 0;
+  uint32_t head = __atomic_load_n(&gameActionQueueHead, __ATOMIC_ACQUIRE);
+  for (uint32_t tail = gameActionQueueTail; tail != head; tail++)
+  {
+    actions[actionCount++] = gameActionQueue[tail % GAME_ACTION_QUEUE_CAPACITY];
+  }
+  __atomic_store_n(&gameActionQueueTail, head, __ATOMIC_RELEASE);
 
-  currentLevel = levels;
-  InitLevel(currentLevel);
+  WorldStep(world, GAME_TICK_TIME, actions, actionCount);
 }
 
-//# Immediate GUI functions
-
-void DrawHealthBar(Camera3D camera, Vector3 position, float healthRatio, Color barColor, float healthBarWidth)
+// runs the ticks that are due and publishes a snapshot of the result
+static void GameSimulationStep(World *world)
 {
-  const float healthBarHeight = 6.0f;
-  const float healthBarOffset = 15.0f;
-  const float inset = 2.0f;
-  const float innerWidth = healthBarWidth - inset * 2;
-  const float innerHeight = healthBarHeight - inset * 2;
+  if (__atomic_load_n(&gameRewindTickCount, __ATOMIC_RELAXED))
+  {
+    GameApplyRewind(world);
+    LevelWriteSnapshot(world, RenderSnapshotBeginWrite());
+    RenderSnapshotPublish();
+  }
+  double now = GetTime();
+  int timeScale = GameGetTimeScale();
+  if (timeScale <= 0)
+  {
+    // as fast as possible: tick until the time of a frame is used up, then show where we are
+    do
+    {
+      GameUpdate(world);
+    } while (GetTime() - now < GAME_FAST_FORWARD_STEP_TIME);
+    gameSimulationTime = GetTime();
+    LevelWriteSnapshot(world, RenderSnapshotBeginWrite());
+    RenderSnapshotPublish();
+    return;
+  }
 
-  Vector2 screenPos = GetWorldToScreen(position, camera);
-  float centerX = screenPos.x - healthBarWidth * 0.5f;
-  float topY = screenPos.y - healthBarOffset;
-  DrawRectangle(centerX, topY, healthBarWidth, healthBarHeight, BLACK);
-  float healthWidth = innerWidth * healthRatio;
-  DrawRectangle(centerX + inset, topY + inset, healthWidth, innerHeight, barColor);
+  double tickTime = GAME_TICK_TIME / timeScale;
+  int tickCount = (int)((now - gameSimulationTime) / tickTime);
+  if (tickCount > GAME_MAX_CATCH_UP_TICKS * timeScale)
+  {
+    tickCount = GAME_MAX_CATCH_UP_TICKS * timeScale;
+    gameSimulationTime = now - tickCount * tickTime;
+  }
+  if (tickCount <= 0)
+  {
+    return;
+  }
+  for (int i = 0; i < tickCount; i++)
+  {
+    GameUpdate(world);
+  }
+  gameSimulationTime += tickCount * tickTime;
+  LevelWriteSnapshot(world, RenderSnapshotBeginWrite());
+  RenderSnapshotPublish();
 }
 
-int Button(const char *text, int x, int y, int width, int height, ButtonState *state)
+#ifdef GAME_USE_SIMULATION_THREAD
+static void *GameSimulationThread(void *arg)
 {
-  Rectangle bounds = {x, y, width, height};
-  int isPressed = 0;
-  int isSelected = state && state->isSelected;
-  int isDisabled = state && state->isDisabled;
-  if (CheckCollisionPointRec(GetMousePosition(), bounds) && !guiState.isBlocked && !isDisabled)
+  World *world = arg;
+  while (__atomic_load_n(&gameSimulationIsRunning, __ATOMIC_ACQUIRE))
   {
-    Color color = isSelected ? DARKGRAY : GRAY;
-    DrawRectangle(x, y, width, height, color);
-    if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON))
+    GameSimulationStep(world);
+    int timeScale = GameGetTimeScale();
+    double waitTime = timeScale > 0 ? gameSimulationTime + GAME_TICK_TIME / timeScale - GetTime() : 0.0;
+    if (waitTime > 0.0)
     {
-      isPressed = 1;
+      WaitTime(waitTime);
     }
-    guiState.isBlocked = 1;
   }
-  else
+  return 0;
+}
+#endif
+
+void GameSimulationStart(World *world)
+{
+  gameSimulationTime = GetTime();
+  // the first snapshot, so there is something to draw before the first tick
+  LevelWriteSnapshot(world, RenderSnapshotBeginWrite());
+  RenderSnapshotPublish();
+#ifdef GAME_USE_SIMULATION_THREAD
+  gameSimulationIsRunning = 1;
+  if (pthread_create(&gameSimulationThread, 0, GameSimulationThread, world) != 0)
   {
-    Color color = isSelected ? WHITE : LIGHTGRAY;
-    DrawRectangle(x, y, width, height, color);
+    TraceLog(LOG_WARNING, "GAME: could not start the simulation thread, simulating on the main thread");
+    gameSimulationIsRunning = 0;
   }
-  Font font = GetFontDefault();
-  Vector2 textSize = MeasureTextEx(font, text, font.baseSize * 2.0f, 1);
-  Color textColor = isDisabled ? GRAY : BLACK;
-  DrawTextEx(font, text, (Vector2){x + width / 2 - textSize.x / 2, y + height / 2 - textSize.y / 2}, font.baseSize * 2.0f, 1, textColor);
-  return isPressed;
+#endif
 }
 
-//# Main game loop
-
-void GameUpdate()
+// called once per frame; without a simulation thread this is where the ticks run
+void GameSimulationUpdate(World *world)
 {
-  float dt = GetFrameTime();
-  // cap maximum delta time to 0.1 seconds to prevent large time steps
-  if (dt > 0.1f) dt = 0.1f;
-  gameTime.time += dt;
-  gameTime.deltaTime = dt;
+#ifdef GAME_USE_SIMULATION_THREAD
+  if (gameSimulationIsRunning)
+  {
+    return;
+  }
+#endif
+  GameSimulationStep(world);
+}
 
-  UpdateLevel(currentLevel);
+void GameSimulationStop()
+{
+#ifdef GAME_USE_SIMULATION_THREAD
+  if (gameSimulationIsRunning)
+  {
+    __atomic_store_n(&gameSimulationIsRunning, 0, __ATOMIC_RELEASE);
+    pthread_join(gameSimulationThread, 0);
+  }
+#endif
 }
 
+//# Main game loop
+
 int main(void)
 {
   int screenWidth, screenHeight;
   GetPreferredSize(&screenWidth, &screenHeight);
   InitWindow(screenWidth, screenHeight, "Tower defense");
   SetTargetFPS(30);
+  double startTime = GetTime();
 
+  // the assets are decoded on worker threads while we show the loading progress
+  JobSystemInit(JobSystemGetDefaultThreadCount());
   LoadAssets();
-  InitGame();
+  float loadingProgress = 0.0f;
+  while (!WindowShouldClose() && (loadingProgress = UpdateLoadingAssets()) < 1.0f)
+  {
+    BeginDrawing();
+    ClearBackground((Color){0x4E, 0x63, 0x26, 0xFF});
+    DrawLoadingScreen(loadingProgress);
+    EndDrawing();
+  }
+  gameWorld = WorldCreate((int)(GetTime() * 100.0f));
+  RenderSnapshotInit();
+  // TD_RECORD=<file> records the session as a replay for the headless runner
+  const char *recordFilename = getenv("TD_RECORD");
+  if (recordFilename && ReplayRecorderOpen(recordFilename, gameWorld, GAME_TICK_TIME, REPLAY_DEFAULT_KEYFRAME_INTERVAL))
+  {
+    TraceLog(LOG_INFO, "GAME: recording to %s", recordFilename);
+  }
+  // TD_REWIND=<megabytes> keeps that much rewind history; backspace steps back a second
+  const char *rewindMegabytes = getenv("TD_REWIND");
+  if (rewindMegabytes && (gameWorld->rewindHistory = RewindHistoryCreate(atof(rewindMegabytes) * 1024 * 1024,
+    REWIND_DEFAULT_KEYFRAME_INTERVAL)))
+  {
+    RewindHistoryRecord(gameWorld->rewindHistory, gameWorld);
+  }
+  GameSimulationStart(gameWorld);
 
+  int isFirstFrame = 1;
   while (!WindowShouldClose())
   {
     if (IsPaused()) {
@@ -585,15 +750,41 @@ int main(void)
       continue;
     }
 
+    if (IsKeyPressed(KEY_BACKSPACE))
+    {
+      GameQueueRewind((int)(1.0 / GAME_TICK_TIME));
+    }
+    GameSimulationUpdate(gameWorld);
+    const RenderSnapshot *snapshot = RenderSnapshotAcquire();
+
     BeginDrawing();
     ClearBackground((Color){0x4E, 0x63, 0x26, 0xFF});
-
-    GameUpdate();
-    DrawLevel(currentLevel);
-
+    if (GameGetTimeScale() > 0)
+    {
+      DrawLevel(snapshot);
+    }
+    else
+    {
+      DrawLevelFastForward(snapshot);
+    }
     EndDrawing();
+
+    if (isFirstFrame)
+    {
+      TraceLog(LOG_INFO, "GAME: time to first frame: %.2f ms", (GetTime() - startTime) * 1000.0);
+      isFirstFrame = 0;
+    }
   }
 
+  GameSimulationStop();
+  ReplayRecorderClose(gameWorld);
+  RewindHistoryDestroy(gameWorld->rewindHistory);
+  WorldDestroy(gameWorld);
+  RenderSnapshotUnload();
+  // the workers run the queued jobs before they exit, so no decode job is
+  // left that could still write into the asset requests
+  JobSystemShutdown();
+  UnloadAssets();
   CloseWindow();
 
   return 0;
@@ -9,24 +9,54 @@
 //# Declarations
 
 #define ENEMY_MAX_PATH_COUNT 8
+// enemies are addressed by 16 bit indices, so this can be raised up to 65535
+#ifndef ENEMY_MAX_COUNT
 #define ENEMY_MAX_COUNT 400
+#endif
 #define ENEMY_TYPE_NONE 0
 #define ENEMY_TYPE_MINION 1
 
-#define PARTICLE_MAX_COUNT 400
 #define PARTICLE_TYPE_NONE 0
 #define PARTICLE_TYPE_EXPLOSION 1
-
-typedef struct Particle
+#define PARTICLE_TYPE_DEBRIS 2
+#define PARTICLE_TYPE_COUNT 3
+// particles per emitter; must be a power of two. Particles are only for show,
+// so builds that host many worlds can use a smaller capacity
+#ifndef PARTICLE_EMITTER_CAPACITY
+#define PARTICLE_EMITTER_CAPACITY 65536
+#endif
+
+// all particles of one type; see particle_system.c
+typedef struct ParticleEmitter
 {
-  uint8_t particleType;
-  float spawnTime;
+  float positionX[PARTICLE_EMITTER_CAPACITY];
+  float positionY[PARTICLE_EMITTER_CAPACITY];
+  float positionZ[PARTICLE_EMITTER_CAPACITY];
+  float velocityX[PARTICLE_EMITTER_CAPACITY];
+  float velocityY[PARTICLE_EMITTER_CAPACITY];
+  float velocityZ[PARTICLE_EMITTER_CAPACITY];
+  float spawnTime[PARTICLE_EMITTER_CAPACITY];
+  // head and tail count up forever, the slot is counter & (capacity - 1)
+  uint32_t head;
+  uint32_t tail;
   float lifetime;
+  uint8_t particleType;
+} ParticleEmitter;
+
+// projectile trails and particles are drawn as instanced cubes
+#define CUBE_BATCH_MAX_COUNT 16384
+
+typedef struct CubeInstance
+{
   Vector3 position;
-  Vector3 velocity;
-} Particle;
+  Vector3 size;
+  Color color;
+} CubeInstance;
 
 #define TOWER_MAX_COUNT 400
+// the tower grid covers the same area as the pathfinding map
+#define TOWER_GRID_SIZE 20
+#define TOWER_GRID_ORIGIN (-TOWER_GRID_SIZE / 2)
 enum TowerType
 {
   TOWER_TYPE_NONE,
@@ -54,11 +84,20 @@ typedef struct Tower
 {
   int16_t x, y;
   uint8_t towerType;
+  uint16_t groupSlot;
   Vector2 lastTargetPosition;
   float cooldown;
   float damage;
 } Tower;
 
+// towers of the same type are tracked in a dense list of indices into the
+// towers array, so per type updates don't need to look at any other tower
+typedef struct TowerGroup
+{
+  uint16_t count;
+  uint16_t towerIndices[TOWER_MAX_COUNT];
+} TowerGroup;
+
 typedef struct GameTime
 {
   float time;
@@ -72,6 +111,8 @@ typedef struct ButtonState {
 
 typedef struct GUIState {
   int isBlocked;
+  // the tower type the player is about to place, 0 if none
+  int placementMode;
 } GUIState;
 
 typedef enum LevelState
@@ -97,13 +138,77 @@ typedef struct EnemyWave {
   float timeToSpawnNext;
 } EnemyWave;
 
+// the world is split into square chunks for view frustum culling
+#define VISIBILITY_CHUNK_SIZE 4.0f
+#define VISIBILITY_CHUNK_COUNT 16
+#define VISIBILITY_CHUNK_ORIGIN (-VISIBILITY_CHUNK_SIZE * VISIBILITY_CHUNK_COUNT / 2)
+// how far objects may reach out of their chunk, and how tall they can be
+#define VISIBILITY_CHUNK_MARGIN 1.0f
+#define VISIBILITY_CHUNK_MIN_Y -1.0f
+#define VISIBILITY_CHUNK_MAX_Y 4.0f
+
+typedef struct Frustum
+{
+  // a, b, c, d of the plane equation ax + by + cz + d >= 0 (inside)
+  Vector4 planes[6];
+} Frustum;
+
+// models and batches record render commands that are sorted before drawing
+#define RENDER_QUEUE_MAX_COUNT 4096
+// the layer comes first in the sort order; transparent things are drawn after
+// everything opaque so they don't hide what's behind them in the depth buffer
+#define RENDER_LAYER_OPAQUE 0
+#define RENDER_LAYER_TRANSPARENT 1
+
+typedef void (*RenderBatchFunction)();
+
+typedef struct RenderCommand
+{
+  // layer << 60 | shader id << 48 | texture id << 32 | mesh id
+  uint64_t sortKey;
+  uint32_t sequence;
+  // either a batch that draws itself or a mesh
+  RenderBatchFunction drawBatch;
+  Mesh *mesh;
+  Material *material;
+  Color color;
+  Matrix transform;
+} RenderCommand;
+
+typedef struct RenderQueueStats
+{
+  int commandCount;
+  // the draw calls the commands issued and the objects (meshes, cubes,
+  // sprites) they drew; drawn one by one, every object took a draw call
+  int drawCallCount;
+  int objectCount;
+  // how often shader or texture changed between commands before and after sorting
+  int unsortedStateChanges;
+  int sortedStateChanges;
+} RenderQueueStats;
+
+// the static scenery is merged into a few meshes, one per texture and chunk
+#define SCENERY_BATCH_MAX_MESH_COUNT 128
+
+typedef struct SceneryBatchMesh
+{
+  unsigned int textureId;
+  int chunk;
+  Mesh mesh;
+  Material material;
+  int vertexCapacity;
+  int indexCapacity;
+  int isUploaded;
+  // how many meshes were merged into this one
+  int sourceMeshCount;
+} SceneryBatchMesh;
+
 typedef struct Level
 {
   int seed;
   LevelState state;
   LevelState nextState;
   Camera3D camera;
-  int placementMode;
 
   int initialGold;
   int playerGold;
@@ -174,6 +279,23 @@ typedef struct Enemy
   Vector2 movePath[ENEMY_MAX_PATH_COUNT];
 } Enemy;
 
+// Damage to enemies is not applied right away but collected in a buffer that
+// any system (or thread) can append to. EnemyApplyDamageEvents applies them
+// once per tick, sorted by the sort key, so the outcome doesn't depend on the
+// order in which the events were added. The producers build the sort key from
+// their source and a sequence number that is deterministic for that source.
+#define ENEMY_DAMAGE_EVENT_MAX_COUNT 16384
+#define ENEMY_DAMAGE_SOURCE_PROJECTILE 1
+#define ENEMY_DAMAGE_SOURCE_AREA 2
+#define ENEMY_DAMAGE_SORT_KEY(source, sequence) (((uint64_t)(source) << 56) | ((uint64_t)(sequence) & 0xffffffffffffffull))
+
+typedef struct EnemyDamageEvent
+{
+  uint64_t sortKey;
+  EnemyId enemyId;
+  float damage;
+} EnemyDamageEvent;
+
 // a unit that uses sprites to be drawn
 #define SPRITE_UNIT_PHASE_WEAPON_IDLE 0
 #define SPRITE_UNIT_PHASE_WEAPON_COOLDOWN 1
@@ -189,9 +311,25 @@ typedef struct SpriteUnit
   Vector2 srcWeaponCooldownOffset;
 } SpriteUnit;
 
+// one health bar per damaged enemy or tower at most
+#define HEALTH_BAR_BATCH_MAX_COUNT (ENEMY_MAX_COUNT + TOWER_MAX_COUNT)
+
+// units are drawn as camera facing sprites, collected per frame
+#define SPRITE_BATCH_MAX_COUNT 16384
+#define SPRITE_BATCH_MAX_TEXTURE_COUNT 8
+
+typedef struct SpriteBatchQuad
+{
+  Texture2D texture;
+  Color tint;
+  Vector3 points[4];
+  Vector2 texcoords[4];
+} SpriteBatchQuad;
+
 #define PROJECTILE_MAX_COUNT 1200
 #define PROJECTILE_TYPE_NONE 0
 #define PROJECTILE_TYPE_ARROW 1
+#define PROJECTILE_TYPE_CATAPULT 2
 
 typedef struct Projectile
 {
@@ -200,82 +338,604 @@ typedef struct Projectile
   float arrivalTime;
   float distance;
   float damage;
+  float areaDamageRadius;
   Vector3 position;
   Vector3 target;
   Vector3 directionNormal;
   EnemyId targetEnemy;
 } Projectile;
 
+#define AREA_DAMAGE_MAX_COUNT 256
+#define AREA_DAMAGE_GRID_SIZE 32
+#define AREA_DAMAGE_GRID_CELL_SIZE 1.0f
+
+typedef struct AreaDamage
+{
+  Vector2 position;
+  float radius;
+  float damage;
+  float pushbackPower;
+} AreaDamage;
+
+// Everything a match consists of. The systems keep no state of their own but
+// get the world they work on passed in, so a process can run any number of
+// matches side by side, each on its own thread if needed.
+typedef struct World
+{
+  GameTime gameTime;
+  // the number of ticks since the world was created; replays are timed by it
+  uint32_t tick;
+  // WorldHashState after the last tick, for spotting desyncs
+  uint64_t stateHash;
+  // the level seeds are derived from this
+  int seed;
+  Level level;
+
+  Enemy enemies[ENEMY_MAX_COUNT];
+  int enemyCount;
+  EnemyDamageEvent enemyDamageEvents[ENEMY_DAMAGE_EVENT_MAX_COUNT];
+  // incremented atomically, so EnemyQueueDamage can be called from any thread
+  int enemyDamageEventCount;
+
+  Tower towers[TOWER_MAX_COUNT];
+  int towerCount;
+  TowerGroup towerGroups[TOWER_TYPE_COUNT];
+  // index of the tower occupying each grid cell, -1 if the cell is free
+  int16_t towerGrid[TOWER_GRID_SIZE * TOWER_GRID_SIZE];
+  // slots of destroyed towers that can be reused before growing towerCount
+  uint16_t freeTowerSlots[TOWER_MAX_COUNT];
+  int freeTowerSlotCount;
+
+  // a min-heap on the arrival time, see projectile_system.c
+  Projectile projectiles[PROJECTILE_MAX_COUNT];
+  int projectileCount;
+  // the projectiles that landed in this tick, resolved together after popping them
+  Projectile projectileImpacts[PROJECTILE_MAX_COUNT];
+
+  ParticleEmitter particleEmitters[PARTICLE_TYPE_COUNT - 1];
+  // particles have their own random numbers so they don't disturb the level's sequence
+  uint32_t particleRandomState;
+
+  AreaDamage areaDamages[AREA_DAMAGE_MAX_COUNT];
+  int areaDamageCount;
+  // counts the resolved events of the tick; used to order their damage events
+  uint32_t areaDamageSequence;
+  // enemies of cell i are stored in areaDamageCellEnemies[areaDamageCellStart[i]] to
+  // areaDamageCellEnemies[areaDamageCellStart[i + 1] - 1]
+  uint16_t areaDamageCellStart[AREA_DAMAGE_GRID_SIZE * AREA_DAMAGE_GRID_SIZE + 1];
+  uint16_t areaDamageCellEnemies[ENEMY_MAX_COUNT];
+
+  // the distances from the castle to each cell in the map
+  PathfindingMap pathfindingMap;
+  // the queue of the pathfinding algorithm; kept around to avoid reallocating it
+  PathfindingNode *pathfindingNodeQueue;
+  int pathfindingNodeQueueCount;
+  int pathfindingNodeQueueCapacity;
+
+  // when set, UpdateLevel records the timings of its systems here; not part of the match
+  struct TaskTrace *updateTrace;
+  // when set, WorldStep records the input and keyframes of the match here, see replay.c
+  struct ReplayRecorder *replayRecorder;
+  // when set, WorldStep keeps the last ticks here for rewinding, see rewind.c
+  struct RewindHistory *rewindHistory;
+} World;
+
+typedef enum LevelActionType
+{
+  LEVEL_ACTION_NONE,
+  LEVEL_ACTION_PLACE_TOWER,
+  LEVEL_ACTION_SET_NEXT_STATE,
+} LevelActionType;
+
+// a player input; the front ends queue these and apply them to the world
+// between ticks with LevelActionApply
+typedef struct LevelAction
+{
+  uint8_t actionType;
+  uint8_t towerType;
+  uint8_t nextState;
+  int16_t x, y;
+} LevelAction;
+
+#define WORLD_STATE_MAGIC 0x53574454
+#define WORLD_STATE_VERSION 2
+
+// a growable buffer that world states are written to and read from
+typedef struct ByteBuffer
+{
+  uint8_t *data;
+  int size;
+  int capacity;
+  int readOffset;
+  // set when a write ran out of memory or a read ran past the end
+  int isOverflow;
+} ByteBuffer;
+
+#define REPLAY_MAGIC 0x50524454
+#define REPLAY_VERSION 2
+#define REPLAY_DEFAULT_KEYFRAME_INTERVAL 600
+// the most actions a replay can apply in one tick, as many as the headless scripts can hold
+#define REPLAY_MAX_TICK_ACTION_COUNT 1024
+
+// opaque, see replay.c
+typedef struct ReplayRecorder ReplayRecorder;
+typedef struct ReplayPlayer ReplayPlayer;
+
+typedef struct ReplayHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t headerSize;
+  int32_t seed;
+  float deltaTime;
+  // a full world state is stored every keyframeInterval ticks, starting with startTick
+  uint32_t keyframeInterval;
+  uint32_t startTick;
+  uint32_t tickCount;
+  uint32_t keyframeCount;
+  // where the table of keyframe ticks and file offsets starts
+  uint32_t indexOffset;
+} ReplayHeader;
+
+#define REWIND_DEFAULT_KEYFRAME_INTERVAL 60
+
+// opaque, see rewind.c
+typedef struct RewindHistory RewindHistory;
+
+typedef struct RewindStats
+{
+  uint32_t oldestTick;
+  uint32_t newestTick;
+  int frameCount;
+  int keyframeCount;
+  // the bytes taken by the stored frames, out of the memory budget
+  int usedBytes;
+  int memoryBudget;
+} RewindStats;
+
+typedef struct RenderSnapshotEnemy
+{
+  Vector2 position;
+  float walkedDistance;
+  // 1 if the enemy is unharmed, which hides its health bar
+  float healthRatio;
+  uint8_t enemyType;
+} RenderSnapshotEnemy;
+
+typedef struct RenderSnapshotTower
+{
+  int16_t x, y;
+  uint8_t towerType;
+  uint8_t isCoolingDown;
+  Vector2 lastTargetPosition;
+  float healthRatio;
+} RenderSnapshotTower;
+
+typedef struct RenderSnapshotProjectile
+{
+  Vector3 position;
+  Vector3 target;
+  float transition;
+  float distance;
+  uint8_t projectileType;
+} RenderSnapshotProjectile;
+
+typedef struct RenderSnapshotParticle
+{
+  Vector3 position;
+  float transition;
+  uint8_t particleType;
+} RenderSnapshotParticle;
+
+// Everything the main thread needs to draw a world, copied out at the end of
+// a tick. The simulation thread fills one snapshot while the main thread draws
+// another, so the world itself is never touched by the renderer.
+typedef struct RenderSnapshot
+{
+  // counts the published snapshots
+  uint32_t sequence;
+  float time;
+  Camera3D camera;
+  uint8_t levelState;
+  uint8_t hasNextWave;
+  int levelSeed;
+  int playerGold;
+  // all enemies of the current wave, and those not yet spawned or still alive
+  int waveEnemyCount;
+  int waveRemainingCount;
+
+  // grouped by type; the towers of type t are towers[towerGroupStart[t]] to
+  // towers[towerGroupStart[t + 1] - 1]
+  RenderSnapshotTower towers[TOWER_MAX_COUNT];
+  uint16_t towerGroupStart[TOWER_TYPE_COUNT + 1];
+  int towerCount;
+  RenderSnapshotEnemy enemies[ENEMY_MAX_COUNT];
+  int enemyCount;
+  RenderSnapshotProjectile projectiles[PROJECTILE_MAX_COUNT];
+  int projectileCount;
+  RenderSnapshotParticle particles[(PARTICLE_TYPE_COUNT - 1) * PARTICLE_EMITTER_CAPACITY];
+  int particleCount;
+} RenderSnapshot;
+
+// The parts of the world a system reads or writes. The task graph runs two
+// systems at the same time only if neither writes what the other one touches.
+#define WORLD_DATA_LEVEL 0x01
+#define WORLD_DATA_ENEMIES 0x02
+#define WORLD_DATA_TOWERS 0x04
+#define WORLD_DATA_PROJECTILES 0x08
+#define WORLD_DATA_PARTICLES 0x10
+#define WORLD_DATA_AREA_DAMAGE 0x20
+#define WORLD_DATA_DAMAGE_EVENTS 0x40
+#define WORLD_DATA_PATHFINDING 0x80
+
+#define TASK_GRAPH_MAX_TASKS 32
+
+typedef void (*TaskFunction)(World *world);
+
+// a system of the task graph; see task_graph.c
+typedef struct Task
+{
+  const char *name;
+  TaskFunction function;
+  uint32_t reads;
+  uint32_t writes;
+} Task;
+
+#define TASK_TRACE_MAX_EVENTS 8192
+
+typedef struct TaskTraceEvent
+{
+  const char *name;
+  int threadIndex;
+  double startTime;
+  double endTime;
+} TaskTraceEvent;
+
+// timings of task graph runs; the events of the first runs are kept until
+// the buffer is full, the totals are summed up over all runs
+typedef struct TaskTrace
+{
+  TaskTraceEvent events[TASK_TRACE_MAX_EVENTS];
+  int eventCount;
+  int runCount;
+  // the time spent in the tasks and the time the runs took from start to end;
+  // the ratio is the average number of tasks running at the same time
+  double taskTime;
+  double runTime;
+} TaskTrace;
+
+#define ASSET_CACHE_MAX_COUNT 64
+#define ASSET_PATH_MAX_LENGTH 128
+#define ASSET_TYPE_NONE 0
+#define ASSET_TYPE_MODEL 1
+#define ASSET_TYPE_TEXTURE 2
+
+typedef struct AssetCacheEntry
+{
+  char path[ASSET_PATH_MAX_LENGTH];
+  uint8_t assetType;
+  uint8_t isPacked;
+  int refCount;
+  Model model;
+  Texture2D texture;
+} AssetCacheEntry;
+
+#define ASSET_REQUEST_MAX_COUNT 64
+#define ASSET_REQUEST_QUEUED 0
+#define ASSET_REQUEST_DECODED 1
+#define ASSET_REQUEST_DONE 2
+
+// an asset that is loaded in the background; the state is written by the
+// worker thread that decodes the asset, so it must be accessed atomically
+typedef struct AssetRequest
+{
+  char path[ASSET_PATH_MAX_LENGTH];
+  uint8_t assetType;
+  int state;
+  Model *model;
+  Texture2D *texture;
+  Texture2D *diffuseTexture;
+  int textureFilter;
+  Image image;
+  unsigned char *fileData;
+  int fileDataSize;
+} AssetRequest;
+
+#define JOB_SYSTEM_MAX_THREADS 16
+#define JOB_QUEUE_CAPACITY 256
+
+typedef void (*JobFunction)(void *data);
+
+typedef struct Job
+{
+  JobFunction function;
+  void *data;
+} Job;
+
+// counters to compare the asset pack loader against loading the individual files
+typedef struct AssetLoadStats
+{
+  int fileReads;
+  long bytesRead;
+  long bytesCopied;
+  double loadTime;
+} AssetLoadStats;
+
+// The asset pack is a single file holding all assets of the data directory in
+// the layout that is uploaded to the GPU, so loading needs no parsing or decoding.
+// It starts with the header, followed by the entry table; each entry points to
+// a payload. Entry offsets are in bytes from the start of the file, offsets
+// inside a payload are relative to the start of that payload. Payloads and
+// their arrays are aligned to ASSET_PACK_ALIGNMENT bytes.
+#define ASSET_PACK_MAGIC 0x4B415054 // "TPAK"
+#define ASSET_PACK_VERSION 2
+#define ASSET_PACK_ALIGNMENT 16
+#define ASSET_PACK_PATH "data/assets.pak"
+
+typedef struct AssetPackHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entryCount;
+  uint32_t entryTableOffset;
+} AssetPackHeader;
+
+typedef struct AssetPackEntry
+{
+  char path[ASSET_PATH_MAX_LENGTH];
+  uint32_t assetType;
+  uint32_t offset;
+  uint32_t size;
+  // size and modification time of the file the entry was packed from; once
+  // the file doesn't match them anymore, the entry is stale
+  uint32_t sourceSize;
+  int64_t sourceModTime;
+} AssetPackEntry;
+
+// a model payload starts with an AssetPackModel that points to the material
+// and mesh tables, which in turn point to the vertex arrays
+typedef struct AssetPackModel
+{
+  uint32_t meshCount;
+  uint32_t materialCount;
+  uint32_t materialsOffset;
+  uint32_t meshesOffset;
+} AssetPackModel;
+
+typedef struct AssetPackMaterial
+{
+  Color diffuseColor;
+} AssetPackMaterial;
+
+// array offsets are 0 if the mesh doesn't have that vertex attribute
+typedef struct AssetPackMesh
+{
+  uint32_t vertexCount;
+  uint32_t triangleCount;
+  uint32_t materialIndex;
+  uint32_t verticesOffset;
+  uint32_t texcoordsOffset;
+  uint32_t normalsOffset;
+  uint32_t colorsOffset;
+  uint32_t indicesOffset;
+} AssetPackMesh;
+
+// a texture payload is an AssetPackTexture followed by the pixel data
+typedef struct AssetPackTexture
+{
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  uint32_t dataOffset;
+} AssetPackTexture;
+
 //# Function declarations
 float TowerGetMaxHealth(Tower *tower);
 int Button(const char *text, int x, int y, int width, int height, ButtonState *state);
-int EnemyAddDamage(Enemy *enemy, float damage);
+void GameQueueAction(LevelAction action);
+void GameQueueRewind(int tickCount);
+void GameSetTimeScale(int timeScale);
+int GameGetTimeScale();
+void GameQueueNextState(int nextState);
+int GameCanPlaceTower(const RenderSnapshot *snapshot, uint8_t towerType, int16_t x, int16_t y);
+int EnemyAddDamage(World *world, Enemy *enemy, float damage);
+
+//# Assets
+Model AssetCacheLoadModel(const char *path);
+Texture2D AssetCacheLoadTexture(const char *path);
+void AssetCacheReleaseModel(Model model);
+void AssetCacheReleaseTexture(Texture2D texture);
+void AssetCacheUnloadAll();
+AssetLoadStats AssetCacheGetStats();
+void AssetCacheRequestModel(const char *path, Model *model, Texture2D *diffuseTexture);
+void AssetCacheRequestTexture(const char *path, Texture2D *texture, int textureFilter);
+float AssetCacheUpdateRequests(double timeBudget);
+int AssetPackOpen(const char *path);
+void AssetPackClose();
+int AssetPackIsOpen();
+int AssetPackContains(const char *path, uint32_t assetType);
+int AssetPackLoadModel(const char *path, Model *model, AssetLoadStats *stats);
+int AssetPackLoadTexture(const char *path, Texture2D *texture, AssetLoadStats *stats);
+void AssetPackUnloadModel(Model model);
+void RequestGLBModel(char *filename, Model *model);
+
+//# Jobs
+int JobSystemGetDefaultThreadCount();
+void JobSystemInit(int threadCount);
+void JobSystemShutdown();
+int JobSystemGetThreadCount();
+int JobSystemGetThreadIndex();
+void JobSystemSubmit(JobFunction function, void *data);
+void JobSystemWaitForCounter(int *counter);
+void JobSystemWait();
+
+//# Task graph
+void TaskGraphRun(const Task *tasks, int taskCount, World *world, TaskTrace *trace);
+int TaskTraceSave(TaskTrace *trace, const char *filename);
 
 //# Enemy functions
-void EnemyInit();
-void EnemyDraw();
-void EnemyTriggerExplode(Enemy *enemy, Tower *tower, Vector3 explosionSource);
-void EnemyUpdate();
+void EnemyInit(World *world);
+void EnemyDraw(const RenderSnapshot *snapshot);
+void EnemyWriteSnapshot(World *world, RenderSnapshot *snapshot);
+void EnemyTriggerExplode(World *world, Enemy *enemy, Tower *tower, Vector3 explosionSource);
+void EnemyUpdate(World *world);
 float EnemyGetCurrentMaxSpeed(Enemy *enemy);
 float EnemyGetMaxHealth(Enemy *enemy);
-int EnemyGetNextPosition(int16_t currentX, int16_t currentY, int16_t *nextX, int16_t *nextY);
-Vector2 EnemyGetPosition(Enemy *enemy, float deltaT, Vector2 *velocity, int *waypointPassedCount);
-EnemyId EnemyGetId(Enemy *enemy);
-Enemy *EnemyTryResolve(EnemyId enemyId);
-Enemy *EnemyTryAdd(uint8_t enemyType, int16_t currentX, int16_t currentY);
-int EnemyAddDamage(Enemy *enemy, float damage);
-Enemy* EnemyGetClosestToCastle(int16_t towerX, int16_t towerY, float range);
-int EnemyCount();
-void EnemyDrawHealthbars(Camera3D camera);
+int EnemyGetNextPosition(World *world, int16_t currentX, int16_t currentY, int16_t *nextX, int16_t *nextY);
+Vector2 EnemyGetPosition(World *world, Enemy *enemy, float deltaT, Vector2 *velocity, int *waypointPassedCount);
+EnemyId EnemyGetId(World *world, Enemy *enemy);
+Enemy *EnemyTryResolve(World *world, EnemyId enemyId);
+Enemy *EnemyTryAdd(World *world, uint8_t enemyType, int16_t currentX, int16_t currentY);
+int EnemyAddDamage(World *world, Enemy *enemy, float damage);
+void EnemyQueueDamage(World *world, Enemy *enemy, float damage, uint64_t sortKey);
+void EnemyApplyDamageEvents(World *world);
+Enemy* EnemyGetClosestToCastle(World *world, int16_t towerX, int16_t towerY, float range);
+int EnemyCount(World *world);
+void EnemyDrawHealthbars(const RenderSnapshot *snapshot);
 
 //# Tower functions
-void TowerInit();
-Tower *TowerGetAt(int16_t x, int16_t y);
-Tower *TowerTryAdd(uint8_t towerType, int16_t x, int16_t y);
-Tower *GetTowerByType(uint8_t towerType);
+void TowerInit(World *world);
+void TowerLoadAssets();
+void TowerUnloadAssets();
+Tower *TowerGetAt(World *world, int16_t x, int16_t y);
+Tower *TowerTryAdd(World *world, uint8_t towerType, int16_t x, int16_t y);
+void TowerDestroy(World *world, Tower *tower);
+int TowerRebuildLookups(World *world);
+Tower *GetTowerByType(World *world, uint8_t towerType);
 int GetTowerCosts(uint8_t towerType);
 float TowerGetMaxHealth(Tower *tower);
-void TowerDraw();
-void TowerUpdate();
-void TowerDrawHealthBars(Camera3D camera);
+void TowerDraw(const RenderSnapshot *snapshot);
+void TowerUpdate(World *world);
+void TowerWriteSnapshot(World *world, RenderSnapshot *snapshot);
+void TowerDrawHealthBars(const RenderSnapshot *snapshot);
 void DrawSpriteUnit(SpriteUnit unit, Vector3 position, float t, int flip, int phase);
 
 //# Particles
-void ParticleInit();
-void ParticleAdd(uint8_t particleType, Vector3 position, Vector3 velocity, float lifetime);
-void ParticleUpdate();
-void ParticleDraw();
+void ParticleInit(World *world);
+void ParticleAdd(World *world, uint8_t particleType, Vector3 position, Vector3 velocity);
+void ParticleEmitBurst(World *world, uint8_t particleType, Vector3 position, int count, float speed);
+void ParticleUpdate(World *world);
+void ParticleWriteSnapshot(World *world, RenderSnapshot *snapshot);
+void ParticleDraw(const RenderSnapshot *snapshot);
+
+//# Cube batch
+void CubeBatchInit();
+void CubeBatchUnload();
+void CubeBatchAdd(Vector3 position, Vector3 size, Color color);
+void CubeBatchDraw();
+unsigned int CubeBatchGetShaderId();
 
 //# Projectiles
-void ProjectileInit();
-void ProjectileDraw();
-void ProjectileUpdate();
-Projectile *ProjectileTryAdd(uint8_t projectileType, Enemy *enemy, Vector3 position, Vector3 target, float speed, float damage);
+void ProjectileInit(World *world);
+void ProjectileWriteSnapshot(World *world, RenderSnapshot *snapshot);
+void ProjectileDraw(const RenderSnapshot *snapshot);
+void ProjectileUpdate(World *world);
+Projectile *ProjectileTryAdd(World *world, uint8_t projectileType, Enemy *enemy, Vector3 position, Vector3 target, float speed, float damage, float areaDamageRadius);
+
+//# Area damage
+void AreaDamageInit(World *world);
+void AreaDamageAdd(World *world, Vector2 position, float radius, float damage, float pushbackPower);
+void AreaDamageUpdate(World *world);
 
 //# Pathfinding map
-void PathfindingMapInit(int width, int height, Vector3 translate, float scale);
-float PathFindingGetDistance(int mapX, int mapY);
-Vector2 PathFindingGetGradient(Vector3 world);
-int PathFindingFromWorldToMapPosition(Vector3 worldPosition, int16_t *mapX, int16_t *mapY);
-void PathFindingMapUpdate();
-void PathFindingMapDraw();
+void PathfindingMapInit(World *world, int width, int height, Vector3 translate, float scale);
+void PathfindingMapUnload(World *world);
+float PathFindingGetDistance(World *world, int mapX, int mapY);
+Vector2 PathFindingGetGradient(World *world, Vector3 worldPosition);
+int PathFindingFromWorldToMapPosition(World *world, Vector3 worldPosition, int16_t *mapX, int16_t *mapY);
+void PathFindingMapUpdate(World *world);
+void PathFindingMapDraw(World *world);
 
 //# UI
-void DrawHealthBar(Camera3D camera, Vector3 position, float healthRatio, Color barColor, float healthBarWidth);
+void HealthBarBatchAdd(Vector3 position, float healthRatio, Color barColor, float width);
+void HealthBarBatchDraw(Camera3D camera);
+
+//# Render queue
+void RenderQueueBegin();
+void RenderQueueAddModel(Model model, Matrix transform, Color tint);
+void RenderQueueAddBatch(RenderBatchFunction drawBatch, uint8_t layer, unsigned int shaderId, unsigned int textureId);
+void RenderQueueSubmit();
+void RenderQueueCountDrawCalls(int drawCallCount, int objectCount);
+RenderQueueStats RenderQueueGetStats();
+
+//# Visibility
+Frustum FrustumFromMatrix(Matrix viewProjection);
+int FrustumIntersectsBox(const Frustum *frustum, BoundingBox box);
+void VisibilityUpdate();
+int VisibilityGetChunk(float x, float z);
+BoundingBox VisibilityGetChunkBounds(int chunk);
+int VisibilityIsChunkVisible(int chunk);
+int VisibilityIsVisible(float x, float z);
+
+//# Sprite batch
+void SpriteBatchBegin(Camera3D camera);
+void SpriteBatchAdd(Texture2D texture, Rectangle srcRect, Vector3 position, Vector2 size, Vector2 origin, Color tint);
+void SpriteBatchDraw();
+
+//# Scenery batch
+void SceneryBatchClear();
+void SceneryBatchAddModel(Model model, Matrix transform);
+void SceneryBatchUpload();
+void SceneryBatchDraw();
+
+//# Render snapshots
+void RenderSnapshotInit();
+void RenderSnapshotUnload();
+RenderSnapshot *RenderSnapshotBeginWrite();
+void RenderSnapshotPublish();
+const RenderSnapshot *RenderSnapshotAcquire();
+
+//# World
+World *WorldCreate(int seed);
+void WorldDestroy(World *world);
+int WorldStep(World *world, float deltaTime, const LevelAction *actions, int actionCount);
+void WorldWriteState(World *world, ByteBuffer *buffer);
+int WorldReadState(World *world, ByteBuffer *buffer);
+int WorldSaveFile(World *world, const char *filename);
+int WorldLoadFile(World *world, const char *filename);
+uint64_t WorldHashState(World *world);
+
+//# Byte buffer
+uint8_t *ByteBufferReserve(ByteBuffer *buffer, int size);
+void ByteBufferWrite(ByteBuffer *buffer, const void *data, int size);
+int ByteBufferRead(ByteBuffer *buffer, void *data, int size);
+void ByteBufferFree(ByteBuffer *buffer);
+
+//# Replay
+ReplayRecorder *ReplayRecorderOpen(const char *filename, World *world, float deltaTime, int keyframeInterval);
+void ReplayRecorderClose(World *world);
+void ReplayRecorderAddAction(World *world, LevelAction action);
+void ReplayRecorderEndTick(World *world);
+ReplayPlayer *ReplayPlayerOpen(const char *filename);
+void ReplayPlayerClose(ReplayPlayer *player);
+const ReplayHeader *ReplayPlayerGetHeader(ReplayPlayer *player);
+int ReplayPlayerSeek(ReplayPlayer *player, World *world, uint32_t tick);
+int ReplayPlayerStep(ReplayPlayer *player, World *world);
+int ReplayPlayerGetDesyncTick(ReplayPlayer *player, uint32_t *tick);
+
+//# Rewind
+RewindHistory *RewindHistoryCreate(int memoryBudget, int keyframeInterval);
+void RewindHistoryDestroy(RewindHistory *history);
+void RewindHistoryRecord(RewindHistory *history, World *world);
+int RewindHistoryRestore(RewindHistory *history, World *world, uint32_t tick);
+void RewindHistoryGetStats(RewindHistory *history, RewindStats *stats);
 
 //# Level
-void DrawLevelGround(Level *level);
+void InitLevel(World *world);
+void UpdateLevel(World *world);
+int HasLevelNextWave(Level *level);
+void InitBattleStateConditions(Level *level);
+int LevelActionPlaceTower(World *world, uint8_t towerType, int16_t x, int16_t y);
+void LevelActionSetNextState(World *world, int nextState);
+int LevelActionApply(World *world, LevelAction action);
+void LevelWriteSnapshot(World *world, RenderSnapshot *snapshot);
+void DrawLevelGround(const RenderSnapshot *snapshot);
+void DrawLevelScene(const RenderSnapshot *snapshot);
 
 //# variables
-extern Level *currentLevel;
-extern Enemy enemies[ENEMY_MAX_COUNT];
-extern int enemyCount;
 extern EnemyClassConfig enemyClassConfigs[];
 
 extern GUIState guiState;
-extern GameTime gameTime;
-extern Tower towers[TOWER_MAX_COUNT];
-extern int towerCount;
 
 extern Texture2D palette, spriteSheet;
 
@@ -1,7 +1,9 @@
 #include "td_main.h"
 #include <raymath.h>
 
-static TowerTypeConfig towerTypeConfigs[TOWER_TYPE_COUNT] = {
+// the configs are constant so that the per type update kernels below can
+// have the values folded into the code by the compiler
+static const TowerTypeConfig towerTypeConfigs[TOWER_TYPE_COUNT] = {
     [TOWER_TYPE_BASE] = {
         .maxHealth = 10,
     },
@@ -31,7 +33,7 @@ static TowerTypeConfig towerTypeConfigs[TOWER_TYPE_COUNT] = {
         .cost = 10,
         .maxHealth = 10,
         .projectileSpeed = 4.0f,
-        .projectileType = PROJECTILE_TYPE_ARROW,
+        .projectileType = PROJECTILE_TYPE_CATAPULT,
     },
     [TOWER_TYPE_WALL] = {
         .cost = 2,
@@ -39,9 +41,6 @@ static TowerTypeConfig towerTypeConfigs[TOWER_TYPE_COUNT] = {
     },
 };
 
-Tower towers[TOWER_MAX_COUNT];
-int towerCount = 0;
-
 Model towerModels[TOWER_TYPE_COUNT];
 
 // definition of our archer unit
@@ -59,15 +58,10 @@ SpriteUnit archerUnit = {
 void DrawSpriteUnit(SpriteUnit unit, Vector3 position, float t, int flip, int phase)
 {
   float xScale = flip ? -1.0f : 1.0f;
-  Camera3D camera = currentLevel->camera;
   float size = 0.5f;
   Vector2 offset = (Vector2){ unit.offset.x / 16.0f * size, unit.offset.y / 16.0f * size * xScale };
   Vector2 scale = (Vector2){ unit.srcRect.width / 16.0f * size, unit.srcRect.height / 16.0f * size };
-  // we want the sprite to face the camera, so we need to calculate the up vector
-  Vector3 forward = Vector3Subtract(camera.target, camera.position);
-  Vector3 up = {0, 1, 0};
-  Vector3 right = Vector3CrossProduct(forward, up);
-  up = Vector3Normalize(Vector3CrossProduct(right, forward));
+  // the sprites are drawn by the sprite batch, which makes them face the camera
 
   Rectangle srcRect = unit.srcRect;
   if (unit.frameCount > 1)
@@ -79,7 +73,7 @@ void DrawSpriteUnit(SpriteUnit unit, Vector3 position, float t, int flip, int ph
     srcRect.x += srcRect.width;
     srcRect.width = -srcRect.width;
   }
-  DrawBillboardPro(camera, spriteSheet, srcRect, position, up, scale, offset, 0, WHITE);
+  SpriteBatchAdd(spriteSheet, srcRect, position, scale, offset, WHITE);
 
   if (phase == SPRITE_UNIT_PHASE_WEAPON_COOLDOWN && unit.srcWeaponCooldownRect.width > 0)
   {
@@ -93,7 +87,7 @@ void DrawSpriteUnit(SpriteUnit unit, Vector3 position, float t, int flip, int ph
       srcRect.width = -srcRect.width;
       offset.x = scale.x - offset.x;
     }
-    DrawBillboardPro(camera, spriteSheet, srcRect, position, up, scale, offset, 0, WHITE);
+    SpriteBatchAdd(spriteSheet, srcRect, position, scale, offset, WHITE);
   }
   else if (phase == SPRITE_UNIT_PHASE_WEAPON_IDLE && unit.srcWeaponIdleRect.width > 0)
   {
@@ -107,50 +101,65 @@ void DrawSpriteUnit(SpriteUnit unit, Vector3 position, float t, int flip, int ph
       srcRect.width = -srcRect.width;
       offset.x = scale.x - offset.x;
     }
-    DrawBillboardPro(camera, spriteSheet, srcRect, position, up, scale, offset, 0, WHITE);
+    SpriteBatchAdd(spriteSheet, srcRect, position, scale, offset, WHITE);
   }
 }
 
-void TowerInit()
+void TowerInit(World *world)
 {
   for (int i = 0; i < TOWER_MAX_COUNT; i++)
   {
-    towers[i] = (Tower){0};
+    world->towers[i] = (Tower){0};
+  }
+  world->towerCount = 0;
+  for (int i = 0; i < TOWER_TYPE_COUNT; i++)
+  {
+    world->towerGroups[i].count = 0;
   }
-  towerCount = 0;
+  for (int i = 0; i < TOWER_GRID_SIZE * TOWER_GRID_SIZE; i++)
+  {
+    world->towerGrid[i] = -1;
+  }
+  world->freeTowerSlotCount = 0;
+}
 
-  towerModels[TOWER_TYPE_BASE] = LoadModel("data/keep.glb");
-  towerModels[TOWER_TYPE_WALL] = LoadModel("data/wall-0000.glb");
+void TowerLoadAssets()
+{
+  // the models come from the asset cache, so they are loaded only once per process
+  RequestGLBModel("keep", &towerModels[TOWER_TYPE_BASE]);
+  RequestGLBModel("wall-0000", &towerModels[TOWER_TYPE_WALL]);
+}
 
+void TowerUnloadAssets()
+{
   for (int i = 0; i < TOWER_TYPE_COUNT; i++)
   {
-    if (towerModels[i].materials)
+    if (towerModels[i].meshes)
     {
-      // assign the palette texture to the material of the model (0 is not used afaik)
-      towerModels[i].materials[1].maps[MATERIAL_MAP_DIFFUSE].texture = palette;
+      AssetCacheReleaseModel(towerModels[i]);
+      towerModels[i] = (Model){0};
     }
   }
 }
 
-static void TowerGunUpdate(Tower *tower)
+static inline void TowerGunUpdate(World *world, Tower *tower, const TowerTypeConfig *config)
 {
-  TowerTypeConfig config = towerTypeConfigs[tower->towerType];
   if (tower->cooldown <= 0.0f)
   {
-    Enemy *enemy = EnemyGetClosestToCastle(tower->x, tower->y, config.range);
+    Enemy *enemy = EnemyGetClosestToCastle(world, tower->x, tower->y, config->range);
     if (enemy)
     {
-      tower->cooldown = config.cooldown;
+      tower->cooldown = config->cooldown;
       // shoot the enemy; determine future position of the enemy
-      float bulletSpeed = config.projectileSpeed;
-      float bulletDamage = config.damage;
+      float bulletSpeed = config->projectileSpeed;
+      float bulletDamage = config->damage;
       Vector2 velocity = enemy->simVelocity;
-      Vector2 futurePosition = EnemyGetPosition(enemy, gameTime.time - enemy->startMovingTime, &velocity, 0);
+      Vector2 futurePosition = EnemyGetPosition(world, enemy, world->gameTime.time - enemy->startMovingTime, &velocity, 0);
       Vector2 towerPosition = {tower->x, tower->y};
       float eta = Vector2Distance(towerPosition, futurePosition) / bulletSpeed;
       for (int i = 0; i < 8; i++) {
         velocity = enemy->simVelocity;
-        futurePosition = EnemyGetPosition(enemy, gameTime.time - enemy->startMovingTime + eta, &velocity, 0);
+        futurePosition = EnemyGetPosition(world, enemy, world->gameTime.time - enemy->startMovingTime + eta, &velocity, 0);
         float distance = Vector2Distance(towerPosition, futurePosition);
         float eta2 = distance / bulletSpeed;
         if (fabs(eta - eta2) < 0.01f) {
@@ -158,64 +167,192 @@ static void TowerGunUpdate(Tower *tower)
         }
         eta = (eta2 + eta) * 0.5f;
       }
-      ProjectileTryAdd(PROJECTILE_TYPE_ARROW, enemy, 
+      ProjectileTryAdd(world, config->projectileType, enemy, 
         (Vector3){towerPosition.x, 1.33f, towerPosition.y}, 
         (Vector3){futurePosition.x, 0.25f, futurePosition.y},
-        bulletSpeed, bulletDamage);
+        bulletSpeed, bulletDamage, config->areaDamageRadius);
       enemy->futureDamage += bulletDamage;
       tower->lastTargetPosition = futurePosition;
     }
   }
   else
   {
-    tower->cooldown -= gameTime.deltaTime;
+    tower->cooldown -= world->gameTime.deltaTime;
   }
 }
 
-Tower *TowerGetAt(int16_t x, int16_t y)
+// The update kernel for all towers of one type. It is only ever called with a
+// constant tower type, so after inlining each call site becomes a loop that is
+// specialized on that type's config: range, cooldown and projectile values
+// are compile time constants and there's no per tower type dispatch left.
+static inline void TowerGunUpdateGroup(World *world, const uint8_t towerType)
 {
-  for (int i = 0; i < towerCount; i++)
+  const TowerTypeConfig *config = &towerTypeConfigs[towerType];
+  TowerGroup *group = &world->towerGroups[towerType];
+  for (int i = 0; i < group->count; i++)
   {
-    if (towers[i].x == x && towers[i].y == y && towers[i].towerType != TOWER_TYPE_NONE)
-    {
-      return &towers[i];
-    }
+    TowerGunUpdate(world, &world->towers[group->towerIndices[i]], config);
   }
-  return 0;
 }
 
-Tower *TowerTryAdd(uint8_t towerType, int16_t x, int16_t y)
+// returns true if the position is inside the tower grid
+static int TowerGetGridCell(int16_t x, int16_t y, int *cell)
 {
-  if (towerCount >= TOWER_MAX_COUNT)
+  int gridX = x - TOWER_GRID_ORIGIN;
+  int gridY = y - TOWER_GRID_ORIGIN;
+  if (gridX < 0 || gridX >= TOWER_GRID_SIZE || gridY < 0 || gridY >= TOWER_GRID_SIZE)
   {
     return 0;
   }
+  *cell = gridY * TOWER_GRID_SIZE + gridX;
+  return 1;
+}
 
-  Tower *tower = TowerGetAt(x, y);
-  if (tower)
+Tower *TowerGetAt(World *world, int16_t x, int16_t y)
+{
+  int cell;
+  if (!TowerGetGridCell(x, y, &cell) || world->towerGrid[cell] < 0)
   {
     return 0;
   }
+  return &world->towers[world->towerGrid[cell]];
+}
 
-  tower = &towers[towerCount++];
+Tower *TowerTryAdd(World *world, uint8_t towerType, int16_t x, int16_t y)
+{
+  int cell;
+  if (!TowerGetGridCell(x, y, &cell) || world->towerGrid[cell] >= 0)
+  {
+    return 0;
+  }
+
+  // reuse the slots of destroyed towers first, so the towers array stays
+  // compact no matter how often towers get destroyed and rebuilt
+  Tower *tower = 0;
+  if (world->freeTowerSlotCount > 0)
+  {
+    tower = &world->towers[world->freeTowerSlots[--world->freeTowerSlotCount]];
+  }
+  else if (world->towerCount < TOWER_MAX_COUNT)
+  {
+    tower = &world->towers[world->towerCount++];
+  }
+  else
+  {
+    return 0;
+  }
+
+  // a reused slot still holds the state of the destroyed tower
+  *tower = (Tower){0};
   tower->x = x;
   tower->y = y;
   tower->towerType = towerType;
   tower->cooldown = 0.0f;
   tower->damage = 0.0f;
+  world->towerGrid[cell] = tower - world->towers;
+
+  TowerGroup *group = &world->towerGroups[towerType];
+  tower->groupSlot = group->count;
+  group->towerIndices[group->count++] = tower - world->towers;
   return tower;
 }
 
-Tower *GetTowerByType(uint8_t towerType)
+void TowerDestroy(World *world, Tower *tower)
 {
-  for (int i = 0; i < towerCount; i++)
+  if (tower->towerType == TOWER_TYPE_NONE)
+  {
+    return;
+  }
+
+  // swap remove the tower from its group; the last tower of the group takes its slot
+  TowerGroup *group = &world->towerGroups[tower->towerType];
+  uint16_t lastIndex = group->towerIndices[--group->count];
+  group->towerIndices[tower->groupSlot] = lastIndex;
+  world->towers[lastIndex].groupSlot = tower->groupSlot;
+
+  int cell;
+  if (TowerGetGridCell(tower->x, tower->y, &cell))
+  {
+    world->towerGrid[cell] = -1;
+  }
+  world->freeTowerSlots[world->freeTowerSlotCount++] = tower - world->towers;
+
+  tower->towerType = TOWER_TYPE_NONE;
+}
+
+// rebuilds the grid and the groups from the towers array; a tower's group slot
+// says where it is in its group, so the group order comes out the same as before.
+// The towers may come from a broken file, so returns 0 if they are not
+// something TowerTryAdd and TowerDestroy could have left behind: group slots
+// that aren't exactly 0 to count - 1 per type, two towers on one cell, or free
+// slots that aren't distinct destroyed towers
+int TowerRebuildLookups(World *world)
+{
+  for (int i = 0; i < TOWER_TYPE_COUNT; i++)
+  {
+    TowerGroup *group = &world->towerGroups[i];
+    group->count = 0;
+    for (int j = 0; j < TOWER_MAX_COUNT; j++)
+    {
+      group->towerIndices[j] = UINT16_MAX;
+    }
+  }
+  for (int i = 0; i < TOWER_GRID_SIZE * TOWER_GRID_SIZE; i++)
+  {
+    world->towerGrid[i] = -1;
+  }
+  for (int i = 0; i < world->towerCount; i++)
+  {
+    Tower *tower = &world->towers[i];
+    if (tower->towerType == TOWER_TYPE_NONE)
+    {
+      continue;
+    }
+    if (tower->towerType >= TOWER_TYPE_COUNT || tower->groupSlot >= TOWER_MAX_COUNT)
+    {
+      return 0;
+    }
+    TowerGroup *group = &world->towerGroups[tower->towerType];
+    int cell;
+    if (group->towerIndices[tower->groupSlot] != UINT16_MAX || !TowerGetGridCell(tower->x, tower->y, &cell) ||
+      world->towerGrid[cell] >= 0)
+    {
+      return 0;
+    }
+    group->towerIndices[tower->groupSlot] = i;
+    group->count++;
+    world->towerGrid[cell] = i;
+  }
+  // with no slot used twice, count slots below count means each of them is used
+  for (int i = 0; i < TOWER_TYPE_COUNT; i++)
+  {
+    TowerGroup *group = &world->towerGroups[i];
+    for (int j = 0; j < group->count; j++)
+    {
+      if (group->towerIndices[j] == UINT16_MAX)
+      {
+        return 0;
+      }
+    }
+  }
+
+  uint8_t isFree[TOWER_MAX_COUNT] = {0};
+  for (int i = 0; i < world->freeTowerSlotCount; i++)
   {
-    if (towers[i].towerType == towerType)
+    uint16_t slot = world->freeTowerSlots[i];
+    if (slot >= world->towerCount || isFree[slot] || world->towers[slot].towerType != TOWER_TYPE_NONE)
     {
-      return &towers[i];
+      return 0;
     }
+    isFree[slot] = 1;
   }
-  return 0;
+  return 1;
+}
+
+Tower *GetTowerByType(World *world, uint8_t towerType)
+{
+  TowerGroup *group = &world->towerGroups[towerType];
+  return group->count > 0 ? &world->towers[group->towerIndices[0]] : 0;
 }
 
 int GetTowerCosts(uint8_t towerType)
@@ -228,75 +365,94 @@ float TowerGetMaxHealth(Tower *tower)
   return towerTypeConfigs[tower->towerType].maxHealth;
 }
 
-void TowerDraw()
+static void TowerDrawModelGroup(const RenderSnapshot *snapshot, uint8_t towerType, Color fallbackColor)
 {
-  for (int i = 0; i < towerCount; i++)
+  for (int i = snapshot->towerGroupStart[towerType]; i < snapshot->towerGroupStart[towerType + 1]; i++)
   {
-    Tower tower = towers[i];
-    if (tower.towerType == TOWER_TYPE_NONE)
+    const RenderSnapshotTower *tower = &snapshot->towers[i];
+    if (!VisibilityIsVisible(tower->x, tower->y))
     {
       continue;
     }
+    if (towerModels[towerType].materials)
+    {
+      RenderQueueAddModel(towerModels[towerType], MatrixTranslate(tower->x, 0.0f, tower->y), WHITE);
+    } else {
+      CubeBatchAdd((Vector3){tower->x, 0.5f, tower->y}, (Vector3){1.0f, 1.0f, 1.0f}, fallbackColor);
+    }
+  }
+}
 
-    switch (tower.towerType)
+static void TowerDrawArcherGroup(const RenderSnapshot *snapshot)
+{
+  for (int i = snapshot->towerGroupStart[TOWER_TYPE_ARCHER]; i < snapshot->towerGroupStart[TOWER_TYPE_ARCHER + 1]; i++)
+  {
+    const RenderSnapshotTower *tower = &snapshot->towers[i];
+    if (!VisibilityIsVisible(tower->x, tower->y))
     {
-    case TOWER_TYPE_ARCHER:
-      {
-        Vector2 screenPosTower = GetWorldToScreen((Vector3){tower.x, 0.0f, tower.y}, currentLevel->camera);
-        Vector2 screenPosTarget = GetWorldToScreen((Vector3){tower.lastTargetPosition.x, 0.0f, tower.lastTargetPosition.y}, currentLevel->camera);
-        DrawModel(towerModels[TOWER_TYPE_WALL], (Vector3){tower.x, 0.0f, tower.y}, 1.0f, WHITE);
-        DrawSpriteUnit(archerUnit, (Vector3){tower.x, 1.0f, tower.y}, 0, screenPosTarget.x > screenPosTower.x, 
-          tower.cooldown > 0.2f ? SPRITE_UNIT_PHASE_WEAPON_COOLDOWN : SPRITE_UNIT_PHASE_WEAPON_IDLE);
-      }
-      break;
-    case TOWER_TYPE_BALLISTA:
-      DrawCube((Vector3){tower.x, 0.5f, tower.y}, 1.0f, 1.0f, 1.0f, BROWN);
-      break;
-    case TOWER_TYPE_CATAPULT:
-      DrawCube((Vector3){tower.x, 0.5f, tower.y}, 1.0f, 1.0f, 1.0f, DARKGRAY);
-      break;
-    default:
-      if (towerModels[tower.towerType].materials)
-      {
-        DrawModel(towerModels[tower.towerType], (Vector3){tower.x, 0.0f, tower.y}, 1.0f, WHITE);
-      } else {
-        DrawCube((Vector3){tower.x, 0.5f, tower.y}, 1.0f, 1.0f, 1.0f, LIGHTGRAY);
-      }
-      break;
+      continue;
     }
+    Vector2 screenPosTower = GetWorldToScreen((Vector3){tower->x, 0.0f, tower->y}, snapshot->camera);
+    Vector2 screenPosTarget = GetWorldToScreen((Vector3){tower->lastTargetPosition.x, 0.0f, tower->lastTargetPosition.y}, snapshot->camera);
+    RenderQueueAddModel(towerModels[TOWER_TYPE_WALL], MatrixTranslate(tower->x, 0.0f, tower->y), WHITE);
+    DrawSpriteUnit(archerUnit, (Vector3){tower->x, 1.0f, tower->y}, 0, screenPosTarget.x > screenPosTower.x, 
+      tower->isCoolingDown ? SPRITE_UNIT_PHASE_WEAPON_COOLDOWN : SPRITE_UNIT_PHASE_WEAPON_IDLE);
   }
 }
 
-void TowerUpdate()
+void TowerDraw(const RenderSnapshot *snapshot)
+{
+  TowerDrawModelGroup(snapshot, TOWER_TYPE_BASE, LIGHTGRAY);
+  TowerDrawModelGroup(snapshot, TOWER_TYPE_WALL, LIGHTGRAY);
+  TowerDrawModelGroup(snapshot, TOWER_TYPE_BALLISTA, BROWN);
+  TowerDrawModelGroup(snapshot, TOWER_TYPE_CATAPULT, DARKGRAY);
+  TowerDrawArcherGroup(snapshot);
+}
+
+void TowerUpdate(World *world)
 {
-  for (int i = 0; i < towerCount; i++)
+  TowerGunUpdateGroup(world, TOWER_TYPE_ARCHER);
+  TowerGunUpdateGroup(world, TOWER_TYPE_BALLISTA);
+  TowerGunUpdateGroup(world, TOWER_TYPE_CATAPULT);
+}
+
+// copies the towers group by group, so the groups stay together in the snapshot
+void TowerWriteSnapshot(World *world, RenderSnapshot *snapshot)
+{
+  int count = 0;
+  for (int towerType = 0; towerType < TOWER_TYPE_COUNT; towerType++)
   {
-    Tower *tower = &towers[i];
-    switch (tower->towerType)
+    snapshot->towerGroupStart[towerType] = count;
+    TowerGroup *group = &world->towerGroups[towerType];
+    for (int i = 0; i < group->count; i++)
     {
-    case TOWER_TYPE_BALLISTA:
-    case TOWER_TYPE_ARCHER:
-      TowerGunUpdate(tower);
-      break;
+      Tower *tower = &world->towers[group->towerIndices[i]];
+      float maxHealth = TowerGetMaxHealth(tower);
+      snapshot->towers[count++] = (RenderSnapshotTower){
+        .x = tower->x,
+        .y = tower->y,
+        .towerType = tower->towerType,
+        .isCoolingDown = tower->cooldown > 0.2f,
+        .lastTargetPosition = tower->lastTargetPosition,
+        .healthRatio = tower->damage <= 0.0f ? 1.0f : (maxHealth - tower->damage) / maxHealth,
+      };
     }
   }
+  snapshot->towerGroupStart[TOWER_TYPE_COUNT] = count;
+  snapshot->towerCount = count;
 }
 
-void TowerDrawHealthBars(Camera3D camera)
+void TowerDrawHealthBars(const RenderSnapshot *snapshot)
 {
-  for (int i = 0; i < towerCount; i++)
+  for (int i = 0; i < snapshot->towerCount; i++)
   {
-    Tower *tower = &towers[i];
-    if (tower->towerType == TOWER_TYPE_NONE || tower->damage <= 0.0f)
+    const RenderSnapshotTower *tower = &snapshot->towers[i];
+    if (tower->healthRatio >= 1.0f)
     {
       continue;
     }
     
     Vector3 position = (Vector3){tower->x, 0.5f, tower->y};
-    float maxHealth = TowerGetMaxHealth(tower);
-    float health = maxHealth - tower->damage;
-    float healthRatio = health / maxHealth;
-    
-    DrawHealthBar(camera, position, healthRatio, GREEN, 35.0f);
+    HealthBarBatchAdd(position, tower->healthRatio, GREEN, 35.0f);
   }
 }
\ No newline at end of file
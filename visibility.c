@@ -0,0 +1,110 @@
+#include "td_main.h"
+#include <raymath.h>
+#include <rlgl.h>
+
+// The world is split into square chunks. Once per frame, every chunk's
+// bounding box is tested against the camera frustum; the draw functions then
+// only have to look up the chunk of an object to know whether drawing it can
+// be skipped. Static scenery is merged per chunk, so whole chunks of it are
+// skipped at once.
+static Frustum visibilityFrustum;
+static uint8_t visibleChunks[VISIBILITY_CHUNK_COUNT * VISIBILITY_CHUNK_COUNT];
+
+static int VisibilityGetChunkCoordinate(float position)
+{
+  // everything outside the chunk grid belongs to the border chunks
+  int chunk = (int)floorf((position - VISIBILITY_CHUNK_ORIGIN) / VISIBILITY_CHUNK_SIZE);
+  return chunk < 0 ? 0 : (chunk >= VISIBILITY_CHUNK_COUNT ? VISIBILITY_CHUNK_COUNT - 1 : chunk);
+}
+
+int VisibilityGetChunk(float x, float z)
+{
+  return VisibilityGetChunkCoordinate(z) * VISIBILITY_CHUNK_COUNT + VisibilityGetChunkCoordinate(x);
+}
+
+BoundingBox VisibilityGetChunkBounds(int chunk)
+{
+  int chunkX = chunk % VISIBILITY_CHUNK_COUNT;
+  int chunkZ = chunk / VISIBILITY_CHUNK_COUNT;
+  // objects are assigned to chunks by their position but can reach into the
+  // neighbouring chunks, so the bounds are grown by a margin
+  BoundingBox bounds = {
+    .min = {
+      VISIBILITY_CHUNK_ORIGIN + chunkX * VISIBILITY_CHUNK_SIZE - VISIBILITY_CHUNK_MARGIN,
+      VISIBILITY_CHUNK_MIN_Y,
+      VISIBILITY_CHUNK_ORIGIN + chunkZ * VISIBILITY_CHUNK_SIZE - VISIBILITY_CHUNK_MARGIN},
+    .max = {
+      VISIBILITY_CHUNK_ORIGIN + (chunkX + 1) * VISIBILITY_CHUNK_SIZE + VISIBILITY_CHUNK_MARGIN,
+      VISIBILITY_CHUNK_MAX_Y,
+      VISIBILITY_CHUNK_ORIGIN + (chunkZ + 1) * VISIBILITY_CHUNK_SIZE + VISIBILITY_CHUNK_MARGIN},
+  };
+  // the border chunks also hold everything beyond the grid
+  const float far = 1.0e6f;
+  if (chunkX == 0) bounds.min.x = -far;
+  if (chunkZ == 0) bounds.min.z = -far;
+  if (chunkX == VISIBILITY_CHUNK_COUNT - 1) bounds.max.x = far;
+  if (chunkZ == VISIBILITY_CHUNK_COUNT - 1) bounds.max.z = far;
+  return bounds;
+}
+
+// extracts the 6 clip planes from a view-projection matrix; the plane normals point inwards
+Frustum FrustumFromMatrix(Matrix m)
+{
+  Vector4 row0 = {m.m0, m.m4, m.m8, m.m12};
+  Vector4 row1 = {m.m1, m.m5, m.m9, m.m13};
+  Vector4 row2 = {m.m2, m.m6, m.m10, m.m14};
+  Vector4 row3 = {m.m3, m.m7, m.m11, m.m15};
+  Frustum frustum = {
+    .planes = {
+      {row3.x + row0.x, row3.y + row0.y, row3.z + row0.z, row3.w + row0.w},
+      {row3.x - row0.x, row3.y - row0.y, row3.z - row0.z, row3.w - row0.w},
+      {row3.x + row1.x, row3.y + row1.y, row3.z + row1.z, row3.w + row1.w},
+      {row3.x - row1.x, row3.y - row1.y, row3.z - row1.z, row3.w - row1.w},
+      {row3.x + row2.x, row3.y + row2.y, row3.z + row2.z, row3.w + row2.w},
+      {row3.x - row2.x, row3.y - row2.y, row3.z - row2.z, row3.w - row2.w},
+    },
+  };
+  return frustum;
+}
+
+int FrustumIntersectsBox(const Frustum *frustum, BoundingBox box)
+{
+  for (int i = 0; i < 6; i++)
+  {
+    Vector4 plane = frustum->planes[i];
+    // the corner of the box that is furthest along the plane normal; if even
+    // that one is outside, the whole box is
+    Vector3 corner = {
+      plane.x >= 0.0f ? box.max.x : box.min.x,
+      plane.y >= 0.0f ? box.max.y : box.min.y,
+      plane.z >= 0.0f ? box.max.z : box.min.z,
+    };
+    if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0.0f)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// determines the visible chunks for the current frame; must be called inside BeginMode3D
+void VisibilityUpdate()
+{
+  // use the matrices BeginMode3D has set up, so the frustum matches exactly what is drawn
+  visibilityFrustum = FrustumFromMatrix(MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection()));
+  for (int i = 0; i < VISIBILITY_CHUNK_COUNT * VISIBILITY_CHUNK_COUNT; i++)
+  {
+    visibleChunks[i] = FrustumIntersectsBox(&visibilityFrustum, VisibilityGetChunkBounds(i));
+  }
+}
+
+int VisibilityIsChunkVisible(int chunk)
+{
+  return visibleChunks[chunk];
+}
+
+// whether an object at this position may be visible (assuming it fits into the chunk margin)
+int VisibilityIsVisible(float x, float z)
+{
+  return visibleChunks[VisibilityGetChunk(x, z)];
+}
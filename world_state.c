@@ -0,0 +1,816 @@
+#include "td_main.h"
+#include <stdio.h>
+#include <string.h>
+
+// Writes the state of a world into a byte buffer and reads it back. Only what
+// can't be derived is stored: the live enemies, towers, projectiles and
+// particles, the level and the clock. The lookup structures (tower grid and
+// groups) and the flow field are rebuilt after reading, and scratch buffers
+// that are empty between ticks are not stored at all. Reading a state back
+// into a world makes it continue exactly like the world it was taken from.
+//
+// The state is packed field by field instead of copying the structs, so it
+// doesn't depend on the struct layout or the capacities of the build:
+// - small integers (grid positions, counts, generations) are varints, signed
+//   ones zigzag encoded; types and states are single bytes
+// - floats that are usually zero or equal to the current time get a bit in
+//   a flags byte instead of 4 bytes
+// - dead enemy and tower slots only keep what a later spawn doesn't overwrite
+// - only the used part of the enemy move paths and the particle rings is stored
+// The floats themselves are stored with all 32 bits, in the byte order of the
+// machine like the asset pack; rounding them would make a restored match drift
+// away from the original one, which the replays rely on not to happen.
+
+//# Byte buffer
+
+// makes room for size more bytes; returns where to write them or 0 if out of memory
+uint8_t *ByteBufferReserve(ByteBuffer *buffer, int size)
+{
+  if (buffer->isOverflow)
+  {
+    return 0;
+  }
+  if (buffer->size + size > buffer->capacity)
+  {
+    int capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+    while (capacity < buffer->size + size)
+    {
+      capacity *= 2;
+    }
+    uint8_t *grown = MemRealloc(buffer->data, capacity);
+    if (!grown)
+    {
+      buffer->isOverflow = 1;
+      return 0;
+    }
+    buffer->data = grown;
+    buffer->capacity = capacity;
+  }
+  return buffer->data + buffer->size;
+}
+
+void ByteBufferWrite(ByteBuffer *buffer, const void *data, int size)
+{
+  uint8_t *target = ByteBufferReserve(buffer, size);
+  if (target)
+  {
+    memcpy(target, data, size);
+    buffer->size += size;
+  }
+}
+
+// returns 0 and leaves the data untouched if the buffer has less than size bytes left
+int ByteBufferRead(ByteBuffer *buffer, void *data, int size)
+{
+  if (buffer->isOverflow || size < 0 || buffer->readOffset + size > buffer->size)
+  {
+    buffer->isOverflow = 1;
+    return 0;
+  }
+  memcpy(data, buffer->data + buffer->readOffset, size);
+  buffer->readOffset += size;
+  return 1;
+}
+
+void ByteBufferFree(ByteBuffer *buffer)
+{
+  MemFree(buffer->data);
+  *buffer = (ByteBuffer){0};
+}
+
+//# Packing
+
+// the most bytes a single enemy, tower, ... can take; space for a whole array
+// is reserved at once so the writers don't need to check each field
+#define WORLD_STATE_VARINT_MAX_SIZE 5
+#define WORLD_STATE_ENEMY_MAX_SIZE (3 + 6 * WORLD_STATE_VARINT_MAX_SIZE + 9 * 4 + ENEMY_MAX_PATH_COUNT * 8)
+#define WORLD_STATE_TOWER_MAX_SIZE (1 + 3 * WORLD_STATE_VARINT_MAX_SIZE + 4 * 4)
+#define WORLD_STATE_PROJECTILE_MAX_SIZE (1 + 2 * WORLD_STATE_VARINT_MAX_SIZE + 14 * 4)
+
+#define WORLD_STATE_ENEMY_START_TIME 1
+#define WORLD_STATE_ENEMY_DAMAGE 2
+#define WORLD_STATE_ENEMY_FUTURE_DAMAGE 4
+#define WORLD_STATE_ENEMY_CONTACT_TIME 8
+
+typedef struct WorldStateReader
+{
+  const uint8_t *cursor;
+  const uint8_t *end;
+  int isOverflow;
+} WorldStateReader;
+
+static inline void WorldStatePutU8(uint8_t **cursor, uint8_t value)
+{
+  *(*cursor)++ = value;
+}
+
+static inline void WorldStatePutVarint(uint8_t **cursor, uint32_t value)
+{
+  while (value >= 0x80)
+  {
+    *(*cursor)++ = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  *(*cursor)++ = value;
+}
+
+static inline void WorldStatePutSigned(uint8_t **cursor, int32_t value)
+{
+  WorldStatePutVarint(cursor, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+static inline void WorldStatePutFloat(uint8_t **cursor, float value)
+{
+  memcpy(*cursor, &value, sizeof(float));
+  *cursor += sizeof(float);
+}
+
+static inline uint8_t WorldStateGetU8(WorldStateReader *reader)
+{
+  if (reader->cursor >= reader->end)
+  {
+    reader->isOverflow = 1;
+    return 0;
+  }
+  return *reader->cursor++;
+}
+
+static inline uint32_t WorldStateGetVarint(WorldStateReader *reader)
+{
+  uint32_t value = 0;
+  for (int shift = 0; shift < 35; shift += 7)
+  {
+    uint8_t byte = WorldStateGetU8(reader);
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+    {
+      return value;
+    }
+  }
+  reader->isOverflow = 1;
+  return 0;
+}
+
+static inline int32_t WorldStateGetSigned(WorldStateReader *reader)
+{
+  uint32_t value = WorldStateGetVarint(reader);
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static inline float WorldStateGetFloat(WorldStateReader *reader)
+{
+  float value = 0.0f;
+  if (reader->end - reader->cursor < (long)sizeof(float))
+  {
+    reader->isOverflow = 1;
+    reader->cursor = reader->end;
+    return value;
+  }
+  memcpy(&value, reader->cursor, sizeof(float));
+  reader->cursor += sizeof(float);
+  return value;
+}
+
+// compares the bits, so -0.0 is not taken for 0.0
+static inline int WorldStateIsSameFloat(float a, float b)
+{
+  return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+//# Writing
+
+static void WorldStateWriteLevel(uint8_t **cursor, Level *level)
+{
+  WorldStatePutSigned(cursor, level->seed);
+  WorldStatePutU8(cursor, level->state);
+  WorldStatePutU8(cursor, level->nextState);
+  Camera3D *camera = &level->camera;
+  float cameraFloats[] = {camera->position.x, camera->position.y, camera->position.z, camera->target.x,
+    camera->target.y, camera->target.z, camera->up.x, camera->up.y, camera->up.z, camera->fovy};
+  for (int i = 0; i < 10; i++)
+  {
+    WorldStatePutFloat(cursor, cameraFloats[i]);
+  }
+  WorldStatePutVarint(cursor, camera->projection);
+  WorldStatePutSigned(cursor, level->initialGold);
+  WorldStatePutSigned(cursor, level->playerGold);
+  for (int i = 0; i < 10; i++)
+  {
+    EnemyWave *wave = &level->waves[i];
+    WorldStatePutU8(cursor, wave->enemyType);
+    WorldStatePutU8(cursor, wave->wave);
+    WorldStatePutVarint(cursor, wave->count);
+    WorldStatePutFloat(cursor, wave->interval);
+    WorldStatePutFloat(cursor, wave->delay);
+    WorldStatePutFloat(cursor, wave->spawnPosition.x);
+    WorldStatePutFloat(cursor, wave->spawnPosition.y);
+    WorldStatePutVarint(cursor, wave->spawned);
+    WorldStatePutFloat(cursor, wave->timeToSpawnNext);
+  }
+  WorldStatePutSigned(cursor, level->currentWave);
+  WorldStatePutFloat(cursor, level->waveEndTimer);
+}
+
+static void WorldStateWriteEnemy(uint8_t **cursor, Enemy *enemy, float time)
+{
+  WorldStatePutU8(cursor, enemy->enemyType);
+  WorldStatePutVarint(cursor, enemy->generation);
+  uint8_t flags = 0;
+  flags |= WorldStateIsSameFloat(enemy->contactTime, 0.0f) ? 0 : WORLD_STATE_ENEMY_CONTACT_TIME;
+  if (enemy->enemyType == ENEMY_TYPE_NONE)
+  {
+    // a spawn in this slot resets everything but the generation and the contact time
+    WorldStatePutU8(cursor, flags);
+    if (flags)
+    {
+      WorldStatePutFloat(cursor, enemy->contactTime);
+    }
+    return;
+  }
+  flags |= WorldStateIsSameFloat(enemy->startMovingTime, time) ? 0 : WORLD_STATE_ENEMY_START_TIME;
+  flags |= WorldStateIsSameFloat(enemy->damage, 0.0f) ? 0 : WORLD_STATE_ENEMY_DAMAGE;
+  flags |= WorldStateIsSameFloat(enemy->futureDamage, 0.0f) ? 0 : WORLD_STATE_ENEMY_FUTURE_DAMAGE;
+  WorldStatePutU8(cursor, flags);
+  if (flags & WORLD_STATE_ENEMY_CONTACT_TIME) WorldStatePutFloat(cursor, enemy->contactTime);
+  if (flags & WORLD_STATE_ENEMY_START_TIME) WorldStatePutFloat(cursor, enemy->startMovingTime);
+  if (flags & WORLD_STATE_ENEMY_DAMAGE) WorldStatePutFloat(cursor, enemy->damage);
+  if (flags & WORLD_STATE_ENEMY_FUTURE_DAMAGE) WorldStatePutFloat(cursor, enemy->futureDamage);
+
+  WorldStatePutSigned(cursor, enemy->currentX);
+  WorldStatePutSigned(cursor, enemy->currentY);
+  // the next cell is always a neighbour (or the same cell)
+  WorldStatePutSigned(cursor, enemy->nextX - enemy->currentX);
+  WorldStatePutSigned(cursor, enemy->nextY - enemy->currentY);
+  WorldStatePutFloat(cursor, enemy->simPosition.x);
+  WorldStatePutFloat(cursor, enemy->simPosition.y);
+  WorldStatePutFloat(cursor, enemy->simVelocity.x);
+  WorldStatePutFloat(cursor, enemy->simVelocity.y);
+  WorldStatePutFloat(cursor, enemy->walkedDistance);
+  WorldStatePutU8(cursor, enemy->movePathCount);
+  for (int i = 0; i < enemy->movePathCount; i++)
+  {
+    WorldStatePutFloat(cursor, enemy->movePath[i].x);
+    WorldStatePutFloat(cursor, enemy->movePath[i].y);
+  }
+}
+
+static void WorldStateWriteTower(uint8_t **cursor, Tower *tower)
+{
+  // a reused slot is cleared, so nothing of a destroyed tower matters
+  WorldStatePutU8(cursor, tower->towerType);
+  if (tower->towerType == TOWER_TYPE_NONE)
+  {
+    return;
+  }
+  WorldStatePutSigned(cursor, tower->x);
+  WorldStatePutSigned(cursor, tower->y);
+  WorldStatePutVarint(cursor, tower->groupSlot);
+  WorldStatePutFloat(cursor, tower->lastTargetPosition.x);
+  WorldStatePutFloat(cursor, tower->lastTargetPosition.y);
+  WorldStatePutFloat(cursor, tower->cooldown);
+  WorldStatePutFloat(cursor, tower->damage);
+}
+
+static void WorldStateWriteProjectile(uint8_t **cursor, Projectile *projectile)
+{
+  WorldStatePutU8(cursor, projectile->projectileType);
+  float floats[] = {projectile->shootTime, projectile->arrivalTime, projectile->distance, projectile->damage,
+    projectile->areaDamageRadius, projectile->position.x, projectile->position.y, projectile->position.z,
+    projectile->target.x, projectile->target.y, projectile->target.z, projectile->directionNormal.x,
+    projectile->directionNormal.y, projectile->directionNormal.z};
+  for (int i = 0; i < 14; i++)
+  {
+    WorldStatePutFloat(cursor, floats[i]);
+  }
+  WorldStatePutVarint(cursor, projectile->targetEnemy.index);
+  WorldStatePutVarint(cursor, projectile->targetEnemy.generation);
+}
+
+// copies the live part of a particle ring, which may wrap around the end
+static void WorldStateWriteRing(uint8_t **cursor, const float *ring, uint32_t tail, uint32_t count)
+{
+  uint32_t start = tail & (PARTICLE_EMITTER_CAPACITY - 1);
+  uint32_t firstCount = count < PARTICLE_EMITTER_CAPACITY - start ? count : PARTICLE_EMITTER_CAPACITY - start;
+  memcpy(*cursor, ring + start, firstCount * sizeof(float));
+  memcpy(*cursor + firstCount * sizeof(float), ring, (count - firstCount) * sizeof(float));
+  *cursor += count * sizeof(float);
+}
+
+void WorldWriteState(World *world, ByteBuffer *buffer)
+{
+  uint8_t *start = ByteBufferReserve(buffer, 1024 + world->freeTowerSlotCount * WORLD_STATE_VARINT_MAX_SIZE +
+    world->areaDamageCount * 5 * sizeof(float));
+  if (!start)
+  {
+    return;
+  }
+  uint8_t *cursor = start;
+  memcpy(cursor, &(uint32_t){WORLD_STATE_MAGIC}, 4);
+  cursor += 4;
+  WorldStatePutVarint(&cursor, WORLD_STATE_VERSION);
+  WorldStatePutVarint(&cursor, world->tick);
+  WorldStatePutFloat(&cursor, world->gameTime.time);
+  WorldStatePutFloat(&cursor, world->gameTime.deltaTime);
+  WorldStatePutSigned(&cursor, world->seed);
+  WorldStateWriteLevel(&cursor, &world->level);
+  WorldStatePutVarint(&cursor, world->freeTowerSlotCount);
+  for (int i = 0; i < world->freeTowerSlotCount; i++)
+  {
+    WorldStatePutVarint(&cursor, world->freeTowerSlots[i]);
+  }
+  WorldStatePutVarint(&cursor, world->particleRandomState);
+  WorldStatePutVarint(&cursor, world->areaDamageSequence);
+  WorldStatePutVarint(&cursor, world->areaDamageCount);
+  for (int i = 0; i < world->areaDamageCount; i++)
+  {
+    AreaDamage *areaDamage = &world->areaDamages[i];
+    WorldStatePutFloat(&cursor, areaDamage->position.x);
+    WorldStatePutFloat(&cursor, areaDamage->position.y);
+    WorldStatePutFloat(&cursor, areaDamage->radius);
+    WorldStatePutFloat(&cursor, areaDamage->damage);
+    WorldStatePutFloat(&cursor, areaDamage->pushbackPower);
+  }
+  buffer->size += cursor - start;
+
+  if (!(cursor = start = ByteBufferReserve(buffer, WORLD_STATE_VARINT_MAX_SIZE + world->enemyCount * WORLD_STATE_ENEMY_MAX_SIZE)))
+  {
+    return;
+  }
+  WorldStatePutVarint(&cursor, world->enemyCount);
+  for (int i = 0; i < world->enemyCount; i++)
+  {
+    WorldStateWriteEnemy(&cursor, &world->enemies[i], world->gameTime.time);
+  }
+  buffer->size += cursor - start;
+
+  if (!(cursor = start = ByteBufferReserve(buffer, WORLD_STATE_VARINT_MAX_SIZE + world->towerCount * WORLD_STATE_TOWER_MAX_SIZE)))
+  {
+    return;
+  }
+  WorldStatePutVarint(&cursor, world->towerCount);
+  for (int i = 0; i < world->towerCount; i++)
+  {
+    WorldStateWriteTower(&cursor, &world->towers[i]);
+  }
+  buffer->size += cursor - start;
+
+  if (!(cursor = start = ByteBufferReserve(buffer, WORLD_STATE_VARINT_MAX_SIZE + world->projectileCount * WORLD_STATE_PROJECTILE_MAX_SIZE)))
+  {
+    return;
+  }
+  WorldStatePutVarint(&cursor, world->projectileCount);
+  for (int i = 0; i < world->projectileCount; i++)
+  {
+    WorldStateWriteProjectile(&cursor, &world->projectiles[i]);
+  }
+  buffer->size += cursor - start;
+
+  for (int i = 0; i < PARTICLE_TYPE_COUNT - 1; i++)
+  {
+    ParticleEmitter *emitter = &world->particleEmitters[i];
+    uint32_t count = emitter->head - emitter->tail;
+    if (!(cursor = start = ByteBufferReserve(buffer, 2 * WORLD_STATE_VARINT_MAX_SIZE + count * 7 * sizeof(float))))
+    {
+      return;
+    }
+    // the tail is kept since the ring slots depend on it
+    WorldStatePutVarint(&cursor, emitter->tail);
+    WorldStatePutVarint(&cursor, count);
+    const float *rings[] = {emitter->positionX, emitter->positionY, emitter->positionZ,
+      emitter->velocityX, emitter->velocityY, emitter->velocityZ, emitter->spawnTime};
+    for (int f = 0; f < 7; f++)
+    {
+      WorldStateWriteRing(&cursor, rings[f], emitter->tail, count);
+    }
+    buffer->size += cursor - start;
+  }
+}
+
+//# Reading
+
+static void WorldStateReadLevel(WorldStateReader *reader, Level *level)
+{
+  level->seed = WorldStateGetSigned(reader);
+  level->state = WorldStateGetU8(reader);
+  level->nextState = WorldStateGetU8(reader);
+  Camera3D *camera = &level->camera;
+  float *cameraFloats[] = {&camera->position.x, &camera->position.y, &camera->position.z, &camera->target.x,
+    &camera->target.y, &camera->target.z, &camera->up.x, &camera->up.y, &camera->up.z, &camera->fovy};
+  for (int i = 0; i < 10; i++)
+  {
+    *cameraFloats[i] = WorldStateGetFloat(reader);
+  }
+  camera->projection = WorldStateGetVarint(reader);
+  level->initialGold = WorldStateGetSigned(reader);
+  level->playerGold = WorldStateGetSigned(reader);
+  for (int i = 0; i < 10; i++)
+  {
+    EnemyWave *wave = &level->waves[i];
+    wave->enemyType = WorldStateGetU8(reader);
+    wave->wave = WorldStateGetU8(reader);
+    wave->count = WorldStateGetVarint(reader);
+    wave->interval = WorldStateGetFloat(reader);
+    wave->delay = WorldStateGetFloat(reader);
+    wave->spawnPosition.x = WorldStateGetFloat(reader);
+    wave->spawnPosition.y = WorldStateGetFloat(reader);
+    wave->spawned = WorldStateGetVarint(reader);
+    wave->timeToSpawnNext = WorldStateGetFloat(reader);
+  }
+  level->currentWave = WorldStateGetSigned(reader);
+  level->waveEndTimer = WorldStateGetFloat(reader);
+}
+
+static void WorldStateReadEnemy(WorldStateReader *reader, Enemy *enemy, float time)
+{
+  *enemy = (Enemy){0};
+  enemy->enemyType = WorldStateGetU8(reader);
+  enemy->generation = WorldStateGetVarint(reader);
+  uint8_t flags = WorldStateGetU8(reader);
+  if (flags & WORLD_STATE_ENEMY_CONTACT_TIME) enemy->contactTime = WorldStateGetFloat(reader);
+  if (enemy->enemyType == ENEMY_TYPE_NONE)
+  {
+    return;
+  }
+  enemy->startMovingTime = flags & WORLD_STATE_ENEMY_START_TIME ? WorldStateGetFloat(reader) : time;
+  if (flags & WORLD_STATE_ENEMY_DAMAGE) enemy->damage = WorldStateGetFloat(reader);
+  if (flags & WORLD_STATE_ENEMY_FUTURE_DAMAGE) enemy->futureDamage = WorldStateGetFloat(reader);
+
+  enemy->currentX = WorldStateGetSigned(reader);
+  enemy->currentY = WorldStateGetSigned(reader);
+  enemy->nextX = enemy->currentX + WorldStateGetSigned(reader);
+  enemy->nextY = enemy->currentY + WorldStateGetSigned(reader);
+  enemy->simPosition.x = WorldStateGetFloat(reader);
+  enemy->simPosition.y = WorldStateGetFloat(reader);
+  enemy->simVelocity.x = WorldStateGetFloat(reader);
+  enemy->simVelocity.y = WorldStateGetFloat(reader);
+  enemy->walkedDistance = WorldStateGetFloat(reader);
+  enemy->movePathCount = WorldStateGetU8(reader);
+  if (enemy->movePathCount > ENEMY_MAX_PATH_COUNT)
+  {
+    reader->isOverflow = 1;
+    return;
+  }
+  for (int i = 0; i < enemy->movePathCount; i++)
+  {
+    enemy->movePath[i].x = WorldStateGetFloat(reader);
+    enemy->movePath[i].y = WorldStateGetFloat(reader);
+  }
+}
+
+static void WorldStateReadTower(WorldStateReader *reader, Tower *tower)
+{
+  *tower = (Tower){0};
+  tower->towerType = WorldStateGetU8(reader);
+  if (tower->towerType == TOWER_TYPE_NONE)
+  {
+    return;
+  }
+  if (tower->towerType >= TOWER_TYPE_COUNT)
+  {
+    reader->isOverflow = 1;
+    return;
+  }
+  tower->x = WorldStateGetSigned(reader);
+  tower->y = WorldStateGetSigned(reader);
+  uint32_t groupSlot = WorldStateGetVarint(reader);
+  if (groupSlot >= TOWER_MAX_COUNT)
+  {
+    reader->isOverflow = 1;
+    return;
+  }
+  tower->groupSlot = groupSlot;
+  tower->lastTargetPosition.x = WorldStateGetFloat(reader);
+  tower->lastTargetPosition.y = WorldStateGetFloat(reader);
+  tower->cooldown = WorldStateGetFloat(reader);
+  tower->damage = WorldStateGetFloat(reader);
+}
+
+static void WorldStateReadProjectile(WorldStateReader *reader, Projectile *projectile)
+{
+  projectile->projectileType = WorldStateGetU8(reader);
+  float *floats[] = {&projectile->shootTime, &projectile->arrivalTime, &projectile->distance, &projectile->damage,
+    &projectile->areaDamageRadius, &projectile->position.x, &projectile->position.y, &projectile->position.z,
+    &projectile->target.x, &projectile->target.y, &projectile->target.z, &projectile->directionNormal.x,
+    &projectile->directionNormal.y, &projectile->directionNormal.z};
+  for (int i = 0; i < 14; i++)
+  {
+    *floats[i] = WorldStateGetFloat(reader);
+  }
+  projectile->targetEnemy.index = WorldStateGetVarint(reader);
+  projectile->targetEnemy.generation = WorldStateGetVarint(reader);
+}
+
+// skips skipCount floats, then reads count floats into the ring
+static void WorldStateReadRing(WorldStateReader *reader, float *ring, uint32_t tail, uint32_t count, uint32_t skipCount)
+{
+  if ((size_t)(reader->end - reader->cursor) < ((size_t)count + skipCount) * sizeof(float))
+  {
+    reader->isOverflow = 1;
+    return;
+  }
+  reader->cursor += skipCount * sizeof(float);
+  uint32_t start = tail & (PARTICLE_EMITTER_CAPACITY - 1);
+  uint32_t firstCount = count < PARTICLE_EMITTER_CAPACITY - start ? count : PARTICLE_EMITTER_CAPACITY - start;
+  memcpy(ring + start, reader->cursor, firstCount * sizeof(float));
+  memcpy(ring, reader->cursor + firstCount * sizeof(float), (count - firstCount) * sizeof(float));
+  reader->cursor += count * sizeof(float);
+}
+
+// returns 0 if the state is broken or of another version; the world may be
+// partly overwritten then and should be reset with InitLevel
+int WorldReadState(World *world, ByteBuffer *buffer)
+{
+  WorldStateReader reader = {
+    .cursor = buffer->data + buffer->readOffset,
+    .end = buffer->data + buffer->size,
+  };
+  uint32_t magic = 0;
+  if (reader.end - reader.cursor >= 4)
+  {
+    memcpy(&magic, reader.cursor, 4);
+    reader.cursor += 4;
+  }
+  if (magic != WORLD_STATE_MAGIC || WorldStateGetVarint(&reader) != WORLD_STATE_VERSION)
+  {
+    TraceLog(LOG_WARNING, "WORLD: not a world state or an unsupported version");
+    return 0;
+  }
+
+  world->tick = WorldStateGetVarint(&reader);
+  world->gameTime.time = WorldStateGetFloat(&reader);
+  world->gameTime.deltaTime = WorldStateGetFloat(&reader);
+  world->seed = WorldStateGetSigned(&reader);
+  WorldStateReadLevel(&reader, &world->level);
+  uint32_t freeTowerSlotCount = WorldStateGetVarint(&reader);
+  if (freeTowerSlotCount > TOWER_MAX_COUNT)
+  {
+    return 0;
+  }
+  world->freeTowerSlotCount = freeTowerSlotCount;
+  for (int i = 0; i < world->freeTowerSlotCount; i++)
+  {
+    // checked against the towers in TowerRebuildLookups
+    uint32_t slot = WorldStateGetVarint(&reader);
+    world->freeTowerSlots[i] = slot < TOWER_MAX_COUNT ? slot : UINT16_MAX;
+  }
+  world->particleRandomState = WorldStateGetVarint(&reader);
+  world->areaDamageSequence = WorldStateGetVarint(&reader);
+  uint32_t areaDamageCount = WorldStateGetVarint(&reader);
+  if (areaDamageCount > AREA_DAMAGE_MAX_COUNT)
+  {
+    return 0;
+  }
+  world->areaDamageCount = areaDamageCount;
+  for (int i = 0; i < world->areaDamageCount; i++)
+  {
+    AreaDamage *areaDamage = &world->areaDamages[i];
+    areaDamage->position.x = WorldStateGetFloat(&reader);
+    areaDamage->position.y = WorldStateGetFloat(&reader);
+    areaDamage->radius = WorldStateGetFloat(&reader);
+    areaDamage->damage = WorldStateGetFloat(&reader);
+    areaDamage->pushbackPower = WorldStateGetFloat(&reader);
+  }
+
+  uint32_t enemyCount = WorldStateGetVarint(&reader);
+  if (enemyCount > ENEMY_MAX_COUNT)
+  {
+    TraceLog(LOG_WARNING, "WORLD: the state has %u enemies, this build only supports %d", enemyCount, ENEMY_MAX_COUNT);
+    return 0;
+  }
+  for (uint32_t i = 0; i < enemyCount; i++)
+  {
+    WorldStateReadEnemy(&reader, &world->enemies[i], world->gameTime.time);
+  }
+  for (int i = enemyCount; i < world->enemyCount; i++)
+  {
+    world->enemies[i] = (Enemy){0};
+  }
+  world->enemyCount = enemyCount;
+  world->enemyDamageEventCount = 0;
+
+  uint32_t towerCount = WorldStateGetVarint(&reader);
+  if (towerCount > TOWER_MAX_COUNT)
+  {
+    return 0;
+  }
+  world->towerCount = towerCount;
+  for (int i = 0; i < world->towerCount; i++)
+  {
+    WorldStateReadTower(&reader, &world->towers[i]);
+  }
+
+  uint32_t projectileCount = WorldStateGetVarint(&reader);
+  if (projectileCount > PROJECTILE_MAX_COUNT)
+  {
+    return 0;
+  }
+  world->projectileCount = projectileCount;
+  for (int i = 0; i < world->projectileCount; i++)
+  {
+    WorldStateReadProjectile(&reader, &world->projectiles[i]);
+  }
+
+  for (int i = 0; i < PARTICLE_TYPE_COUNT - 1; i++)
+  {
+    ParticleEmitter *emitter = &world->particleEmitters[i];
+    uint32_t tail = WorldStateGetVarint(&reader);
+    uint32_t count = WorldStateGetVarint(&reader);
+    // a build with smaller emitters drops the oldest particles
+    uint32_t skipCount = count > PARTICLE_EMITTER_CAPACITY ? count - PARTICLE_EMITTER_CAPACITY : 0;
+    tail += skipCount;
+    count -= skipCount;
+    float *rings[] = {emitter->positionX, emitter->positionY, emitter->positionZ,
+      emitter->velocityX, emitter->velocityY, emitter->velocityZ, emitter->spawnTime};
+    for (int f = 0; f < 7; f++)
+    {
+      WorldStateReadRing(&reader, rings[f], tail, count, skipCount);
+    }
+    emitter->tail = tail;
+    emitter->head = tail + count;
+  }
+
+  if (reader.isOverflow)
+  {
+    TraceLog(LOG_WARNING, "WORLD: the state is truncated or broken");
+    return 0;
+  }
+  if (!TowerRebuildLookups(world))
+  {
+    TraceLog(LOG_WARNING, "WORLD: the towers in the state don't add up");
+    return 0;
+  }
+  buffer->readOffset = reader.cursor - buffer->data;
+  // the flow field only depends on the towers
+  PathFindingMapUpdate(world);
+  world->stateHash = WorldHashState(world);
+  return 1;
+}
+
+//# Hashing
+
+// An xxHash64 style hash of what the simulation decides: the live enemies,
+// towers and projectiles plus the level's gold, state and wave. Two worlds
+// that hash the same after a tick took the same decisions; a difference shows
+// up in the tick it happens, without comparing full states. The fields are
+// hashed one by one (floats by their bits), so padding and unused slots don't
+// matter. Four independent lanes keep the multiplications from waiting on
+// each other, like in xxHash.
+
+#define WORLD_HASH_PRIME_1 0x9E3779B185EBCA87ull
+#define WORLD_HASH_PRIME_2 0xC2B2AE3D27D4EB4Full
+#define WORLD_HASH_PRIME_3 0x165667B19E3779F9ull
+#define WORLD_HASH_PRIME_4 0x85EBCA77C2B2AE63ull
+
+static inline uint64_t WorldHashRotate(uint64_t value, int bits)
+{
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t WorldHashRound(uint64_t lane, uint64_t input)
+{
+  lane += input * WORLD_HASH_PRIME_2;
+  return WorldHashRotate(lane, 31) * WORLD_HASH_PRIME_1;
+}
+
+static inline uint64_t WorldHashMerge(uint64_t hash, uint64_t lane)
+{
+  hash ^= WorldHashRound(0, lane);
+  return hash * WORLD_HASH_PRIME_1 + WORLD_HASH_PRIME_4;
+}
+
+static inline uint64_t WorldHashFloats(float a, float b)
+{
+  uint32_t bits[2];
+  memcpy(&bits[0], &a, sizeof(float));
+  memcpy(&bits[1], &b, sizeof(float));
+  return (uint64_t)bits[0] << 32 | bits[1];
+}
+
+static inline uint64_t WorldHashInts(uint32_t a, uint32_t b)
+{
+  return (uint64_t)a << 32 | b;
+}
+
+uint64_t WorldHashState(World *world)
+{
+  uint64_t lanes[4] = {
+    WORLD_HASH_PRIME_1 + WORLD_HASH_PRIME_2,
+    WORLD_HASH_PRIME_2,
+    0,
+    -WORLD_HASH_PRIME_1,
+  };
+  Level *level = &world->level;
+  lanes[0] = WorldHashRound(lanes[0], WorldHashInts(level->state, level->currentWave));
+  lanes[1] = WorldHashRound(lanes[1], WorldHashInts(level->playerGold, world->tick));
+  lanes[2] = WorldHashRound(lanes[2], WorldHashFloats(world->gameTime.time, level->waveEndTimer));
+
+  for (int i = 0; i < world->enemyCount; i++)
+  {
+    Enemy *enemy = &world->enemies[i];
+    if (enemy->enemyType == ENEMY_TYPE_NONE)
+    {
+      continue;
+    }
+    lanes[0] = WorldHashRound(lanes[0], WorldHashInts((uint32_t)i << 16 | enemy->generation,
+      (uint32_t)enemy->enemyType << 8 | enemy->movePathCount));
+    lanes[1] = WorldHashRound(lanes[1], WorldHashInts((uint16_t)enemy->currentX << 16 | (uint16_t)enemy->currentY,
+      (uint16_t)enemy->nextX << 16 | (uint16_t)enemy->nextY));
+    lanes[2] = WorldHashRound(lanes[2], WorldHashFloats(enemy->simPosition.x, enemy->simPosition.y));
+    lanes[3] = WorldHashRound(lanes[3], WorldHashFloats(enemy->simVelocity.x, enemy->simVelocity.y));
+    lanes[0] = WorldHashRound(lanes[0], WorldHashFloats(enemy->walkedDistance, enemy->startMovingTime));
+    lanes[1] = WorldHashRound(lanes[1], WorldHashFloats(enemy->damage, enemy->futureDamage));
+    lanes[2] = WorldHashRound(lanes[2], WorldHashFloats(enemy->contactTime, 0.0f));
+    for (int j = 0; j < enemy->movePathCount; j++)
+    {
+      lanes[3] = WorldHashRound(lanes[3], WorldHashFloats(enemy->movePath[j].x, enemy->movePath[j].y));
+    }
+  }
+
+  for (int i = 0; i < world->towerCount; i++)
+  {
+    Tower *tower = &world->towers[i];
+    if (tower->towerType == TOWER_TYPE_NONE)
+    {
+      continue;
+    }
+    lanes[0] = WorldHashRound(lanes[0], WorldHashInts((uint32_t)i << 16 | tower->towerType,
+      (uint16_t)tower->x << 16 | (uint16_t)tower->y));
+    lanes[1] = WorldHashRound(lanes[1], WorldHashFloats(tower->lastTargetPosition.x, tower->lastTargetPosition.y));
+    lanes[2] = WorldHashRound(lanes[2], WorldHashFloats(tower->cooldown, tower->damage));
+    lanes[3] = WorldHashRound(lanes[3], tower->groupSlot);
+  }
+
+  for (int i = 0; i < world->projectileCount; i++)
+  {
+    Projectile *projectile = &world->projectiles[i];
+    lanes[0] = WorldHashRound(lanes[0], WorldHashInts(projectile->projectileType,
+      (uint32_t)projectile->targetEnemy.index << 16 | projectile->targetEnemy.generation));
+    lanes[1] = WorldHashRound(lanes[1], WorldHashFloats(projectile->shootTime, projectile->arrivalTime));
+    lanes[2] = WorldHashRound(lanes[2], WorldHashFloats(projectile->distance, projectile->damage));
+    lanes[3] = WorldHashRound(lanes[3], WorldHashFloats(projectile->areaDamageRadius, projectile->position.x));
+    lanes[0] = WorldHashRound(lanes[0], WorldHashFloats(projectile->position.y, projectile->position.z));
+    lanes[1] = WorldHashRound(lanes[1], WorldHashFloats(projectile->target.x, projectile->target.y));
+    lanes[2] = WorldHashRound(lanes[2], WorldHashFloats(projectile->target.z, projectile->directionNormal.x));
+    lanes[3] = WorldHashRound(lanes[3], WorldHashFloats(projectile->directionNormal.y, projectile->directionNormal.z));
+  }
+
+  uint64_t hash = WorldHashRotate(lanes[0], 1) + WorldHashRotate(lanes[1], 7) + WorldHashRotate(lanes[2], 12) +
+    WorldHashRotate(lanes[3], 18);
+  for (int i = 0; i < 4; i++)
+  {
+    hash = WorldHashMerge(hash, lanes[i]);
+  }
+  hash += WorldHashInts(world->enemyCount, world->towerCount) ^ world->projectileCount;
+  hash ^= hash >> 33;
+  hash *= WORLD_HASH_PRIME_2;
+  hash ^= hash >> 29;
+  hash *= WORLD_HASH_PRIME_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+//# Files
+
+// writes to a temporary file first, so a crash while saving doesn't destroy the last good save
+int WorldSaveFile(World *world, const char *filename)
+{
+  ByteBuffer buffer = {0};
+  WorldWriteState(world, &buffer);
+  char tempFilename[512];
+  snprintf(tempFilename, sizeof(tempFilename), "%s.tmp", filename);
+  FILE *file = buffer.isOverflow ? 0 : fopen(tempFilename, "wb");
+  int isSaved = file && fwrite(buffer.data, 1, buffer.size, file) == (size_t)buffer.size;
+  if (file)
+  {
+    isSaved = fclose(file) == 0 && isSaved;
+  }
+  isSaved = isSaved && rename(tempFilename, filename) == 0;
+  if (!isSaved)
+  {
+    TraceLog(LOG_WARNING, "WORLD: could not save to %s", filename);
+  }
+  ByteBufferFree(&buffer);
+  return isSaved;
+}
+
+int WorldLoadFile(World *world, const char *filename)
+{
+  FILE *file = fopen(filename, "rb");
+  if (!file)
+  {
+    TraceLog(LOG_WARNING, "WORLD: could not open %s", filename);
+    return 0;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  ByteBuffer buffer = {.data = size > 0 ? MemAlloc(size) : 0, .capacity = size};
+  if (buffer.data)
+  {
+    buffer.size = fread(buffer.data, 1, size, file);
+  }
+  fclose(file);
+  int isLoaded = WorldReadState(world, &buffer);
+  ByteBufferFree(&buffer);
+  return isLoaded;
+}
\ No newline at end of file